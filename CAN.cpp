@@ -13,11 +13,13 @@
  */
 #include "Arduino.h"
 #include "CAN.h"
+#include "mcp2515_regs.h"
 #include <SPI.h>
 
 CanMessage::CanMessage ()
 {
     extended = 0;
+    rtr = 0;
     id = DEFAULT_CAN_ID;
     len = 0;
     pos = 0;
@@ -66,10 +68,9 @@ void CanMessage::setData (const char *data, uint8_t len)
     setData ((const uint8_t *)data, len);
 }
 
-void CanMessage::send ()
+uint8_t CanMessage::send ()
 {
-    mcp2515_set_msg (0, id, data, len, extended);
-    mcp2515_request_tx (0);
+    return CANClass::send (*this);
 }
 
 byte CanMessage::getByteFromData()
@@ -125,6 +126,7 @@ void CanMessage::getData (char *data)
 
 void CanMessage::clear (void)
 {
+    this->rtr = 0;
     this->len = 0;
     this->pos = 0;
 }
@@ -139,6 +141,11 @@ void CanMessage::print (uint8_t format)
     Serial.print (len, DEC);
     Serial.print ("]:");
 
+    if (this->rtr) {
+        Serial.println (" remote");
+        return;
+    }
+
     for (i = 0; i < this->len; i++) {
         Serial.print (" ");
         Serial.print (this->data[i], format);
@@ -150,22 +157,185 @@ void CanMessage::print (uint8_t format)
 /*
  * CANClass
  */
-void CANClass::begin(uint32_t bit_time) {
+uint32_t CANClass::init_time;
+CanMessage CANClass::rx_msg;
+uint8_t CANClass::rx_pending;
+#if CAN_ON_CHANGE_MAX
+CANClass::OnChange CANClass::on_change[CAN_ON_CHANGE_MAX];
+#endif
+uint8_t CANClass::on_change_count;
+#if CAN_REPLY_MAX
+CANClass::Reply CANClass::replies[CAN_REPLY_MAX];
+#endif
+uint8_t CANClass::reply_count;
+int8_t CANClass::reply_loaded = -1;
+uint8_t CANClass::reply_stale;
+uint8_t CANClass::reply_loads;
+CanReplyStats CANClass::reply_stats;
+uint32_t CANClass::bit_time = CAN_SPEED_500000;
+uint32_t CANClass::baud_order[CAN_AUTOBAUD_RATES] = {
+    CAN_SPEED_500000, CAN_SPEED_250000, CAN_SPEED_125000, CAN_SPEED_1000000,
+    CAN_SPEED_100000, CAN_SPEED_50000, CAN_SPEED_62500, CAN_SPEED_20000,
+    CAN_SPEED_31250, CAN_SPEED_25000, CAN_SPEED_15625,
+};
+#if CAN_SHAPER_MAX
+CANClass::Shaper CANClass::shapers[CAN_SHAPER_MAX];
+#endif
+uint8_t CANClass::shaper_count;
+uint8_t CANClass::load_limit;
+uint16_t CANClass::load_burst;
+uint16_t CANClass::load_tokens;
+uint32_t CANClass::last_refill;
+uint8_t CANClass::policy;
+CanShapingStats CANClass::shaping_stats;
+#if CAN_TX_QUEUE_LEN
+CanMessage CANClass::tx_queue[CAN_TX_QUEUE_LEN];
+#endif
+uint8_t CANClass::tx_head;
+uint8_t CANClass::tx_count;
+uint8_t CANClass::error_state;
+uint8_t CANClass::recover_policy;
+uint16_t CANClass::backoff_min = CAN_BACKOFF_MIN;
+uint16_t CANClass::backoff_max = CAN_BACKOFF_MAX;
+uint16_t CANClass::backoff = CAN_BACKOFF_MIN;
+uint16_t CANClass::tx_timeout = CAN_TX_TIMEOUT;
+uint8_t CANClass::off_mode;
+uint32_t CANClass::off_since;
+uint8_t CANClass::recovering;
+uint32_t CANClass::recovered;
+uint32_t CANClass::last_check;
+uint32_t CANClass::tx_started;
+uint8_t CANClass::tx_busy;
+CanMessage CANClass::tx_last;
+can_error_fn CANClass::error_fn;
+CanErrorStats CANClass::error_stats;
+#if CAN_LANES_MAX
+CANClass::Lane CANClass::lanes[CAN_LANES_MAX];
+#endif
+uint8_t CANClass::lane_count;
+uint32_t CANClass::lane_unmatched;
+uint8_t CANClass::hybrid;
+uint8_t CANClass::hybrid_irq;
+uint16_t CANClass::hybrid_idle;
+volatile uint8_t CANClass::hybrid_woken;
+uint32_t CANClass::hybrid_since;
+uint32_t CANClass::hybrid_last;
+uint16_t CANClass::hybrid_batch;
+CanHybridStats CANClass::hybrid_stats;
+uint32_t CANClass::load_bits;
+uint32_t CANClass::load_start;
+uint8_t CANClass::load;
+
+boolean CANClass::begin(uint32_t bit_time) {
+    struct mcp2515_config cfg;
+    uint32_t start;
+    uint8_t status;
+
     SPI.begin();
     SPI.setDataMode(SPI_MODE0);
     SPI.setBitOrder(MSBFIRST);
     SPI.setClockDivider(SPI_CLOCK_DIV4);
 
-    mcp2515_init (bit_time);
+    start = micros ();
+
+    CANClass::bit_time = bit_time;
+    mcp2515_config_init (&cfg, bit_time);
+
+    /* Masks are left clear so no bits are filtered (allow all
+     * identifiers).  Set a filter for both standard and extended message
+     * types.  Since the extended bit in the filter registers in not
+     * maskable, an acceptance filter has to be explicitly set to accept
+     * both types. */
+    mcp2515_config_filter (&cfg, 0, 0, 0);
+    mcp2515_config_filter (&cfg, 1, 0, 1);
+
+    status = mcp2515_configure (&cfg, MCP2515_RESET_POLLS);
+
+    init_time = micros () - start;
+
+    error_state = CAN_ERROR_ACTIVE;
+    recovering = 0;
+    tx_busy = 0;
+    reply_loaded = -1;
+
+    return status == MCP2515_OK;
+}
+
+/*
+ * Listen at a bit time until a message arrives, a receive error is
+ * flagged or the time runs out.  Only MERRF tells of errors: in listen
+ * only mode the controller sends no error frames and leaves the error
+ * counters alone, so EFLG's warning and passive flags never change.
+ */
+boolean CANClass::tryBaud (uint32_t bit_time, uint16_t timeout)
+{
+    struct mcp2515_config cfg;
+    uint8_t flags;
+    uint8_t clear = 0;
+    uint32_t start;
+
+    if (!changeMode (CAN_MODE_CONFIG))
+        return false;
+
+    /* Only the bit timing changes between candidates */
+    mcp2515_config_init (&cfg, bit_time);
+    mcp2515_write_regs (CNF3, cfg.cnf, sizeof(cfg.cnf));
+
+    mcp2515_write_regs (CANINTF, &clear, 1);
+
+    if (!changeMode (CAN_MODE_LISTEN_ONLY))
+        return false;
+
+    start = millis ();
+    do {
+        mcp2515_read_regs (CANINTF, &flags, 1);
 
-    /* Set mask to not filter any bits (allow all identifiers) */
-    mcp2515_set_rx_mask (0, 0, 0);
+        if (flags & (1 << MERRF))
+            return false;
 
-    /* Set a filter for both standard and extended message types.  Since the
-     * extended bit in the filter registers in not maskable, an acceptance
-     * filter has to be explicitly set to accept both types. */
-    mcp2515_set_rx_filter (0, 0, 0);
-    mcp2515_set_rx_filter (1, 0, 1);
+        if (flags & ((1 << RX0IF) | (1 << RX1IF)))
+            return true;
+    } while ((uint32_t)(millis () - start) < timeout);
+
+    return false;
+}
+
+uint32_t CANClass::autoBaud (uint16_t timeout, uint32_t hint)
+{
+    uint32_t found = 0;
+    uint8_t i;
+
+    if (!begin (hint ? hint : baud_order[0]))
+        return 0;
+
+    if (hint && tryBaud (hint, timeout))
+        found = hint;
+
+    for (i = 0; !found && i < CAN_AUTOBAUD_RATES; i++) {
+        if (baud_order[i] != hint && tryBaud (baud_order[i], timeout))
+            found = baud_order[i];
+    }
+
+    if (!found) {
+        changeMode (CAN_MODE_CONFIG);
+        return 0;
+    }
+
+    /* Move the bit time found to the front */
+    for (i = 0; i < CAN_AUTOBAUD_RATES && baud_order[i] != found; i++)
+        ;
+    if (i < CAN_AUTOBAUD_RATES) {
+        for (; i > 0; i--)
+            baud_order[i] = baud_order[i - 1];
+        baud_order[0] = found;
+    }
+
+    CANClass::bit_time = found;
+    return found;
+}
+
+uint32_t CANClass::initTime() {
+    return init_time;
 }
 
 void CANClass::end() {
@@ -177,24 +347,1178 @@ void CANClass::setMode (uint8_t mode)
     mcp2515_set_mode (mode);
 }
 
+uint8_t CANClass::getMode ()
+{
+    return mcp2515_get_mode ();
+}
+
+boolean CANClass::changeMode (uint8_t mode, uint16_t max_polls)
+{
+    return (boolean)mcp2515_change_mode (mode, max_polls);
+}
+
 uint8_t CANClass::ready ()
 {
-    return mcp2515_msg_sent ();
+    supervise ();
+
+    if (error_state == CAN_ERROR_BUS_OFF)
+        return 0;
+
+    if (!mcp2515_msg_sent ())
+        return 0;
+
+    tx_busy = 0;
+    return 1;
+}
+
+/*
+ * Read the next message from whichever receive buffer holds one, and
+ * optionally the number of the filter it matched
+ */
+uint8_t CANClass::receive (CanMessage *m, uint8_t *filter)
+{
+    uint8_t raw[MCP2515_RAW_SIZE];
+    uint8_t status;
+    uint8_t rx_buf;
+    uint8_t i;
+
+    /* Remote requests that are answered from the reply cache are not
+     * delivered */
+    do {
+        status = mcp2515_rx_status ();
+        if (status & MCP2515_RXSTATUS_RX0)
+            rx_buf = 0;
+        else if (status & MCP2515_RXSTATUS_RX1)
+            rx_buf = 1;
+        else
+            return 0;
+
+        if (filter) {
+            *filter = status & MCP2515_RXSTATUS_FILTER;
+            if (*filter >= 6)
+                *filter -= 6;   /* RXF0 or RXF1, rolled over into RXB1 */
+        }
+
+        m->clear ();
+        m->len = mcp2515_read_raw (rx_buf, raw);
+        m->extended = mcp2515_raw_get_id (raw, &m->id) ? 1 : 0;
+        m->rtr = mcp2515_raw_is_remote (raw) ? 1 : 0;
+
+        if (!m->rtr) {
+            for (i = 0; i < m->len; i++)
+                m->data[i] = raw[5 + i];
+        }
+
+        count_load (frameBits (*m));
+
+        if (hybrid == HYBRID_POLLING) {
+            hybrid_stats.frames++;
+            hybrid_batch++;
+        }
+    } while (m->rtr && reply_count && answer (*m));
+
+    return 1;
+}
+
+/*
+ * Returns true if the message should be dropped because it carries the
+ * same data as the last one delivered with its identifier
+ */
+boolean CANClass::unchanged (const CanMessage *m)
+{
+#if CAN_ON_CHANGE_MAX
+    OnChange *c;
+    uint8_t len = m->len > CAN_BYTES_MAX ? CAN_BYTES_MAX : m->len;
+    uint32_t now;
+
+    if (m->rtr)
+        return false;
+
+    for (c = on_change; c < on_change + on_change_count; c++) {
+        if (c->id == m->id && c->extended == m->extended)
+            break;
+    }
+    if (c == on_change + on_change_count)
+        return false;
+
+    now = millis ();
+
+    if (c->seen && c->len == len && memcmp (c->data, m->data, len) == 0 &&
+        (c->heartbeat == 0 || (uint32_t)(now - c->last) < c->heartbeat)) {
+        c->suppressed++;
+        return true;
+    }
+
+    c->seen = 1;
+    c->len = len;
+    memcpy (c->data, m->data, len);
+    c->last = now;
+#else
+    (void)m;
+#endif
+
+    return false;
 }
 
 boolean CANClass::available ()
 {
-    return (boolean)mcp2515_msg_received();
+    boolean found;
+
+    if (rx_pending)
+        return true;
+
+    if (hybrid && !hybrid_wait ())
+        return false;
+
+    if (on_change_count == 0 && !hybrid && !reply_count)
+        return (boolean)mcp2515_msg_received();
+
+    found = false;
+    while (receive (&rx_msg)) {
+        if (on_change_count == 0 || !unchanged (&rx_msg)) {
+            rx_pending = 1;
+            found = true;
+            break;
+        }
+    }
+
+    if (hybrid)
+        hybrid_result (found);
+
+    return found;
 }
 
 CanMessage CANClass::getMessage ()
 {
     CanMessage m;
 
-    m.extended = mcp2515_get_msg (0, &m.id, m.data, &m.len);
+    if (rx_pending) {
+        rx_pending = 0;
+        return rx_msg;
+    }
+
+    if (!receive (&m))
+        m.extended = mcp2515_get_msg (0, &m.id, m.data, &m.len);
 
     return m;
 }
 
+boolean CANClass::setOnChange (uint32_t id, uint16_t heartbeat,
+                               uint8_t extended)
+{
+#if CAN_ON_CHANGE_MAX
+    OnChange *c;
+
+    if (on_change_count >= CAN_ON_CHANGE_MAX)
+        return false;
+
+    c = &on_change[on_change_count++];
+    c->id = id;
+    c->extended = extended ? 1 : 0;
+    c->heartbeat = heartbeat;
+    c->suppressed = 0;
+    c->seen = 0;
+
+    return true;
+#else
+    (void)id;
+    (void)heartbeat;
+    (void)extended;
+    return false;
+#endif
+}
+
+void CANClass::clearOnChange ()
+{
+    on_change_count = 0;
+}
+
+uint32_t CANClass::suppressed ()
+{
+    uint32_t total = 0;
+#if CAN_ON_CHANGE_MAX
+    uint8_t i;
+
+    for (i = 0; i < on_change_count; i++)
+        total += on_change[i].suppressed;
+#endif
+
+    return total;
+}
+
+uint32_t CANClass::suppressed (uint32_t id, uint8_t extended)
+{
+#if CAN_ON_CHANGE_MAX
+    uint8_t i;
+
+    for (i = 0; i < on_change_count; i++) {
+        if (on_change[i].id == id && on_change[i].extended == (extended ? 1 : 0))
+            return on_change[i].suppressed;
+    }
+#else
+    (void)id;
+    (void)extended;
+#endif
+
+    return 0;
+}
+
+/*
+ * Remote request replies
+ */
+boolean CANClass::publish (uint32_t id, const uint8_t *data, uint8_t len,
+                           uint8_t extended)
+{
+#if CAN_REPLY_MAX
+    Reply *r;
+    uint8_t i;
+
+    extended = extended ? 1 : 0;
+    if (len > CAN_BYTES_MAX)
+        len = CAN_BYTES_MAX;
+
+    for (i = 0; i < reply_count; i++) {
+        if (replies[i].id == id && replies[i].extended == extended)
+            break;
+    }
+    if (i == reply_count) {
+        if (reply_count >= CAN_REPLY_MAX)
+            return false;
+        reply_count++;
+        mcp2515_reserve_tx (1 << 2);
+    }
+
+    r = &replies[i];
+    r->id = id;
+    r->extended = extended;
+    r->len = len;
+    memcpy (r->data, data, len);
+
+    /* Preload TXB2 if it is free or holds the old data */
+    if (reply_loaded < 0 || reply_loaded == i)
+        load_reply (i);
+
+    return true;
+#else
+    (void)id;
+    (void)data;
+    (void)len;
+    (void)extended;
+    return false;
+#endif
+}
+
+void CANClass::clearReplies ()
+{
+    reply_count = 0;
+    reply_loaded = -1;
+    mcp2515_reserve_tx (0);
+}
+
+const CanReplyStats &CANClass::replyStats ()
+{
+    return reply_stats;
+}
+
+/*
+ * Load a reply into TXB2, unless a reply is still being sent from it
+ */
+void CANClass::load_reply (uint8_t i)
+{
+#if CAN_REPLY_MAX
+    Reply *r = &replies[i];
+
+    reply_loaded = i;
+    reply_stale = 1;
+
+    if (mcp2515_read_status () & MCP2515_STATUS_TX2REQ)
+        return;
+
+    mcp2515_set_msg (2, r->id, r->data, r->len, r->extended);
+    reply_stale = 0;
+    reply_loads = mcp2515_tx_loads (2);
+#else
+    (void)i;
+#endif
+}
+
+/*
+ * Answer a remote request from the reply cache.  Returns false if the
+ * identifier is not published.
+ */
+boolean CANClass::answer (const CanMessage &m)
+{
+#if CAN_REPLY_MAX
+    CanMessage reply;
+    uint8_t i;
+
+    for (i = 0; i < reply_count; i++) {
+        if (replies[i].id == m.id && replies[i].extended == m.extended)
+            break;
+    }
+    if (i == reply_count)
+        return false;
+
+    if (error_state == CAN_ERROR_BUS_OFF) {
+        reply_stats.busy++;
+        return true;
+    }
+
+    /* TXB2 may have been loaded with something else since */
+    if (reply_loaded == i && !reply_stale &&
+        mcp2515_tx_loads (2) == reply_loads) {
+        /* Requesting a buffer that is still sending is harmless */
+        reply_stats.preloaded++;
+    } else {
+        load_reply (i);
+        if (reply_stale) {
+            reply_stats.busy++;
+            return true;
+        }
+    }
+
+    mcp2515_request_tx (2);
+    reply_stats.answered++;
+
+    reply.extended = m.extended;
+    reply.len = replies[i].len;
+    count_load (frameBits (reply));
+
+    return true;
+#else
+    (void)m;
+    return false;
+#endif
+}
+
+/*
+ * Hybrid interrupt and polling receive
+ */
+void CANClass::hybrid_isr ()
+{
+    /* The INT pin stays low until the messages are read, so the level
+     * interrupt is disabled until polling is over */
+    detachInterrupt (hybrid_irq);
+    hybrid_woken = 1;
+}
+
+void CANClass::beginHybrid (uint8_t irq, uint16_t idle)
+{
+    uint8_t caninte;
+
+    endHybrid ();
+
+    /* Assert INT for received messages and error flag changes */
+    mcp2515_read_regs (CANINTE, &caninte, 1);
+    caninte |= (1 << RX0IE) | (1 << RX1IE) | (1 << ERRIE);
+    mcp2515_write_regs (CANINTE, &caninte, 1);
+
+    hybrid_irq = irq;
+    hybrid_idle = idle;
+    hybrid_woken = 0;
+    hybrid_since = micros ();
+    hybrid = HYBRID_ARMED;
+
+    attachInterrupt (irq, hybrid_isr, LOW);
+}
+
+void CANClass::endHybrid ()
+{
+    if (hybrid == HYBRID_ARMED)
+        detachInterrupt (hybrid_irq);
+    hybrid = HYBRID_OFF;
+}
+
+const CanHybridStats &CANClass::hybridStats ()
+{
+    return hybrid_stats;
+}
+
+/*
+ * Returns true if the controller should be polled; false while waiting
+ * for the interrupt
+ */
+boolean CANClass::hybrid_wait ()
+{
+    uint32_t now;
+
+    if (hybrid == HYBRID_POLLING)
+        return true;
+
+    if (!hybrid_woken)
+        return false;
+
+    now = micros ();
+    hybrid_woken = 0;
+    hybrid_stats.wakeups++;
+    hybrid_stats.irq_time += now - hybrid_since;
+    hybrid_since = now;
+    hybrid_last = now;
+    hybrid_batch = 0;
+    hybrid = HYBRID_POLLING;
+
+    return true;
+}
+
+/*
+ * Account for a poll, and go back to waiting for the interrupt once the
+ * bus has been quiet for the idle time
+ */
+void CANClass::hybrid_result (boolean received)
+{
+    uint32_t now = micros ();
+
+    hybrid_stats.polls++;
+
+    if (received) {
+        hybrid_last = now;
+        return;
+    }
+
+    if ((uint32_t)(now - hybrid_last) < hybrid_idle)
+        return;
+
+    hybrid_stats.poll_time += now - hybrid_since;
+    hybrid_since = now;
+    if (hybrid_batch > hybrid_stats.max_batch)
+        hybrid_stats.max_batch = hybrid_batch;
+
+    /* A message that arrived since the last poll holds INT low, so the
+     * interrupt triggers at once */
+    hybrid = HYBRID_ARMED;
+    attachInterrupt (hybrid_irq, hybrid_isr, LOW);
+}
+
+/*
+ * Receive lanes
+ */
+int8_t CANClass::addLane (CanLaneEntry *ring, uint8_t size, uint8_t overflow)
+{
+#if CAN_LANES_MAX
+    Lane *l;
+
+    if (lane_count >= CAN_LANES_MAX || size == 0)
+        return -1;
+
+    l = &lanes[lane_count];
+    memset (l, 0, sizeof(*l));
+    l->ring = ring;
+    l->size = size;
+    l->overflow = overflow;
+
+    return lane_count++;
+#else
+    (void)ring;
+    (void)size;
+    (void)overflow;
+    return -1;
+#endif
+}
+
+void CANClass::setLaneIds (uint8_t lane, uint32_t first, uint32_t last,
+                           uint8_t extended)
+{
+#if CAN_LANES_MAX
+    lanes[lane].first = first;
+    lanes[lane].last = last;
+    lanes[lane].extended = extended ? 1 : 0;
+    lanes[lane].ids = 1;
+#else
+    (void)lane;
+    (void)first;
+    (void)last;
+    (void)extended;
+#endif
+}
+
+void CANClass::setLaneFilters (uint8_t lane, uint8_t filters)
+{
+#if CAN_LANES_MAX
+    lanes[lane].filters = filters;
+#else
+    (void)lane;
+    (void)filters;
+#endif
+}
+
+void CANClass::clearLanes ()
+{
+    lane_count = 0;
+}
+
+uint8_t CANClass::pumpLanes ()
+{
+#if CAN_LANES_MAX
+    CanLaneEntry *e;
+    CanMessage m;
+    Lane *l;
+    uint8_t filter;
+    uint8_t moved = 0;
+    uint8_t any;
+
+    if (lane_count == 0)
+        return 0;
+
+    if (hybrid && !hybrid_wait ())
+        return 0;
+
+    while (receive (&m, &filter)) {
+        if (on_change_count && unchanged (&m))
+            continue;
+
+        for (l = lanes; l < lanes + lane_count; l++) {
+            any = !l->filters && !l->ids;
+            if (any || (l->filters & (1 << filter)))
+                break;
+            if (l->ids && m.extended == l->extended &&
+                m.id >= l->first && m.id <= l->last)
+                break;
+        }
+        if (l == lanes + lane_count) {
+            lane_unmatched++;
+            continue;
+        }
+
+        if (l->count == l->size) {
+            l->stats.dropped++;
+            if (l->overflow == CAN_LANE_DROP_NEW)
+                continue;
+            l->head = (l->head + 1) % l->size;
+            l->count--;
+        }
+
+        e = &l->ring[(l->head + l->count++) % l->size];
+        e->msg = m;
+        e->time = micros ();
+
+        l->stats.received++;
+        if (l->count > l->stats.high_water)
+            l->stats.high_water = l->count;
+        moved++;
+    }
+
+    if (hybrid)
+        hybrid_result (moved != 0);
+
+    return moved;
+#else
+    return 0;
+#endif
+}
+
+boolean CANClass::laneAvailable (uint8_t lane)
+{
+#if CAN_LANES_MAX
+    return lanes[lane].count != 0;
+#else
+    (void)lane;
+    return false;
+#endif
+}
+
+boolean CANClass::getLaneMessage (uint8_t lane, CanMessage *m)
+{
+#if CAN_LANES_MAX
+    Lane *l = &lanes[lane];
+    CanLaneEntry *e;
+    uint32_t delay;
+
+    if (l->count == 0)
+        return false;
+
+    e = &l->ring[l->head];
+    *m = e->msg;
+    l->head = (l->head + 1) % l->size;
+    l->count--;
+
+    delay = micros () - e->time;
+    l->stats.delivered++;
+    l->stats.delay_sum += delay;
+    if (delay > l->stats.delay_max)
+        l->stats.delay_max = delay;
+
+    return true;
+#else
+    (void)lane;
+    (void)m;
+    return false;
+#endif
+}
+
+int8_t CANClass::getPriorityMessage (CanMessage *m)
+{
+    uint8_t i;
+
+    pumpLanes ();
+
+    for (i = 0; i < lane_count; i++) {
+        if (getLaneMessage (i, m))
+            return i;
+    }
+
+    return -1;
+}
+
+const CanLaneStats &CANClass::laneStats (uint8_t lane)
+{
+#if CAN_LANES_MAX
+    return lanes[lane].stats;
+#else
+    static const CanLaneStats none = CanLaneStats ();
+
+    (void)lane;
+    return none;
+#endif
+}
+
+uint32_t CANClass::laneUnmatched ()
+{
+    return lane_unmatched;
+}
+
+/*
+ * Transmit shaping
+ */
+uint16_t CANClass::frameBits (const CanMessage &m)
+{
+    uint8_t len = m.len > CAN_BYTES_MAX ? CAN_BYTES_MAX : m.len;
+    uint16_t stuffed;
+
+    if (m.rtr)
+        len = 0;
+
+    /* Bits from SOF to the end of the CRC may be stuffed, worst case one
+     * stuff bit after the first five and then after every four more */
+    if (m.extended)
+        stuffed = 54 + 8 * len;
+    else
+        stuffed = 34 + 8 * len;
+
+    /* Add the CRC delimiter, ACK slot and delimiter, EOF and interframe
+     * space */
+    return stuffed + (stuffed - 1) / 4 + 13;
+}
+
+/*
+ * Add the budget earned since the last refill
+ */
+void CANClass::refill ()
+{
+    uint32_t now = micros ();
+    uint32_t elapsed = now - last_refill;
+    uint32_t bits;
+#if CAN_SHAPER_MAX
+    Shaper *s;
+#endif
+
+    /* Both budgets are full after a second */
+    if (elapsed > 1000000)
+        elapsed = 1000000;
+
+    if (load_limit) {
+        /* bits = elapsed (us) * 1000 / bit_time (ns) * load_limit / 100 */
+        bits = elapsed * load_limit * 10 / bit_time;
+        if (bits == 0)
+            return;   /* Wait for a whole bit, or the remainder is lost */
+        bits += load_tokens;
+        load_tokens = bits > load_burst ? load_burst : bits;
+    }
+
+#if CAN_SHAPER_MAX
+    for (s = shapers; s < shapers + shaper_count; s++) {
+        s->tokens += elapsed;
+        if (s->tokens > s->limit)
+            s->tokens = s->limit;
+    }
+#endif
+
+    last_refill = now;
+}
+
+/*
+ * Check whether a message fits in its budget and charge it if it does
+ */
+boolean CANClass::in_budget (const CanMessage &m, uint16_t bits)
+{
+#if CAN_SHAPER_MAX
+    Shaper *s;
+#endif
+
+    refill ();
+
+    if (load_limit && load_tokens < bits)
+        return false;
+
+#if CAN_SHAPER_MAX
+    for (s = shapers; s < shapers + shaper_count; s++) {
+        if (s->id == m.id && s->extended == (m.extended ? 1 : 0))
+            break;
+    }
+    if (s < shapers + shaper_count) {
+        if (s->tokens < s->period)
+            return false;
+        s->tokens -= s->period;
+    }
+#else
+    (void)m;
+#endif
+
+    if (load_limit)
+        load_tokens -= bits;
+
+    return true;
+}
+
+void CANClass::transmit (const CanMessage &m, uint16_t bits)
+{
+    if (m.rtr)
+        mcp2515_set_remote (0, m.id, m.len, m.extended);
+    else
+        mcp2515_set_msg (0, m.id, m.data, m.len, m.extended);
+    mcp2515_request_tx (0);
+
+    tx_last = m;
+    tx_started = millis ();
+    tx_busy = 1;
+
+    sent (bits);
+}
+
+/*
+ * Add a message to the back of the transmit queue, or to the front to be
+ * sent next.  Returns false if the queue is full.
+ */
+boolean CANClass::enqueue (const CanMessage &m, boolean front)
+{
+#if CAN_TX_QUEUE_LEN
+    if (tx_count >= CAN_TX_QUEUE_LEN)
+        return false;
+
+    if (front) {
+        tx_head = (tx_head + CAN_TX_QUEUE_LEN - 1) % CAN_TX_QUEUE_LEN;
+        tx_queue[tx_head] = m;
+    } else {
+        tx_queue[(tx_head + tx_count) % CAN_TX_QUEUE_LEN] = m;
+    }
+    tx_count++;
+
+    return true;
+#else
+    (void)m;
+    (void)front;
+    return false;
+#endif
+}
+
+void CANClass::count_load (uint16_t bits)
+{
+    uint32_t now = millis ();
+    uint32_t elapsed = now - load_start;
+
+    if (elapsed >= 1000) {
+        /* percent = bits * bit_time (ns) / elapsed (ms) / 10^4 */
+        load = (uint8_t)(load_bits * (bit_time / 100) / elapsed / 100);
+        load_bits = 0;
+        load_start = now;
+    }
+
+    load_bits += bits;
+}
+
+uint8_t CANClass::send (const CanMessage &m)
+{
+    uint16_t bits = frameBits (m);
+
+    if (error_state == CAN_ERROR_BUS_OFF) {
+        if (recover_policy == CAN_RECOVER_KEEP && enqueue (m))
+            return CAN_TX_QUEUED;
+
+        error_stats.flushed++;
+        return CAN_TX_DROPPED;
+    }
+
+    if (load_limit == 0 && shaper_count == 0 && tx_count == 0) {
+        transmit (m, bits);
+        return CAN_TX_OK;
+    }
+
+    /* Keep messages in order behind those already queued */
+    if (tx_count == 0 && in_budget (m, bits)) {
+        transmit (m, bits);
+        return CAN_TX_OK;
+    }
+
+    /* Messages kept over a bus-off are queued whatever the policy */
+    if ((policy == CAN_SHAPE_QUEUE || tx_count) && enqueue (m)) {
+        shaping_stats.queued++;
+        return CAN_TX_QUEUED;
+    }
+
+    shaping_stats.dropped++;
+    return CAN_TX_DROPPED;
+}
+
+/*
+ * Check whether a message from another transmit buffer may be sent now,
+ * and charge it if it may
+ */
+boolean CANClass::admit (const CanMessage &m, uint16_t bits)
+{
+    if (error_state == CAN_ERROR_BUS_OFF)
+        return false;
+
+    if (load_limit == 0 && shaper_count == 0)
+        return true;
+
+    return in_budget (m, bits);
+}
+
+void CANClass::sent (uint16_t bits)
+{
+    shaping_stats.sent++;
+    shaping_stats.bits += bits;
+    count_load (bits);
+}
+
+boolean CANClass::sendFrom (uint8_t tx_buf, const CanMessage &m)
+{
+    uint16_t bits = frameBits (m);
+
+    if (!admit (m, bits))
+        return false;
+
+    if (m.rtr)
+        mcp2515_set_remote (tx_buf, m.id, m.len, m.extended);
+    else
+        mcp2515_set_msg (tx_buf, m.id, m.data, m.len, m.extended);
+    mcp2515_request_tx (tx_buf);
+
+    sent (bits);
+    return true;
+}
+
+boolean CANClass::sendFrom (uint8_t tx_buf, const uint8_t *raw)
+{
+    CanMessage m;
+    uint16_t bits;
+
+    /* Only the header is needed to size and charge the message */
+    m.extended = mcp2515_raw_get_id (raw, &m.id) ? 1 : 0;
+    m.rtr = mcp2515_raw_is_remote (raw) ? 1 : 0;
+    m.len = raw[4] & 0x0F;
+    bits = frameBits (m);
+
+    if (!admit (m, bits))
+        return false;
+
+    mcp2515_send_raw (tx_buf, raw);
+
+    sent (bits);
+    return true;
+}
+
+void CANClass::setBusLoadLimit (uint8_t percent, uint16_t burst)
+{
+    if (percent > 100)
+        percent = 100;
+
+    load_limit = percent;
+    load_burst = burst;
+    load_tokens = burst;
+    last_refill = micros ();
+}
+
+boolean CANClass::setRateLimit (uint32_t id, uint16_t rate, uint8_t burst,
+                                uint8_t extended)
+{
+#if CAN_SHAPER_MAX
+    Shaper *s;
+
+    extended = extended ? 1 : 0;
+
+    for (s = shapers; s < shapers + shaper_count; s++) {
+        if (s->id == id && s->extended == extended)
+            break;
+    }
+
+    if (rate == 0) {
+        /* Remove the limit by moving the last one into its place */
+        if (s < shapers + shaper_count)
+            *s = shapers[--shaper_count];
+        return true;
+    }
+
+    if (s == shapers + shaper_count) {
+        if (shaper_count >= CAN_SHAPER_MAX)
+            return false;
+        shaper_count++;
+    }
+
+    if (burst == 0)
+        burst = 1;
+
+    refill ();
+    s->id = id;
+    s->extended = extended;
+    s->period = 1000000UL / rate;
+    s->limit = s->period * burst;
+    s->tokens = s->limit;
+
+    return true;
+#else
+    (void)id;
+    (void)burst;
+    (void)extended;
+    return rate == 0;
+#endif
+}
+
+void CANClass::setShapingPolicy (uint8_t policy)
+{
+    CANClass::policy = policy;
+}
+
+const CanShapingStats &CANClass::shapingStats ()
+{
+    return shaping_stats;
+}
+
+uint8_t CANClass::busLoad ()
+{
+    count_load (0);
+    return load;
+}
+
+/*
+ * Error supervision
+ */
+void CANClass::set_error_state (uint8_t state)
+{
+    if (state == error_state)
+        return;
+
+    if (state == CAN_ERROR_WARNING)
+        error_stats.warnings++;
+    else if (state == CAN_ERROR_PASSIVE)
+        error_stats.passives++;
+
+    error_state = state;
+
+    if (error_fn)
+        error_fn (state);
+}
+
+/*
+ * Abort the transmission in TXB0 and keep or drop its message
+ */
+void CANClass::abort_tx ()
+{
+    uint8_t ctrl;
+
+    mcp2515_abort_tx (0, MCP2515_MODE_POLLS);
+
+    if (!tx_busy)
+        return;
+    tx_busy = 0;
+
+    /* The message may have gone out before the abort */
+    mcp2515_read_regs (REG(TX, 0, CTRL), &ctrl, 1);
+    if (!(ctrl & (1 << ABTF)))
+        return;
+
+    /* Send it again first */
+    if (recover_policy != CAN_RECOVER_KEEP || !enqueue (tx_last, true))
+        error_stats.flushed++;
+}
+
+void CANClass::bus_off (uint32_t now)
+{
+    uint8_t status;
+    uint8_t held = 0;
+    uint8_t ctrl;
+    uint8_t buf;
+
+    off_since = now;
+    off_mode = mcp2515_get_mode ();
+    error_stats.bus_offs++;
+
+    /* Going bus-off again soon after recovering backs off further */
+    if ((uint32_t)(now - recovered) > backoff_max)
+        backoff = backoff_min;
+
+    abort_tx ();
+
+    if (recover_policy == CAN_RECOVER_FLUSH) {
+        error_stats.flushed += tx_count;
+        tx_count = 0;
+    }
+
+    /*
+     * The controller rejoins the bus by itself after 128 times 11
+     * recessive bits, so it is held in configuration mode instead.  The
+     * mode only changes once nothing is pending, so the other buffers are
+     * aborted and requested again: their owners still see them busy, and
+     * the messages go out after the backoff.
+     */
+    status = mcp2515_read_status ();
+    for (buf = 1; buf < 3; buf++) {
+        if (!(status & (MCP2515_STATUS_TX0REQ << (buf << 1))))
+            continue;
+
+        mcp2515_abort_tx (buf, MCP2515_MODE_POLLS);
+        mcp2515_read_regs (REG(TX, buf, CTRL), &ctrl, 1);
+        if (ctrl & (1 << ABTF))
+            held |= 1 << buf;
+    }
+
+    mcp2515_change_mode (MCP2515_MODE_CONFIG, MCP2515_MODE_POLLS);
+
+    for (buf = 1; buf < 3; buf++) {
+        if (held & (1 << buf))
+            mcp2515_request_tx (buf);
+    }
+
+    set_error_state (CAN_ERROR_BUS_OFF);
+}
+
+/*
+ * Put the controller back into its mode after the backoff
+ */
+void CANClass::restart (uint32_t now)
+{
+    if (!mcp2515_change_mode (off_mode, MCP2515_MODE_POLLS)) {
+        /* Try again after another backoff */
+        error_stats.unavailable += now - off_since;
+        off_since = now;
+        return;
+    }
+
+    recovering = 1;
+}
+
+/*
+ * The controller is back on the bus once it has left bus-off
+ */
+void CANClass::rejoined (uint32_t now)
+{
+    recovering = 0;
+    error_stats.unavailable += now - off_since;
+    error_stats.recoveries++;
+    recovered = now;
+    backoff = backoff > backoff_max / 2 ? backoff_max : backoff * 2;
+}
+
+void CANClass::supervise ()
+{
+    uint32_t now = millis ();
+    uint8_t eflg;
+
+    if (now == last_check)
+        return;
+    last_check = now;
+
+    if (error_state == CAN_ERROR_BUS_OFF && !recovering) {
+        if ((uint32_t)(now - off_since) >= backoff)
+            restart (now);
+        return;
+    }
+
+    /* In hybrid receive a change of the error flags asserts INT, so they
+     * are only read after a wakeup */
+    if (hybrid == HYBRID_ARMED && !hybrid_woken && !recovering) {
+        check_tx (now);
+        return;
+    }
+
+    if (hybrid)
+        mcp2515_clear_int (1 << ERRIF);
+    mcp2515_read_regs (EFLG, &eflg, 1);
+
+    if (eflg & (1 << TXBO)) {
+        /* Still waiting for the recessive bits after a restart */
+        if (!recovering)
+            bus_off (now);
+        return;
+    }
+
+    if (recovering)
+        rejoined (now);
+
+    if (eflg & ((1 << TXEP) | (1 << RXEP)))
+        set_error_state (CAN_ERROR_PASSIVE);
+    else if (eflg & (1 << EWARN))
+        set_error_state (CAN_ERROR_WARNING);
+    else
+        set_error_state (CAN_ERROR_ACTIVE);
+
+    check_tx (now);
+}
+
+/*
+ * A transmission nobody acknowledges is retried forever
+ */
+void CANClass::check_tx (uint32_t now)
+{
+    if (!tx_busy || !tx_timeout || (uint32_t)(now - tx_started) < tx_timeout)
+        return;
+
+    if (mcp2515_msg_sent ()) {
+        tx_busy = 0;
+    } else {
+        error_stats.aborts++;
+        abort_tx ();
+    }
+}
+
+void CANClass::setRecovery (uint8_t policy, uint16_t backoff,
+                            uint16_t backoff_max, uint16_t tx_timeout)
+{
+    recover_policy = policy;
+    backoff_min = backoff;
+    CANClass::backoff_max = backoff_max < backoff ? backoff : backoff_max;
+    CANClass::backoff = backoff;
+    CANClass::tx_timeout = tx_timeout;
+}
+
+void CANClass::onErrorState (can_error_fn fn)
+{
+    error_fn = fn;
+}
+
+uint8_t CANClass::errorState ()
+{
+    return error_state;
+}
+
+const CanErrorStats &CANClass::errorStats ()
+{
+    return error_stats;
+}
+
+void CANClass::poll ()
+{
+#if CAN_TX_QUEUE_LEN
+    CanMessage *m;
+    uint16_t bits;
+#endif
+
+    supervise ();
+    pumpLanes ();
+
+#if CAN_TX_QUEUE_LEN
+    while (tx_count && error_state != CAN_ERROR_BUS_OFF &&
+           mcp2515_msg_sent ()) {
+        m = &tx_queue[tx_head];
+        bits = frameBits (*m);
+        if (!in_budget (*m, bits))
+            break;
+
+        transmit (*m, bits);
+        tx_head = (tx_head + 1) % CAN_TX_QUEUE_LEN;
+        tx_count--;
+    }
+#endif
+}
+
 CANClass CAN;
 
@@ -25,6 +25,172 @@
 #define DEFAULT_CAN_ID          0x0555
 #define CAN_BYTES_MAX           8
 
+/*
+ * The tables of the optional features below are static, so every sketch
+ * pays for them whether it uses the feature or not.  On AVR they default
+ * to the smallest useful size.  A size must be defined for every file of
+ * the library, e.g. on the compiler command line; a size of 0 leaves the
+ * feature out.
+ */
+
+/** Maximum number of identifiers that can be delivered on change only;
+ *  25 bytes of RAM each on AVR */
+#ifndef CAN_ON_CHANGE_MAX
+#if defined(__AVR__)
+#define CAN_ON_CHANGE_MAX       1
+#else
+#define CAN_ON_CHANGE_MAX       8
+#endif
+#endif
+
+/** Maximum number of identifiers with their own transmit rate limit;
+ *  17 bytes of RAM each on AVR */
+#ifndef CAN_SHAPER_MAX
+#if defined(__AVR__)
+#define CAN_SHAPER_MAX          1
+#else
+#define CAN_SHAPER_MAX          4
+#endif
+#endif
+
+/** Number of messages that can wait for transmission, over budget or
+ *  while bus-off; 16 bytes of RAM each on AVR */
+#ifndef CAN_TX_QUEUE_LEN
+#if defined(__AVR__)
+#define CAN_TX_QUEUE_LEN        1
+#else
+#define CAN_TX_QUEUE_LEN        4
+#endif
+#endif
+
+/** Default bus load budget that may be used at once, in bits */
+#define CAN_SHAPER_BURST        1024
+
+/** Number of bit times autoBaud tries */
+#define CAN_AUTOBAUD_RATES      11
+
+/** Default time autoBaud listens at each bit time, in milliseconds */
+#define CAN_AUTOBAUD_TIMEOUT    50
+
+/** Maximum number of receive lanes; 37 bytes of RAM each on AVR, which
+ *  gets two so that a priority lane can be kept apart from the rest */
+#ifndef CAN_LANES_MAX
+#if defined(__AVR__)
+#define CAN_LANES_MAX           2
+#else
+#define CAN_LANES_MAX           4
+#endif
+#endif
+
+/** What a receive lane does with a message when its ring is full */
+enum CAN_LANE_OVERFLOW {
+    CAN_LANE_DROP_NEW,      /**< Drop the new message */
+    CAN_LANE_DROP_OLD,      /**< Drop the oldest message in the ring */
+};
+
+/** Maximum number of identifiers whose remote requests are answered;
+ *  14 bytes of RAM each on AVR */
+#ifndef CAN_REPLY_MAX
+#if defined(__AVR__)
+#define CAN_REPLY_MAX           1
+#else
+#define CAN_REPLY_MAX           4
+#endif
+#endif
+
+/** Default time hybrid receive keeps polling after the last message, in us */
+#define CAN_HYBRID_IDLE         1000
+
+/** Results of sending a message */
+enum CAN_TX {
+    CAN_TX_OK,              /**< Loaded into the controller */
+    CAN_TX_QUEUED,          /**< Over budget; queued for CAN.poll() */
+    CAN_TX_DROPPED,         /**< Over budget, or the queue was full */
+};
+
+/** What to do with messages that exceed their transmit budget */
+enum CAN_SHAPE {
+    CAN_SHAPE_DROP,         /**< Drop the message */
+    CAN_SHAPE_QUEUE,        /**< Queue the message until budget is free */
+};
+
+/** Transmit shaping statistics */
+struct CanShapingStats {
+    uint32_t sent;          /**< Messages loaded into the controller */
+    uint32_t queued;        /**< Messages that had to wait in the queue */
+    uint32_t dropped;       /**< Messages dropped */
+    uint32_t bits;          /**< Worst case bits of all messages sent */
+};
+
+/** Default time to stay off the bus after going bus-off, in ms */
+#define CAN_BACKOFF_MIN         100
+
+/** Default longest time to stay off the bus, in ms */
+#define CAN_BACKOFF_MAX         5000
+
+/** Default time after which a pending transmission is aborted, in ms;
+ *  0 waits indefinitely, as the controller does */
+#define CAN_TX_TIMEOUT          0
+
+/** Error states of the controller */
+enum CAN_ERROR_STATE {
+    CAN_ERROR_ACTIVE,       /**< Normal operation */
+    CAN_ERROR_WARNING,      /**< An error counter has reached 96 */
+    CAN_ERROR_PASSIVE,      /**< An error counter has reached 128; the
+                              *  node no longer signals errors actively */
+    CAN_ERROR_BUS_OFF,      /**< Too many transmit errors; the node is
+                              *  off the bus until it is restarted */
+};
+
+/** What to do with queued messages when the controller goes bus-off */
+enum CAN_RECOVER {
+    CAN_RECOVER_FLUSH,      /**< Drop them */
+    CAN_RECOVER_KEEP,       /**< Send them after recovery */
+};
+
+/** Error supervision statistics */
+struct CanErrorStats {
+    uint32_t warnings;      /**< Times the warning state was entered */
+    uint32_t passives;      /**< Times the error passive state was entered */
+    uint32_t bus_offs;      /**< Times the controller went bus-off */
+    uint32_t recoveries;    /**< Returns to the bus after bus-off */
+    uint32_t aborts;        /**< Stuck transmissions aborted */
+    uint32_t flushed;       /**< Messages dropped by CAN_RECOVER_FLUSH */
+    uint32_t unavailable;   /**< Total time spent bus-off, including the
+                              *  backoff, in ms */
+};
+
+/** Called when the error state changes, with a CAN_ERROR_STATE value */
+typedef void (*can_error_fn) (uint8_t state);
+
+/** Receive lane statistics */
+struct CanLaneStats {
+    uint32_t received;      /**< Messages put in the lane */
+    uint32_t delivered;     /**< Messages taken out of the lane */
+    uint32_t dropped;       /**< Messages lost because the ring was full */
+    uint32_t delay_sum;     /**< Sum of queueing delays, in microseconds */
+    uint32_t delay_max;     /**< Largest queueing delay, in microseconds */
+    uint8_t high_water;     /**< Most messages in the ring at once */
+};
+
+/** Hybrid receive statistics */
+struct CanHybridStats {
+    uint32_t wakeups;       /**< Interrupts taken */
+    uint32_t frames;        /**< Messages read while polling */
+    uint32_t polls;         /**< Times the controller was polled */
+    uint32_t poll_time;     /**< Time spent polling, in microseconds */
+    uint32_t irq_time;      /**< Time spent waiting for the interrupt,
+                              *  in microseconds */
+    uint16_t max_batch;     /**< Most messages read in one wakeup */
+};
+
+/** Remote request reply statistics */
+struct CanReplyStats {
+    uint32_t answered;      /**< Remote requests answered */
+    uint32_t preloaded;     /**< Answered from the already loaded TXB2 */
+    uint32_t busy;          /**< Not answered; TXB2 was still sending */
+};
+
 /** Operation Modes of the MCP2515 */
 enum CAN_MODE {
     CAN_MODE_NORMAL,        /**< Transmit and receive as normal */
@@ -42,6 +208,7 @@ enum CAN_MODE {
 
 /** Predefined CAN speeds - Included mostly for backward compatibility */
 enum CAN_SPEED {
+    CAN_SPEED_1000000           = MCP2515_SPEED_1000000,
     CAN_SPEED_500000            = MCP2515_SPEED_500000,
     CAN_SPEED_250000            = MCP2515_SPEED_250000,
     CAN_SPEED_125000            = MCP2515_SPEED_125000,
@@ -63,6 +230,10 @@ class CanMessage {
     public:
         /** A flag indicating whether this is an extended CAN message */
         uint8_t extended;
+        /** A flag indicating a remote transmission request.  A remote
+          * request carries no data; len is the number of bytes
+          * requested. */
+        uint8_t rtr;
         /** The identifier of the CAN message.  The ID is 29 bytes long
           * if the extended flag is set, or 11 bytes long if not set. */
         uint32_t id;
@@ -118,8 +289,10 @@ class CanMessage {
         /**
          * Send the CAN message.  Once a message has been created, this
          * function sends it.
+         * @return One of the CAN_TX values.
+         * @see CANClass::send
          */
-        void send();
+        uint8_t send();
 
         /**
          * Simple interface to retrieve a byte from a CAN message.  This
@@ -177,18 +350,53 @@ class CanMessage {
         uint8_t pos;
 };
 
+/** A message waiting in a receive lane */
+struct CanLaneEntry {
+    CanMessage msg;
+    uint32_t time;          /**< Time the message was read (us) */
+};
+
 /**
  * A class for managing the CAN driver.
  */
 class CANClass {
     public:
         /**
-         * Call before using any other CAN functions.
+         * Call before using any other CAN functions.  The controller is
+         * reset and its whole configuration is loaded and verified.
          * @param bit_time - Desired width of a single bit in nanoseconds.
          *                   The CAN_SPEED enumerated values are set to
          *                   the bit widths of some common frequencies.
+         * @return True if the controller was configured successfully.
          */
-        static void begin(uint32_t bit_time);
+        static boolean begin(uint32_t bit_time);
+
+        /**
+         * Find the bit rate of the bus and initialize the controller for
+         * it.  Each candidate bit time is tried in listen-only mode, so
+         * the controller never drives the bus.  A candidate is accepted
+         * when a message is received without errors and rejected as soon
+         * as a receive error is flagged, usually within a message time.
+         * The common CAN_SPEED values are tried, most common first; a
+         * detected bit time moves to the front for the next call.  There
+         * must be traffic on the bus.
+         *
+         * The controller is left in CAN_MODE_LISTEN_ONLY with the first
+         * message in its receive buffer; call changeMode to start
+         * transmitting.
+         * @param timeout - Time to listen at each bit time, in ms.
+         * @param hint    - Bit time to try first, e.g. the last one that
+         *                  worked, or 0.
+         * @return The bit time found in nanoseconds, or 0 if none was.
+         */
+        static uint32_t autoBaud (uint16_t timeout = CAN_AUTOBAUD_TIMEOUT,
+                                  uint32_t hint = 0);
+
+        /**
+         * Get the time taken by the last call to begin.
+         * @return The initialization time in microseconds.
+         */
+        static uint32_t initTime();
 
         /** Call when all CAN functions are complete */
         static void end();
@@ -199,6 +407,24 @@ class CANClass {
          * @see enum CAN_MODE */
         static void setMode(uint8_t mode);
 
+        /**
+         * Get the operational mode the controller is actually in.
+         * @return One of the enumerated mode values
+         * @see enum CAN_MODE */
+        static uint8_t getMode();
+
+        /**
+         * Set operational mode and wait a bounded time for the controller
+         * to confirm the change.  Use this when reconfiguring at runtime,
+         * e.g. switching to CAN_MODE_CONFIG to change filters and back to
+         * CAN_MODE_NORMAL.
+         * @param mode      - One of the enumerated mode values
+         * @param max_polls - Maximum number of status reads to wait for
+         * @return True if the controller entered the requested mode.
+         * @see enum CAN_MODE */
+        static boolean changeMode(uint8_t mode,
+                                  uint16_t max_polls = MCP2515_MODE_POLLS);
+
         /** Check whether a message may be sent */
         static uint8_t ready ();
 
@@ -213,6 +439,462 @@ class CANClass {
          * @return A CanMessage containing the retrieved message
          */
         static CanMessage getMessage ();
+
+        /**
+         * Deliver messages with the given identifier only when their data
+         * changes.  Received messages whose length and data are the same
+         * as the last delivered message with that identifier are dropped
+         * before available() reports them.
+         * @param id        - The message identifier
+         * @param heartbeat - Maximum time in milliseconds between
+         *                    delivered messages even if the data has not
+         *                    changed, or 0 to never deliver unchanged data.
+         * @param extended  - Nonzero if id is an extended identifier
+         * @return False if CAN_ON_CHANGE_MAX identifiers are already set.
+         */
+        static boolean setOnChange (uint32_t id, uint16_t heartbeat = 0,
+                                    uint8_t extended = 0);
+
+        /** Deliver all messages again, whether changed or not. */
+        static void clearOnChange ();
+
+        /**
+         * Get the number of unchanged messages that were dropped.
+         * @return The total for all on-change identifiers.
+         */
+        static uint32_t suppressed ();
+
+        /**
+         * Get the number of unchanged messages that were dropped for one
+         * identifier.
+         * @param id       - The message identifier
+         * @param extended - Nonzero if id is an extended identifier
+         */
+        static uint32_t suppressed (uint32_t id, uint8_t extended = 0);
+
+        /**
+         * Answer remote transmission requests for an identifier with the
+         * given data.  Call again whenever the data changes.  Requests
+         * for published identifiers are answered as they are read from
+         * the controller, by available(), getMessage() or poll(), and
+         * are not delivered to the application.  Transmit buffer 2 is
+         * kept loaded with the last reply sent, so a repeated request
+         * is answered with a single SPI transaction.  The buffer is
+         * reserved while identifiers are published, so
+         * mcp2515_free_tx_buf does not return it; a message loaded into
+         * it anyway is replaced by the reply at the next request.
+         * @param id       - The message identifier
+         * @param data     - The reply data
+         * @param len      - Number of bytes in data (0-8)
+         * @param extended - Nonzero if id is an extended identifier
+         * @return False if CAN_REPLY_MAX identifiers are already published.
+         */
+        static boolean publish (uint32_t id, const uint8_t *data,
+                                uint8_t len, uint8_t extended = 0);
+
+        /** Stop answering remote requests; they are delivered again */
+        static void clearReplies ();
+
+        /** Get remote request reply statistics */
+        static const CanReplyStats &replyStats ();
+
+        /**
+         * Receive in hybrid interrupt and polling mode.  While the bus is
+         * quiet, available(), getMessage(), pumpLanes() and the error
+         * supervision in poll() and ready() do not touch the controller;
+         * they wait for its interrupt, which is also asserted when the
+         * error flags change.  The
+         * interrupt is then disabled and the controller is polled with
+         * RX STATUS for as long as messages keep arriving, and the
+         * interrupt is enabled again once none has arrived for the idle
+         * time.  The controller's INT pin must be connected to an
+         * interrupt input.
+         * @param irq  - Interrupt number of the INT pin, as given to
+         *               attachInterrupt
+         * @param idle - Time in microseconds to keep polling after the
+         *               last message
+         */
+        static void beginHybrid (uint8_t irq,
+                                 uint16_t idle = CAN_HYBRID_IDLE);
+
+        /** Stop hybrid receive; the controller is polled on every call */
+        static void endHybrid ();
+
+        /**
+         * Get hybrid receive statistics, including the time spent in each
+         * mode.  The average messages per wakeup is frames / wakeups.
+         */
+        static const CanHybridStats &hybridStats ();
+
+        /**
+         * Add a receive lane.  Once lanes have been added, poll() moves
+         * every received message into the first lane that selects it,
+         * and messages are read with getLaneMessage or getPriorityMessage
+         * instead of getMessage.  Lanes are numbered in the order they
+         * are added, and lower numbers have higher priority.  A lane
+         * selects messages by the acceptance filters they matched
+         * (setLaneFilters), by identifier range (setLaneIds), or both;
+         * a lane with neither selects every message.  Messages that no
+         * lane selects are dropped and counted by laneUnmatched; add a
+         * last lane that selects everything to keep them.
+         * @param ring     - Storage for the messages waiting in the lane
+         * @param size     - Number of entries in ring, up to 255
+         * @param overflow - One of the CAN_LANE_OVERFLOW values
+         * @return The lane number, or -1 if CAN_LANES_MAX lanes exist.
+         */
+        static int8_t addLane (CanLaneEntry *ring, uint8_t size,
+                               uint8_t overflow = CAN_LANE_DROP_NEW);
+
+        /**
+         * Select messages whose identifier is from first to last.
+         * @param lane     - The lane
+         * @param first    - The lowest identifier
+         * @param last     - The highest identifier
+         * @param extended - Nonzero for extended identifiers
+         */
+        static void setLaneIds (uint8_t lane, uint32_t first, uint32_t last,
+                                uint8_t extended = 0);
+
+        /**
+         * Select messages by the acceptance filter they matched, as
+         * reported by the controller (FILHIT).
+         * @param lane    - The lane
+         * @param filters - Bit n set to select messages matching RXFn
+         */
+        static void setLaneFilters (uint8_t lane, uint8_t filters);
+
+        /** Remove all lanes; getMessage is used again */
+        static void clearLanes ();
+
+        /**
+         * Move received messages from the controller into their lanes.
+         * Called by poll(); call it directly to read messages sooner.
+         * @return The number of messages moved.
+         */
+        static uint8_t pumpLanes ();
+
+        /**
+         * Check whether a lane holds a message.
+         * @param lane - The lane
+         */
+        static boolean laneAvailable (uint8_t lane);
+
+        /**
+         * Take the oldest message out of a lane.
+         * @param lane - The lane
+         * @param m    - Where to store the message
+         * @return False if the lane is empty.
+         */
+        static boolean getLaneMessage (uint8_t lane, CanMessage *m);
+
+        /**
+         * Take the oldest message out of the highest priority lane that
+         * holds one.  Received messages are moved into their lanes first.
+         * @param m - Where to store the message
+         * @return The lane the message came from, or -1 if all are empty.
+         */
+        static int8_t getPriorityMessage (CanMessage *m);
+
+        /**
+         * Get the statistics of a lane, including the delay between a
+         * message being read from the controller and taken from the lane.
+         * @param lane - The lane
+         */
+        static const CanLaneStats &laneStats (uint8_t lane);
+
+        /**
+         * Get the number of messages dropped because no lane selected them.
+         */
+        static uint32_t laneUnmatched ();
+
+        /**
+         * Send a message, subject to transmit shaping.  If a bus load
+         * limit or a rate for the message identifier has been set and
+         * the message exceeds it, the message is queued or dropped
+         * according to the shaping policy.
+         * @param m - The message to send
+         * @return One of the CAN_TX values.
+         */
+        static uint8_t send (const CanMessage &m);
+
+        /**
+         * Send a message from a transmit buffer other than TXB0, for
+         * modules that own one, such as CANopen or the gateway.  The
+         * message is charged against the bus load limit and its rate
+         * limit and counted in the bus load like one sent with send(),
+         * but it is never queued: while it is over budget or the
+         * controller is bus-off it is refused, and the caller keeps it
+         * and tries again later.
+         * @param tx_buf - The transmit buffer, which must be free
+         * @param m      - The message to send
+         * @return True if its transmission was requested.
+         */
+        static boolean sendFrom (uint8_t tx_buf, const CanMessage &m);
+
+        /**
+         * Send a message in register layout from a transmit buffer, as
+         * sendFrom above.
+         * @param tx_buf - The transmit buffer, which must be free
+         * @param raw    - Message as read by mcp2515_read_raw
+         * @return True if its transmission was requested.
+         */
+        static boolean sendFrom (uint8_t tx_buf, const uint8_t *raw);
+
+        /**
+         * Limit the bus load caused by messages sent from this node
+         * with send() or sendFrom().  Each message is charged its worst
+         * case length in bits, including stuff bits, against a budget
+         * that refills at the given fraction of the bus bit rate.
+         * @param percent - Maximum share of the bus bit rate, 1-100, or 0
+         *                  for no limit.
+         * @param burst   - Budget that may be used at once, in bits.
+         */
+        static void setBusLoadLimit (uint8_t percent,
+                                     uint16_t burst = CAN_SHAPER_BURST);
+
+        /**
+         * Limit the rate at which messages with one identifier are sent.
+         * @param id       - The message identifier
+         * @param rate     - Maximum average messages per second, or 0 to
+         *                   remove the limit.
+         * @param burst    - Number of messages that may be sent at once.
+         * @param extended - Nonzero if id is an extended identifier
+         * @return False if CAN_SHAPER_MAX identifiers are already limited.
+         */
+        static boolean setRateLimit (uint32_t id, uint16_t rate,
+                                     uint8_t burst = 1, uint8_t extended = 0);
+
+        /**
+         * Set what to do with messages that exceed their budget.
+         * @param policy - One of the CAN_SHAPE values
+         */
+        static void setShapingPolicy (uint8_t policy);
+
+        /**
+         * Get transmit shaping statistics.
+         */
+        static const CanShapingStats &shapingStats ();
+
+        /**
+         * Estimate the bus load over the last second from the messages
+         * sent and received by this node.
+         * @return The bus load in percent.
+         */
+        static uint8_t busLoad ();
+
+        /**
+         * Calculate the worst case length of a message on the bus,
+         * including stuff bits and interframe space.
+         * @param m - The message
+         * @return The length in bits.
+         */
+        static uint16_t frameBits (const CanMessage &m);
+
+        /**
+         * Set how the controller recovers from errors.  When it goes
+         * bus-off, the transmission from TXB0 is aborted and the
+         * controller is held in configuration mode for the backoff time,
+         * then put back into its mode.  Messages pending in TXB1 and TXB2
+         * stay pending and go out once it has left bus-off.  The backoff
+         * time doubles, up to backoff_max, each time the controller goes
+         * bus-off again within backoff_max of recovering.
+         * @param policy      - One of the CAN_RECOVER values; applies to
+         *                      messages queued by send() and stuck
+         *                      transmissions.
+         * @param backoff     - First backoff time in milliseconds
+         * @param backoff_max - Longest backoff time in milliseconds
+         * @param tx_timeout  - Time in milliseconds after which a pending
+         *                      transmission is aborted, e.g. because no
+         *                      other node acknowledges it, or 0 to wait
+         *                      indefinitely.
+         */
+        static void setRecovery (uint8_t policy,
+                                 uint16_t backoff = CAN_BACKOFF_MIN,
+                                 uint16_t backoff_max = CAN_BACKOFF_MAX,
+                                 uint16_t tx_timeout = CAN_TX_TIMEOUT);
+
+        /**
+         * Set a function to call when the error state changes.
+         * @param fn - The function, or NULL
+         */
+        static void onErrorState (can_error_fn fn);
+
+        /**
+         * Get the error state of the controller.
+         * @return One of the CAN_ERROR_STATE values.
+         */
+        static uint8_t errorState ();
+
+        /**
+         * Get error supervision statistics.
+         */
+        static const CanErrorStats &errorStats ();
+
+        /**
+         * Check the error state of the controller and recover from
+         * bus-off and stuck transmissions.  The check is made at most once
+         * a millisecond.  It is called by ready() and poll().
+         */
+        static void supervise ();
+
+        /**
+         * Perform background work, such as sending queued messages and
+         * error supervision.  Call this regularly from loop().
+         */
+        static void poll ();
+
+    private:
+        static boolean tryBaud (uint32_t bit_time, uint16_t timeout);
+        static void hybrid_isr ();
+        static boolean hybrid_wait ();
+        static void hybrid_result (boolean received);
+        static uint8_t receive (CanMessage *m, uint8_t *filter = 0);
+        static boolean unchanged (const CanMessage *m);
+        static boolean answer (const CanMessage &m);
+        static void load_reply (uint8_t i);
+
+        /** Duration of the last begin in microseconds */
+        static uint32_t init_time;
+
+        /** A message read from the controller but not yet retrieved */
+        static CanMessage rx_msg;
+        /** Nonzero if rx_msg holds a message */
+        static uint8_t rx_pending;
+
+        /** State of an identifier that is delivered on change only */
+        struct OnChange {
+            uint32_t id;
+            uint32_t last;          /**< Time of last delivery (ms) */
+            uint32_t suppressed;    /**< Unchanged messages dropped */
+            uint16_t heartbeat;     /**< Maximum time between deliveries */
+            uint8_t extended;
+            uint8_t seen;           /**< Nonzero once len and data are valid */
+            uint8_t len;            /**< Length of last delivered message */
+            uint8_t data[CAN_BYTES_MAX];    /**< Last delivered data */
+        };
+#if CAN_ON_CHANGE_MAX
+        static OnChange on_change[CAN_ON_CHANGE_MAX];
+#endif
+        static uint8_t on_change_count;
+
+        /** Data to answer remote requests for an identifier with */
+        struct Reply {
+            uint32_t id;
+            uint8_t extended;
+            uint8_t len;
+            uint8_t data[CAN_BYTES_MAX];
+        };
+#if CAN_REPLY_MAX
+        static Reply replies[CAN_REPLY_MAX];
+#endif
+        static uint8_t reply_count;
+        static int8_t reply_loaded;     /**< Reply in TXB2, or -1 */
+        static uint8_t reply_stale;     /**< Nonzero if TXB2 needs reloading */
+        static uint8_t reply_loads;     /**< TXB2 load count after the
+                                          *  reply was loaded */
+        static CanReplyStats reply_stats;
+
+        static void refill ();
+        static boolean in_budget (const CanMessage &m, uint16_t bits);
+        static void transmit (const CanMessage &m, uint16_t bits);
+        static boolean admit (const CanMessage &m, uint16_t bits);
+        static void sent (uint16_t bits);
+        static boolean enqueue (const CanMessage &m, boolean front = false);
+        static void count_load (uint16_t bits);
+        static void set_error_state (uint8_t state);
+        static void bus_off (uint32_t now);
+        static void restart (uint32_t now);
+        static void rejoined (uint32_t now);
+        static void abort_tx ();
+        static void check_tx (uint32_t now);
+
+        /** Bit width set by begin, in nanoseconds */
+        static uint32_t bit_time;
+        /** Bit times for autoBaud to try, most recently found first */
+        static uint32_t baud_order[CAN_AUTOBAUD_RATES];
+
+        /** Transmit rate limit of an identifier */
+        struct Shaper {
+            uint32_t id;
+            uint32_t period;        /**< Microseconds per message */
+            uint32_t limit;         /**< Budget limit; period * burst */
+            uint32_t tokens;        /**< Budget in microseconds */
+            uint8_t extended;
+        };
+#if CAN_SHAPER_MAX
+        static Shaper shapers[CAN_SHAPER_MAX];
+#endif
+        static uint8_t shaper_count;
+
+        static uint8_t load_limit;      /**< Bus load limit in percent */
+        static uint16_t load_burst;     /**< Bus load budget limit (bits) */
+        static uint16_t load_tokens;    /**< Bus load budget (bits) */
+        static uint32_t last_refill;    /**< Time of last refill (us) */
+        static uint8_t policy;
+        static CanShapingStats shaping_stats;
+
+#if CAN_TX_QUEUE_LEN
+        static CanMessage tx_queue[CAN_TX_QUEUE_LEN];
+#endif
+        static uint8_t tx_head;
+        static uint8_t tx_count;
+
+        static uint8_t error_state;
+        static uint8_t recover_policy;
+        static uint16_t backoff_min;
+        static uint16_t backoff_max;
+        static uint16_t backoff;        /**< Current backoff time (ms) */
+        static uint16_t tx_timeout;
+        static uint8_t off_mode;        /**< Mode to restore after bus-off */
+        static uint32_t off_since;      /**< Time of going bus-off (ms) */
+        static uint8_t recovering;      /**< Nonzero while the controller
+                                          *  leaves bus-off after a restart */
+        static uint32_t recovered;      /**< Time of last recovery (ms) */
+        static uint32_t last_check;     /**< Time of last supervision (ms) */
+        static uint32_t tx_started;     /**< Time TXB0 was loaded (ms) */
+        static uint8_t tx_busy;         /**< Nonzero until TXB0 is seen free */
+        static CanMessage tx_last;      /**< Message last loaded into TXB0 */
+        static can_error_fn error_fn;
+        static CanErrorStats error_stats;
+
+        /** A receive lane */
+        struct Lane {
+            CanLaneEntry *ring;
+            uint32_t first;         /**< Identifier range */
+            uint32_t last;
+            uint8_t size;
+            uint8_t head;           /**< Oldest entry */
+            uint8_t count;
+            uint8_t overflow;
+            uint8_t filters;        /**< Bit n selects RXFn */
+            uint8_t ids;            /**< Nonzero if the range is set */
+            uint8_t extended;
+            CanLaneStats stats;
+        };
+#if CAN_LANES_MAX
+        static Lane lanes[CAN_LANES_MAX];
+#endif
+        static uint8_t lane_count;
+        static uint32_t lane_unmatched; /**< Messages no lane selected */
+
+        /** Hybrid receive state */
+        enum {
+            HYBRID_OFF,
+            HYBRID_ARMED,           /**< Waiting for the interrupt */
+            HYBRID_POLLING,
+        };
+        static uint8_t hybrid;
+        static uint8_t hybrid_irq;
+        static uint16_t hybrid_idle;
+        static volatile uint8_t hybrid_woken;
+        static uint32_t hybrid_since;   /**< Time of last mode change (us) */
+        static uint32_t hybrid_last;    /**< Time of last message (us) */
+        static uint16_t hybrid_batch;   /**< Messages read this wakeup */
+        static CanHybridStats hybrid_stats;
+
+        static uint32_t load_bits;      /**< Bits seen this window */
+        static uint32_t load_start;     /**< Start of this window (ms) */
+        static uint8_t load;            /**< Load of last window (%) */
 };
 
 extern CANClass CAN;
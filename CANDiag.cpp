@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANDiag.cpp
+ * Asynchronous diagnostic requests over ISO-TP.
+ */
+#include <string.h>
+
+#include "Arduino.h"
+#include "CANDiag.h"
+#include "mcp2515_regs.h"
+
+/** ISO-TP frame types, in the top nibble of the first byte */
+#define PCI_SINGLE          0
+#define PCI_FIRST           1
+#define PCI_CONSECUTIVE     2
+#define PCI_FLOW            3
+
+/** Flow control statuses */
+#define FS_CTS              0
+#define FS_WAIT             1
+#define FS_OVERFLOW         2
+
+/** Payload of single and consecutive frames, and of a first frame */
+#define SF_MAX              7
+#define CF_DATA             7
+#define FF_DATA             6
+
+/** Longest separation time an ECU may ask for, in us */
+#define ST_MIN_MAX          127000UL
+
+CanDiag::CanDiag ()
+{
+    begin ();
+}
+
+void CanDiag::begin (uint8_t tx_bufs)
+{
+    Request *r;
+
+    this->tx_bufs = tx_bufs;
+    setTimeouts (CAN_DIAG_P2, CAN_DIAG_P2_STAR);
+    setFlowControl (CAN_DIAG_BS, CAN_DIAG_ST_MIN);
+
+    for (r = requests; r < requests + CAN_DIAG_REQUESTS; r++)
+        r->state = FREE;
+    count = 0;
+    next_ticket = 0;
+
+    memset (&s, 0, sizeof(s));
+}
+
+void CanDiag::setTimeouts (uint16_t p2, uint16_t p2_star)
+{
+    this->p2 = p2 * 1000UL;
+    this->p2_star = p2_star * 1000UL;
+}
+
+void CanDiag::setFlowControl (uint8_t bs, uint8_t st_min)
+{
+    fc_bs = bs;
+    fc_st_min = st_min;
+}
+
+int8_t CanDiag::request (uint32_t tx_id, uint32_t rx_id, const uint8_t *data,
+                         uint16_t len, can_diag_fn fn, void *ctx,
+                         uint8_t extended)
+{
+    Request *r;
+
+    if (len == 0 || len > CAN_DIAG_DATA)
+        return -1;
+
+    for (r = requests; r < requests + CAN_DIAG_REQUESTS; r++) {
+        if (r->state == FREE)
+            break;
+    }
+    if (r == requests + CAN_DIAG_REQUESTS)
+        return -1;
+
+    r->tx_id = tx_id;
+    r->rx_id = rx_id;
+    r->extended = extended ? 1 : 0;
+    r->fn = fn;
+    r->ctx = ctx;
+    r->len = len;
+    r->pos = 0;
+    r->buf = -1;
+    r->ticket = next_ticket++;
+    r->state = QUEUED;
+    memcpy (r->data, data, len);
+
+    count++;
+    s.requests++;
+
+    return r - requests;
+}
+
+void CanDiag::cancel (int8_t handle)
+{
+    Request *r;
+
+    if (handle < 0 || handle >= CAN_DIAG_REQUESTS)
+        return;
+
+    /* A request ending now is freed when its function returns */
+    r = &requests[handle];
+    if (r->state == FREE || r->state == DONE)
+        return;
+
+    r->state = FREE;
+    count--;
+}
+
+/*
+ * Whether a queued request must wait for an earlier request to the same
+ * ECU
+ */
+boolean CanDiag::blocked (const Request *r) const
+{
+    const Request *o;
+
+    for (o = requests; o < requests + CAN_DIAG_REQUESTS; o++) {
+        if (o == r || o->state == FREE || o->tx_id != r->tx_id ||
+            o->extended != r->extended)
+            continue;
+
+        if (o->state != QUEUED || (int16_t)(o->ticket - r->ticket) < 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Load the next frame of a request into a transmit buffer.  Returns false
+ * if it was refused, leaving the request as it was.
+ */
+boolean CanDiag::send_frame (Request *r, uint8_t buf, uint32_t now)
+{
+    CanMessage m;
+    uint8_t *f = m.data;
+    uint16_t pos = r->pos;
+    uint8_t sn = r->sn;
+    uint16_t n;
+    boolean first = false;
+
+    m.id = r->tx_id;
+    m.extended = r->extended;
+    m.len = CAN_BYTES_MAX;
+    memset (f, CAN_DIAG_PAD, CAN_BYTES_MAX);
+
+    if (r->state == SEND_FC) {
+        f[0] = (PCI_FLOW << 4) | r->fs;
+        f[1] = fc_bs;
+        f[2] = fc_st_min;
+    } else if (pos == 0 && r->len <= SF_MAX) {
+        f[0] = (PCI_SINGLE << 4) | r->len;
+        memcpy (f + 1, r->data, r->len);
+        pos = r->len;
+    } else if (pos == 0) {
+        f[0] = (PCI_FIRST << 4) | (r->len >> 8);
+        f[1] = r->len;
+        memcpy (f + 2, r->data, FF_DATA);
+        pos = FF_DATA;
+        sn = 1;
+        first = true;
+    } else {
+        n = r->len - pos;
+        if (n > CF_DATA)
+            n = CF_DATA;
+        f[0] = (PCI_CONSECUTIVE << 4) | (sn & 0x0F);
+        memcpy (f + 1, r->data + pos, n);
+        pos += n;
+        sn++;
+    }
+
+    /* Over budget or bus-off; the frame is built again next time */
+    if (!CAN.sendFrom (buf, m))
+        return false;
+
+    r->pos = pos;
+    r->sn = sn;
+    r->buf = buf;
+    s.frames_sent++;
+
+    if (r->state == SEND_FC) {
+        if (r->fs != FS_CTS) {
+            finish (r, CAN_DIAG_OVERFLOW);
+            return true;
+        }
+        r->state = RECEIVE;
+        r->bs_left = fc_bs;
+        r->deadline = now + CAN_DIAG_N_TIMEOUT * 1000UL;
+    } else if (r->pos >= r->len) {
+        /* The response replaces the request */
+        r->state = WAIT_RESPONSE;
+        r->deadline = now + p2;
+        r->len = 0;
+        r->pos = 0;
+    } else if (first || (r->bs && --r->bs_left == 0)) {
+        r->state = WAIT_FC;
+        r->deadline = now + CAN_DIAG_N_TIMEOUT * 1000UL;
+    } else {
+        r->next_cf = now + r->st_min;
+    }
+
+    return true;
+}
+
+void CanDiag::poll ()
+{
+    uint32_t now = micros ();
+    Request *r;
+    uint8_t status;
+    uint8_t free = 0;
+    uint8_t buf;
+
+    for (r = requests; r < requests + CAN_DIAG_REQUESTS; r++) {
+        if ((r->state == WAIT_FC || r->state == WAIT_RESPONSE ||
+             r->state == RECEIVE) && (int32_t)(now - r->deadline) >= 0)
+            finish (r, CAN_DIAG_TIMEOUT);
+    }
+
+    if (!count)
+        return;
+
+    status = mcp2515_read_status ();
+    for (buf = 0; buf < 3; buf++) {
+        if ((tx_bufs & (1 << buf)) &&
+            !(status & (MCP2515_STATUS_TX0REQ << (buf << 1))))
+            free |= 1 << buf;
+    }
+
+    for (r = requests; r < requests + CAN_DIAG_REQUESTS && free; r++) {
+        /* The previous frame must be on the bus before the next */
+        if (r->buf >= 0 &&
+            (status & (MCP2515_STATUS_TX0REQ << (r->buf << 1))))
+            continue;
+
+        switch (r->state) {
+        case QUEUED:
+            if (blocked (r))
+                continue;
+            r->state = SEND;
+            break;
+        case SEND:
+            if (r->pos && (int32_t)(now - r->next_cf) < 0)
+                continue;
+            break;
+        case SEND_FC:
+            break;
+        default:
+            continue;
+        }
+
+        for (buf = 0; !(free & (1 << buf)); buf++)
+            ;
+
+        if (send_frame (r, buf, now))
+            free &= ~(1 << buf);
+    }
+}
+
+boolean CanDiag::process (const CanMessage &m)
+{
+    Request *r;
+    uint8_t extended = m.extended ? 1 : 0;
+
+    if (m.rtr || m.len == 0)
+        return false;
+
+    for (r = requests; r < requests + CAN_DIAG_REQUESTS; r++) {
+        if (r->state != WAIT_FC && r->state != WAIT_RESPONSE &&
+            r->state != RECEIVE)
+            continue;
+        if (r->rx_id != m.id || r->extended != extended)
+            continue;
+
+        s.frames_received++;
+        receive (r, m.data, m.len > CAN_BYTES_MAX ? CAN_BYTES_MAX : m.len,
+                 micros ());
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Handle a frame from the ECU of a request
+ */
+void CanDiag::receive (Request *r, const uint8_t *d, uint8_t n, uint32_t now)
+{
+    uint8_t pci = d[0] >> 4;
+    uint16_t len;
+
+    switch (r->state) {
+    case WAIT_FC:
+        if (pci != PCI_FLOW || n < 3)
+            return;
+
+        switch (d[0] & 0x0F) {
+        case FS_CTS:
+            r->bs = d[1];
+            r->bs_left = d[1];
+            if (d[2] <= 0x7F)
+                r->st_min = d[2] * 1000UL;
+            else if (d[2] >= 0xF1 && d[2] <= 0xF9)
+                r->st_min = (d[2] - 0xF0) * 100UL;
+            else
+                r->st_min = ST_MIN_MAX;
+            r->next_cf = now;
+            r->state = SEND;
+            break;
+        case FS_WAIT:
+            r->deadline = now + CAN_DIAG_N_TIMEOUT * 1000UL;
+            break;
+        default:
+            finish (r, CAN_DIAG_ABORTED);
+            break;
+        }
+        break;
+
+    case WAIT_RESPONSE:
+        if (pci == PCI_SINGLE) {
+            len = d[0] & 0x0F;
+            if (len == 0 || len >= n)
+                return;
+
+            if (len >= 3 && d[1] == CAN_DIAG_NEGATIVE_SID &&
+                d[3] == CAN_DIAG_PENDING_NRC) {
+                s.pending++;
+                r->deadline = now + p2_star;
+                return;
+            }
+
+            memcpy (r->data, d + 1, len);
+            r->len = len;
+            finish (r, d[1] == CAN_DIAG_NEGATIVE_SID ? CAN_DIAG_NEGATIVE
+                                                     : CAN_DIAG_OK);
+        } else if (pci == PCI_FIRST) {
+            len = ((uint16_t)(d[0] & 0x0F) << 8) | d[1];
+            if (n < CAN_BYTES_MAX || len <= SF_MAX)
+                return;
+
+            r->len = len;
+            if (len > CAN_DIAG_DATA) {
+                r->fs = FS_OVERFLOW;
+            } else {
+                memcpy (r->data, d + 2, FF_DATA);
+                r->pos = FF_DATA;
+                r->sn = 1;
+                r->fs = FS_CTS;
+            }
+            r->state = SEND_FC;
+        }
+        break;
+
+    case RECEIVE:
+        if (pci != PCI_CONSECUTIVE)
+            return;
+
+        len = r->len - r->pos;
+        if (len > CF_DATA)
+            len = CF_DATA;
+        if ((d[0] & 0x0F) != (r->sn & 0x0F) || len >= n) {
+            finish (r, CAN_DIAG_ABORTED);
+            return;
+        }
+
+        memcpy (r->data + r->pos, d + 1, len);
+        r->pos += len;
+        r->sn++;
+
+        if (r->pos < r->len) {
+            /* The ECU waits for flow control after each block */
+            if (fc_bs && --r->bs_left == 0) {
+                r->fs = FS_CTS;
+                r->state = SEND_FC;
+                return;
+            }
+            r->deadline = now + CAN_DIAG_N_TIMEOUT * 1000UL;
+            return;
+        }
+        finish (r, r->data[0] == CAN_DIAG_NEGATIVE_SID ? CAN_DIAG_NEGATIVE
+                                                        : CAN_DIAG_OK);
+        break;
+    }
+}
+
+/*
+ * End a request and call its function.  The request stays allocated
+ * during the call so a new request made from it gets another one.
+ */
+void CanDiag::finish (Request *r, uint8_t status)
+{
+    r->state = DONE;
+
+    switch (status) {
+    case CAN_DIAG_NEGATIVE:
+        s.negative++;
+        /* fall through */
+    case CAN_DIAG_OK:
+        s.responses++;
+        break;
+    case CAN_DIAG_TIMEOUT:
+        s.timeouts++;
+        break;
+    default:
+        s.errors++;
+        break;
+    }
+
+    if (r->fn) {
+        r->fn (status, r->data,
+               status <= CAN_DIAG_NEGATIVE ? r->len : 0, r->ctx);
+    }
+
+    r->state = FREE;
+    count--;
+}
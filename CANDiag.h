@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANDiag.h
+ * Asynchronous diagnostic (UDS style) requests over ISO-TP, to many ECUs
+ * at once.
+ */
+
+#ifndef CANDiag_h
+#define CANDiag_h
+
+#include "Arduino.h"
+
+#include <inttypes.h>
+#include "CAN.h"
+
+/*
+ * Each request takes about 40 bytes plus CAN_DIAG_DATA of RAM: about
+ * 400 bytes on AVR and 1.3 KB elsewhere, which suits a SAMD21 or other
+ * small ARM board.  Testers on a host computer can define larger sizes
+ * for every file of the library, as host/diag_bench does.
+ */
+
+/** Maximum number of requests outstanding or queued, up to 127 */
+#ifndef CAN_DIAG_REQUESTS
+#if defined(__AVR__)
+#define CAN_DIAG_REQUESTS       4
+#else
+#define CAN_DIAG_REQUESTS       8
+#endif
+#endif
+
+/** Longest request or response, in bytes; ISO-TP allows 4095 */
+#ifndef CAN_DIAG_DATA
+#if defined(__AVR__)
+#define CAN_DIAG_DATA           64
+#else
+#define CAN_DIAG_DATA           128
+#endif
+#endif
+
+/** Default time an ECU has to respond, in ms (UDS P2) */
+#define CAN_DIAG_P2             50
+
+/** Default time an ECU has to respond after a response pending, in ms
+ *  (UDS P2*) */
+#define CAN_DIAG_P2_STAR        5000
+
+/** Time allowed for flow control and consecutive frames, in ms (ISO-TP
+ *  N_Bs and N_Cr) */
+#define CAN_DIAG_N_TIMEOUT      1000
+
+/** Default block size asked of ECUs sending a response: consecutive
+ *  frames between flow controls, or 0 for no limit */
+#define CAN_DIAG_BS             0
+
+/** Default separation time asked of ECUs, as ISO-TP encodes it: 0-127
+ *  ms, or 0xF1-0xF9 for 100-900 us */
+#define CAN_DIAG_ST_MIN         0
+
+/** Byte unused frame bytes are padded with */
+#define CAN_DIAG_PAD            0xCC
+
+/** Transmit buffers used for requests: TXB1.  TXB0 belongs to CAN.send
+ *  and TXB2 to CAN.publish. */
+#define CAN_DIAG_TX_BUFS        0x02
+
+/** Negative response service ID */
+#define CAN_DIAG_NEGATIVE_SID   0x7F
+
+/** Negative response code: request received, response pending */
+#define CAN_DIAG_PENDING_NRC    0x78
+
+/** How a request ended */
+enum CAN_DIAG_STATUS {
+    CAN_DIAG_OK,            /**< Positive response */
+    CAN_DIAG_NEGATIVE,      /**< Negative response (0x7F) */
+    CAN_DIAG_TIMEOUT,       /**< No response, flow control or
+                              *  consecutive frame in time */
+    CAN_DIAG_OVERFLOW,      /**< Response longer than CAN_DIAG_DATA */
+    CAN_DIAG_ABORTED,       /**< ECU refused the request, or sent a
+                              *  frame out of sequence */
+};
+
+/**
+ * Called when a request ends.
+ * @param status - One of the CAN_DIAG_STATUS values
+ * @param data   - The response, starting with the service ID; valid
+ *                 only during the call
+ * @param len    - Length of the response; 0 unless status is
+ *                 CAN_DIAG_OK or CAN_DIAG_NEGATIVE
+ * @param ctx    - Context given with the request
+ */
+typedef void (*can_diag_fn) (uint8_t status, const uint8_t *data,
+                             uint16_t len, void *ctx);
+
+/** Diagnostic client statistics */
+struct CanDiagStats {
+    uint32_t requests;      /**< Requests accepted */
+    uint32_t responses;     /**< Positive and negative responses */
+    uint32_t negative;      /**< Negative responses */
+    uint32_t pending;       /**< Response pending (0x78) messages */
+    uint32_t timeouts;      /**< Requests that timed out */
+    uint32_t errors;        /**< Requests ended by overflow or abort */
+    uint32_t frames_sent;   /**< Frames sent */
+    uint32_t frames_received;   /**< Frames matched to a request */
+};
+
+/**
+ * Diagnostic client.  Requests are given with the identifier pair of the
+ * ECU (the request identifier it listens on and the identifier it
+ * responds with) and a function called with the response, and return at
+ * once.  Requests to different ECUs run at the same time; requests to
+ * the same ECU are queued and each is sent as soon as the previous one
+ * ends, as an ECU handles one request at a time.
+ *
+ * Requests and responses of any length up to CAN_DIAG_DATA are
+ * segmented as ISO-TP (ISO 15765-2) single, first and consecutive
+ * frames, with flow control both ways.  A negative response of
+ * "response pending" (0x78) extends the wait to the P2* time, as often
+ * as the ECU sends it.  Frames are sent from their own transmit
+ * buffers, one frame of a request at a time so they stay in order,
+ * through CAN.sendFrom; a frame it refuses, over a bus load or rate
+ * limit or while bus-off, is sent on a later poll.
+ *
+ * Pass every received message to process and call poll from loop().
+ * The response function may make new requests.
+ */
+class CanDiag {
+    public:
+        CanDiag();
+
+        /**
+         * Cancel all requests, without calling their functions.
+         * @param tx_bufs - Transmit buffers to send from; bit n selects
+         *                  TXBn.  Leave TXB0 to CAN.send; TXB2 may be
+         *                  added if CAN.publish is not used.
+         */
+        void begin (uint8_t tx_bufs = CAN_DIAG_TX_BUFS);
+
+        /**
+         * Set the response times.
+         * @param p2      - Time to respond, in ms
+         * @param p2_star - Time to respond after a response pending, in ms
+         */
+        void setTimeouts (uint16_t p2, uint16_t p2_star);
+
+        /**
+         * Set the flow control sent for long responses.  The MCP2515 has
+         * only two receive buffers, so a board that cannot keep up with
+         * back to back consecutive frames should ask for a block size or
+         * a separation time.
+         * @param bs     - Consecutive frames the ECU sends before waiting
+         *                 for the next flow control, or 0 for no limit
+         * @param st_min - Least time between consecutive frames, encoded
+         *                 as in ISO-TP: 0-127 ms, or 0xF1-0xF9 for
+         *                 100-900 us
+         */
+        void setFlowControl (uint8_t bs, uint8_t st_min);
+
+        /**
+         * Make a request.
+         * @param tx_id    - Identifier the ECU receives requests on
+         * @param rx_id    - Identifier the ECU responds with
+         * @param data     - The request, starting with the service ID
+         * @param len      - Length of the request, 1-CAN_DIAG_DATA
+         * @param fn       - Called when the request ends
+         * @param ctx      - Passed to fn
+         * @param extended - Nonzero if both identifiers are extended
+         * @return A handle, or -1 if the request is too long or
+         *         CAN_DIAG_REQUESTS requests are outstanding.
+         */
+        int8_t request (uint32_t tx_id, uint32_t rx_id, const uint8_t *data,
+                        uint16_t len, can_diag_fn fn, void *ctx = 0,
+                        uint8_t extended = 0);
+
+        /**
+         * Cancel a request without calling its function.
+         * @param handle - Returned by request
+         */
+        void cancel (int8_t handle);
+
+        /**
+         * Handle a received message.
+         * @return True if it was a frame for an outstanding request.
+         */
+        boolean process (const CanMessage &m);
+
+        /**
+         * Send waiting frames and end requests that have timed out.  Call
+         * this as often as possible from loop().
+         */
+        void poll ();
+
+        /** Number of requests outstanding or queued */
+        uint8_t outstanding () const { return count; }
+
+        const CanDiagStats &stats () const { return s; }
+
+    private:
+        enum State {
+            FREE,
+            QUEUED,         /**< Waiting for the ECU's previous request */
+            SEND,           /**< Sending the request */
+            WAIT_FC,        /**< Waiting for flow control */
+            WAIT_RESPONSE,
+            SEND_FC,        /**< Sending flow control for the response */
+            RECEIVE,        /**< Receiving consecutive frames */
+            DONE,           /**< Calling the response function */
+        };
+
+        struct Request {
+            uint32_t tx_id;
+            uint32_t rx_id;
+            can_diag_fn fn;
+            void *ctx;
+            uint32_t deadline;  /**< Time the current wait ends (us) */
+            uint32_t next_cf;   /**< Earliest time of the next
+                                  *  consecutive frame (us) */
+            uint32_t st_min;    /**< Separation time asked by the ECU (us) */
+            uint16_t len;       /**< Length of the request, then of the
+                                  *  response */
+            uint16_t pos;       /**< Bytes sent or received */
+            uint16_t ticket;    /**< Order requests were made in */
+            uint8_t extended;
+            uint8_t state;
+            uint8_t sn;         /**< Next sequence number */
+            uint8_t bs;         /**< Block size asked by the ECU */
+            uint8_t bs_left;    /**< Frames left in the block, sent or
+                                  *  received */
+            uint8_t fs;         /**< Flow status to send */
+            int8_t buf;         /**< Buffer of the last frame, or -1 */
+            uint8_t data[CAN_DIAG_DATA];
+        };
+
+        boolean blocked (const Request *r) const;
+        boolean send_frame (Request *r, uint8_t buf, uint32_t now);
+        void receive (Request *r, const uint8_t *d, uint8_t n,
+                      uint32_t now);
+        void finish (Request *r, uint8_t status);
+
+        uint8_t tx_bufs;
+        uint32_t p2;            /**< us */
+        uint32_t p2_star;       /**< us */
+        uint8_t fc_bs;          /**< Block size asked of ECUs */
+        uint8_t fc_st_min;      /**< Separation time asked of ECUs */
+
+        Request requests[CAN_DIAG_REQUESTS];
+        uint8_t count;
+        uint16_t next_ticket;
+
+        CanDiagStats s;
+};
+
+#endif
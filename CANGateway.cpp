@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANGateway.cpp
+ * Forwarding of CAN messages between two MCP2515 controllers.
+ */
+#include <string.h>
+
+#include "Arduino.h"
+#include "CANGateway.h"
+
+static void clear_route (CanRoute *r)
+{
+    memset (r, 0, sizeof(*r));
+}
+
+CanGateway::CanGateway ()
+{
+    uint8_t dir;
+
+    for (dir = 0; dir < CAN_GATEWAY_DIR_COUNT; dir++) {
+        clearRoutes (dir);
+        setDefault (dir, CAN_ROUTE_PASS);
+        held_route[dir] = NULL;
+    }
+}
+
+boolean CanGateway::begin (uint8_t ss_b, uint32_t bit_time_a,
+                           uint32_t bit_time_b)
+{
+    boolean ok = true;
+
+    mcp2515_attach (1, ss_b);
+
+    mcp2515_select (1);
+    ok &= CAN.begin (bit_time_b);
+    ok &= CAN.changeMode (CAN_MODE_NORMAL);
+
+    mcp2515_select (0);
+    ok &= CAN.begin (bit_time_a);
+    ok &= CAN.changeMode (CAN_MODE_NORMAL);
+
+    return ok;
+}
+
+CanRoute *CanGateway::addRoute (uint8_t dir, uint32_t id, uint32_t mask,
+                                uint8_t action, uint32_t new_id,
+                                uint8_t extended)
+{
+    CanRoute *r;
+
+    if (count[dir] >= CAN_GATEWAY_ROUTES)
+        return NULL;
+
+    r = &routes[dir][count[dir]++];
+    clear_route (r);
+    r->id = id & mask;
+    r->mask = mask;
+    r->extended = extended;
+    r->action = action;
+    r->new_id = new_id;
+    r->new_extended = extended;
+
+    return r;
+}
+
+void CanGateway::clearRoutes (uint8_t dir)
+{
+    count[dir] = 0;
+}
+
+void CanGateway::setDefault (uint8_t dir, uint8_t action)
+{
+    clear_route (&unmatched[dir]);
+    unmatched[dir].action = action;
+}
+
+CanRoute *CanGateway::defaultRoute (uint8_t dir)
+{
+    return &unmatched[dir];
+}
+
+CanRoute *CanGateway::match (uint8_t dir, uint32_t id, uint8_t extended)
+{
+    CanRoute *r = routes[dir];
+    CanRoute *end = r + count[dir];
+
+    for (; r < end; r++) {
+        if (r->extended == extended && (id & r->mask) == r->id)
+            return r;
+    }
+
+    return &unmatched[dir];
+}
+
+/*
+ * Whether the forwarding buffer of the selected controller is still busy
+ */
+boolean CanGateway::tx_busy ()
+{
+    return mcp2515_read_status () &
+           (MCP2515_STATUS_TX0REQ << (CAN_GATEWAY_TX_BUF << 1));
+}
+
+/*
+ * Send a message from the selected controller and count it.  Controller A
+ * is also CAN's, so messages to it are shaped along with CAN's own and
+ * refused while it is bus-off.
+ */
+boolean CanGateway::send (uint8_t dir, CanRoute *r, const uint8_t *raw,
+                          uint32_t start)
+{
+    uint16_t latency;
+
+    if (dir == CAN_GATEWAY_B_TO_A) {
+        if (!CAN.sendFrom (CAN_GATEWAY_TX_BUF, raw))
+            return false;
+    } else {
+        mcp2515_send_raw (CAN_GATEWAY_TX_BUF, raw);
+    }
+
+    latency = (uint16_t)(micros () - start);
+    r->latency_sum += latency;
+    if (latency > r->latency_max)
+        r->latency_max = latency;
+    r->last = millis ();
+    r->forwarded++;
+
+    return true;
+}
+
+/*
+ * Forward the messages waiting in the controller of one direction
+ */
+uint8_t CanGateway::forward (uint8_t dir)
+{
+    uint8_t raw[MCP2515_RAW_SIZE];
+    uint8_t rx_status;
+    uint8_t rx_buf;
+    uint8_t extended;
+    uint8_t forwarded = 0;
+    uint32_t id;
+    uint32_t start;
+    CanRoute *r;
+
+    /* The held message goes first; until it has, the rest wait */
+    if (held_route[dir]) {
+        mcp2515_select (!dir);
+        if (tx_busy () ||
+            !send (dir, held_route[dir], held[dir], held_start[dir]))
+            return 0;
+
+        held_route[dir] = NULL;
+        forwarded++;
+    }
+
+    mcp2515_select (dir);
+    rx_status = mcp2515_rx_status ();
+
+    for (rx_buf = 0; rx_buf < 2; rx_buf++) {
+        if (!(rx_status & (MCP2515_RXSTATUS_RX0 << rx_buf)))
+            continue;
+
+        start = micros ();
+
+        mcp2515_select (dir);
+        mcp2515_read_raw (rx_buf, raw);
+        extended = mcp2515_raw_get_id (raw, &id) ? 1 : 0;
+
+        r = match (dir, id, extended);
+
+        if (r->action == CAN_ROUTE_DROP) {
+            r->dropped++;
+            continue;
+        }
+
+        if (r->interval &&
+            r->forwarded &&
+            (uint32_t)(millis () - r->last) < r->interval) {
+            r->dropped++;
+            continue;
+        }
+
+        if (r->action == CAN_ROUTE_REMAP)
+            mcp2515_raw_set_id (raw, r->new_id, r->new_extended);
+
+        mcp2515_select (!dir);
+        if (tx_busy () || !send (dir, r, raw, start)) {
+            memcpy (held[dir], raw, sizeof(raw));
+            held_route[dir] = r;
+            held_start[dir] = start;
+            r->delayed++;
+            break;
+        }
+
+        forwarded++;
+    }
+
+    return forwarded;
+}
+
+uint8_t CanGateway::poll ()
+{
+    uint8_t forwarded;
+
+    forwarded = forward (CAN_GATEWAY_A_TO_B);
+    forwarded += forward (CAN_GATEWAY_B_TO_A);
+
+    /* Leave controller A selected for CAN */
+    mcp2515_select (0);
+
+    return forwarded;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANGateway.h
+ * Forwarding of CAN messages between two MCP2515 controllers.
+ */
+
+#ifndef CANGateway_h
+#define CANGateway_h
+
+#include "Arduino.h"
+
+#include <inttypes.h>
+#include "CAN.h"
+
+/** Maximum number of routes in each direction */
+#define CAN_GATEWAY_ROUTES      8
+
+/** Transmit buffer forwarded messages are sent from, on both controllers.
+ *  TXB0 belongs to CAN.send and TXB2 to CAN.publish. */
+#define CAN_GATEWAY_TX_BUF      1
+
+/** Forwarding directions */
+enum CAN_GATEWAY_DIR {
+    CAN_GATEWAY_A_TO_B,     /**< Messages received by controller A */
+    CAN_GATEWAY_B_TO_A,     /**< Messages received by controller B */
+
+    CAN_GATEWAY_DIR_COUNT
+};
+
+/** What a route does with the messages it matches */
+enum CAN_ROUTE_ACTION {
+    CAN_ROUTE_PASS,         /**< Forward the message unchanged */
+    CAN_ROUTE_DROP,         /**< Do not forward the message */
+    CAN_ROUTE_REMAP,        /**< Forward the message with a new identifier */
+};
+
+/**
+ * A routing table entry.  A message matches the route if its identifier
+ * has the same extended flag and (message id & mask) == (id & mask).
+ */
+struct CanRoute {
+    /** Identifier to match */
+    uint32_t id;
+    /** Bits of the identifier to compare */
+    uint32_t mask;
+    /** Identifier to send matching messages with (CAN_ROUTE_REMAP) */
+    uint32_t new_id;
+    /** Extended flag to match */
+    uint8_t extended;
+    /** Extended flag of new_id */
+    uint8_t new_extended;
+    /** One of the CAN_ROUTE_ACTION values */
+    uint8_t action;
+    /** Minimum time between forwarded messages in milliseconds, or 0 for
+      * no rate limit.  Messages arriving sooner are dropped. */
+    uint16_t interval;
+
+    /** Number of messages forwarded */
+    uint32_t forwarded;
+    /** Number of messages dropped by the action or the rate limit */
+    uint32_t dropped;
+    /** Number of messages that waited for the transmit buffer */
+    uint32_t delayed;
+    /** Sum of forwarding latencies in microseconds */
+    uint32_t latency_sum;
+    /** Largest forwarding latency in microseconds */
+    uint16_t latency_max;
+    /** Time of the last forwarded message in milliseconds */
+    uint32_t last;
+};
+
+/**
+ * A gateway between two CAN controllers.  Controller A is driver device 0,
+ * the controller used by CAN; controller B is driver device 1.  Each
+ * received message is matched against the routing table of its direction
+ * (first match wins) and copied straight from the receive buffer of one
+ * controller into transmit buffer CAN_GATEWAY_TX_BUF of the other without
+ * being decoded.
+ *
+ * Each direction sends through that one buffer, so messages leave in the
+ * order they arrived.  While it is still busy with the previous message,
+ * the next is held in the gateway and further messages wait in the
+ * controller's receive buffers.  Messages forwarded to controller A go
+ * through CAN.sendFrom, so CAN's bus load and rate limits cover them and
+ * they are held while A is bus-off; controller B has no such limits.
+ *
+ * Forwarding latency is measured from the moment poll finds the message
+ * in the receive buffer until its transmission has been requested.
+ */
+class CanGateway {
+    public:
+        CanGateway();
+
+        /**
+         * Initialize both controllers and put them in normal mode.
+         * @param ss_b       - Slave select pin of controller B
+         * @param bit_time_a - Bit width on bus A in nanoseconds
+         * @param bit_time_b - Bit width on bus B in nanoseconds
+         * @return True if both controllers were configured successfully.
+         */
+        boolean begin (uint8_t ss_b, uint32_t bit_time_a, uint32_t bit_time_b);
+
+        /**
+         * Add a route.  Routes are matched in the order they were added.
+         * @param dir    - One of the CAN_GATEWAY_DIR values
+         * @param id     - Identifier to match
+         * @param mask   - Bits of the identifier to compare
+         * @param action - One of the CAN_ROUTE_ACTION values
+         * @param new_id - Identifier to forward with for CAN_ROUTE_REMAP
+         * @param extended - Extended flag of id and new_id
+         * @return The new route, so that its interval can be set and its
+         *         statistics read, or NULL if the table is full.
+         */
+        CanRoute *addRoute (uint8_t dir, uint32_t id, uint32_t mask,
+                            uint8_t action, uint32_t new_id = 0,
+                            uint8_t extended = 0);
+
+        /**
+         * Remove all routes of a direction.
+         * @param dir - One of the CAN_GATEWAY_DIR values
+         */
+        void clearRoutes (uint8_t dir);
+
+        /**
+         * Set what happens to messages that match no route.  The default
+         * is CAN_ROUTE_PASS.
+         * @param dir    - One of the CAN_GATEWAY_DIR values
+         * @param action - CAN_ROUTE_PASS or CAN_ROUTE_DROP
+         */
+        void setDefault (uint8_t dir, uint8_t action);
+
+        /**
+         * Get the route used for messages that match no route.  Its
+         * statistics cover all unmatched messages.
+         * @param dir - One of the CAN_GATEWAY_DIR values
+         */
+        CanRoute *defaultRoute (uint8_t dir);
+
+        /**
+         * Forward all messages waiting in both controllers.  Call this as
+         * often as possible from loop().
+         * @return The number of messages forwarded.
+         */
+        uint8_t poll ();
+
+    private:
+        uint8_t forward (uint8_t dir);
+        CanRoute *match (uint8_t dir, uint32_t id, uint8_t extended);
+        static boolean tx_busy ();
+        static boolean send (uint8_t dir, CanRoute *r, const uint8_t *raw,
+                             uint32_t start);
+
+        CanRoute routes[CAN_GATEWAY_DIR_COUNT][CAN_GATEWAY_ROUTES];
+        CanRoute unmatched[CAN_GATEWAY_DIR_COUNT];
+        uint8_t count[CAN_GATEWAY_DIR_COUNT];
+
+        /** Message waiting for the transmit buffer, per direction */
+        uint8_t held[CAN_GATEWAY_DIR_COUNT][MCP2515_RAW_SIZE];
+        /** Route of the held message, or NULL if none is held */
+        CanRoute *held_route[CAN_GATEWAY_DIR_COUNT];
+        /** Time the held message was received (us) */
+        uint32_t held_start[CAN_GATEWAY_DIR_COUNT];
+};
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANLogger.cpp
+ * Compressed message logging.
+ */
+#include <string.h>
+
+#include "Arduino.h"
+#include "CANLogger.h"
+
+static void put16 (uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32 (uint8_t *p, uint32_t v)
+{
+    put16 (p, v);
+    put16 (p + 2, v >> 16);
+}
+
+static uint16_t fletcher16 (const uint8_t *p, uint16_t n)
+{
+    uint16_t a = 0;
+    uint16_t b = 0;
+
+    while (n--) {
+        a = (a + *p++) % 255;
+        b = (b + a) % 255;
+    }
+
+    return (b << 8) | a;
+}
+
+CanLogger::CanLogger ()
+{
+    begin (0);
+}
+
+void CanLogger::begin (can_logger_write_fn fn, void *ctx, uint32_t sector)
+{
+    write_fn = fn;
+    write_ctx = ctx;
+    next_sector = sector;
+    seq = 0;
+
+    active = 0;
+    full = 0;
+    used = 0;
+    slot_count = 0;
+    next_slot = 0;
+
+    memset (&s, 0, sizeof(s));
+}
+
+void CanLogger::start_block (uint32_t time)
+{
+    uint8_t *b = buf[active];
+
+    b[0] = 'C';
+    b[1] = 'L';
+    b[2] = CAN_LOGGER_VERSION;
+    b[3] = CAN_LOGGER_IDS << CAN_LOGGER_IDS_SHIFT;
+    put32 (b + 8, seq);
+    put32 (b + 12, time);
+
+    if (seq % CAN_LOGGER_KEY_BLOCKS == 0) {
+        b[3] |= CAN_LOGGER_KEY;
+        slot_count = 0;
+        next_slot = 0;
+    }
+
+    seq++;
+    used = CAN_LOGGER_HEADER;
+    last_time = time;
+}
+
+void CanLogger::finish_block ()
+{
+    uint8_t *b = buf[active];
+    uint16_t n = used - CAN_LOGGER_HEADER;
+
+    put16 (b + 4, n);
+    put16 (b + 6, fletcher16 (b + CAN_LOGGER_HEADER, n));
+    memset (b + used, 0, CAN_LOGGER_BLOCK - used);
+
+    s.bytes += n;
+    full = 1;
+    active ^= 1;
+    used = 0;
+}
+
+boolean CanLogger::write_full ()
+{
+    if (!full)
+        return true;
+
+    if (!write_fn || !write_fn (next_sector, buf[active ^ 1], write_ctx)) {
+        s.errors++;
+        return false;
+    }
+
+    next_sector++;
+    full = 0;
+    s.blocks++;
+
+    return true;
+}
+
+boolean CanLogger::log (const CanMessage &m, uint32_t time)
+{
+    uint8_t *b;
+    uint8_t *tag;
+    Slot *sl;
+    uint32_t delta;
+    uint8_t len = m.len > CAN_BYTES_MAX ? CAN_BYTES_MAX : m.len;
+    uint8_t extended = m.extended ? 1 : 0;
+    uint8_t rtr = m.rtr ? 1 : 0;
+    uint8_t changed = 0;
+    uint8_t encoding;
+    uint8_t i;
+    uint8_t j;
+
+    if (used && used + CAN_LOGGER_RECORD_MAX > CAN_LOGGER_BLOCK) {
+        if (full) {
+            s.dropped++;
+            return false;
+        }
+        finish_block ();
+    }
+    if (used == 0)
+        start_block (time);
+
+    b = buf[active] + used;
+    tag = b++;
+
+    for (i = 0; i < slot_count; i++) {
+        if (slots[i].id == m.id && slots[i].extended == extended)
+            break;
+    }
+
+    if (i == slot_count) {
+        /* New identifier: take the next slot in turn, which is the
+         * first unused one until the table is full */
+        i = next_slot;
+        next_slot = (next_slot + 1) % CAN_LOGGER_IDS;
+        if (slot_count < CAN_LOGGER_IDS)
+            slot_count++;
+        *tag = CAN_LOGGER_NEW_ID;
+        encoding = CAN_LOGGER_RAW;
+    } else {
+        *tag = i;
+        sl = &slots[i];
+        if (sl->rtr != rtr || sl->len != len) {
+            encoding = CAN_LOGGER_RAW;
+        } else {
+            for (j = 0; j < len && !rtr; j++) {
+                if (m.data[j] != sl->data[j])
+                    changed |= 1 << j;
+            }
+            encoding = changed ? CAN_LOGGER_XOR : CAN_LOGGER_SAME;
+        }
+    }
+    *tag |= encoding << 6;
+    sl = &slots[i];
+
+    if ((*tag & CAN_LOGGER_NEW_ID) == CAN_LOGGER_NEW_ID) {
+        if (extended) {
+            *b++ = (m.id >> 24) | 0x80;
+            *b++ = m.id >> 16;
+        }
+        *b++ = m.id >> 8;
+        *b++ = m.id;
+    }
+
+    delta = time - last_time;
+    last_time = time;
+    while (delta >= 0x80) {
+        *b++ = (delta & 0x7F) | 0x80;
+        delta >>= 7;
+    }
+    *b++ = delta;
+
+    switch (encoding) {
+    case CAN_LOGGER_XOR:
+        *b++ = changed;
+        for (i = 0; i < len; i++) {
+            if (changed & (1 << i))
+                *b++ = m.data[i] ^ sl->data[i];
+        }
+        break;
+    case CAN_LOGGER_RAW:
+        *b++ = len | (rtr << 4);
+        if (!rtr) {
+            memcpy (b, m.data, len);
+            b += len;
+        }
+        break;
+    }
+
+    sl->id = m.id;
+    sl->extended = extended;
+    sl->rtr = rtr;
+    sl->len = len;
+    if (!rtr)
+        memcpy (sl->data, m.data, len);
+
+    used = b - buf[active];
+    s.messages++;
+
+    return true;
+}
+
+void CanLogger::poll ()
+{
+    write_full ();
+}
+
+boolean CanLogger::flush ()
+{
+    if (!write_full ())
+        return false;
+
+    if (used > CAN_LOGGER_HEADER) {
+        finish_block ();
+        return write_full ();
+    }
+
+    return true;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANLogger.h
+ * Compressed logging of received messages to SD cards or flash, written a
+ * whole sector at a time.
+ *
+ * The log is a sequence of CAN_LOGGER_BLOCK byte blocks, one per sector.
+ * A block is a 16 byte header followed by records:
+ *
+ *     offset  size
+ *     0       2     "CL"
+ *     2       1     CAN_LOGGER_VERSION
+ *     3       1     Flags; CAN_LOGGER_KEY in bit 0 if the identifier table
+ *                   was cleared at the start of the block, and the table
+ *                   size CAN_LOGGER_IDS in bits 7-2
+ *     4       2     Bytes of records
+ *     6       2     Fletcher-16 checksum of the records
+ *     8       4     Block sequence number
+ *     12      4     Time of the block start, in microseconds
+ *
+ * Multi-byte header fields are little-endian.  Each record is:
+ *
+ *     tag       Encoding in bits 7-6, identifier slot in bits 5-0
+ *     [id]      If the slot is CAN_LOGGER_NEW_ID: the identifier, 2 bytes
+ *               big-endian, or 4 bytes with the top bit set if extended
+ *     delta     Time since the previous record (or the block start) in
+ *               microseconds, 7 bits per byte, low bits first, top bit
+ *               set if more bytes follow
+ *     payload   CAN_LOGGER_SAME: nothing; the same data as the last
+ *               message in the slot
+ *               CAN_LOGGER_XOR: a byte with bit n set if data byte n
+ *               changed, then each changed byte XORed with its old value
+ *               CAN_LOGGER_RAW: the length in bits 3-0 and the RTR flag
+ *               in bit 4, then the data bytes
+ *
+ * Both ends keep a table of CAN_LOGGER_IDS recent identifiers with the
+ * last message of each.  A new identifier is given the next slot in turn
+ * and always written raw.  The table is cleared every CAN_LOGGER_KEY_BLOCKS
+ * blocks, so decoding can start again after a damaged block.
+ */
+
+#ifndef CANLogger_h
+#define CANLogger_h
+
+#include "Arduino.h"
+
+#include <inttypes.h>
+#include "CAN.h"
+
+/** Size of a block; the sector size of SD cards */
+#define CAN_LOGGER_BLOCK        512
+
+/** Size of the block header */
+#define CAN_LOGGER_HEADER       16
+
+/** Number of identifiers remembered, up to 63; 15 bytes of RAM each on
+ *  AVR, 16 on 32-bit processors */
+#ifndef CAN_LOGGER_IDS
+#define CAN_LOGGER_IDS          32
+#endif
+
+/** Blocks between clearings of the identifier table */
+#define CAN_LOGGER_KEY_BLOCKS   16
+
+#define CAN_LOGGER_VERSION      1
+
+/** Block flag: the identifier table starts empty */
+#define CAN_LOGGER_KEY          0x01
+
+/** Shift of the table size in the block flags */
+#define CAN_LOGGER_IDS_SHIFT    2
+
+/** Slot number of a record that carries its identifier */
+#define CAN_LOGGER_NEW_ID       0x3F
+
+/** Longest record */
+#define CAN_LOGGER_RECORD_MAX   (1 + 4 + 5 + 1 + CAN_BYTES_MAX)
+
+/** Record payload encodings */
+enum CAN_LOGGER_ENCODING {
+    CAN_LOGGER_SAME,        /**< Same data as last time */
+    CAN_LOGGER_XOR,         /**< Changed bytes XORed with the old ones */
+    CAN_LOGGER_RAW,         /**< Length and data */
+};
+
+/**
+ * Writes one block to the medium.
+ * @param sector - Block number, counting from 0
+ * @param block  - CAN_LOGGER_BLOCK bytes
+ * @param ctx    - Context given to CanLogger::begin
+ * @return False if the write failed; it is retried later.
+ */
+typedef boolean (*can_logger_write_fn) (uint32_t sector,
+                                        const uint8_t *block, void *ctx);
+
+/** Logger statistics */
+struct CanLoggerStats {
+    uint32_t messages;      /**< Messages logged */
+    uint32_t dropped;       /**< Messages lost because both buffers were full */
+    uint32_t blocks;        /**< Blocks written */
+    uint32_t errors;        /**< Failed block writes */
+    uint32_t bytes;         /**< Bytes of records */
+};
+
+/**
+ * Logs messages in compressed blocks.  Messages are encoded into one of
+ * two block buffers; when it is full the buffers swap, and poll writes
+ * the full one, so a slow write does not hold up logging.
+ *
+ * A fully loaded 500 kbit/s bus carries about 4000 messages a second;
+ * at the usual 6-10 bytes a record that is 50-80 blocks a second.
+ *
+ * A logger takes about 1.5 KB of RAM: the two block buffers, 1 KB, and
+ * the identifier table, 480 bytes on AVR and 512 on 32-bit processors
+ * with the default CAN_LOGGER_IDS.  An Uno has 2 KB in all, which leaves
+ * too little for the rest of a sketch, so use a Mega or an ARM board.
+ */
+class CanLogger {
+    public:
+        CanLogger();
+
+        /**
+         * Start a log.
+         * @param fn     - Function writing a block
+         * @param ctx    - Passed to fn
+         * @param sector - Block number of the first block
+         */
+        void begin (can_logger_write_fn fn, void *ctx = 0,
+                    uint32_t sector = 0);
+
+        /**
+         * Log a message.
+         * @param m    - The message
+         * @param time - Time it was received, in microseconds
+         * @return False if it was dropped because both buffers are full.
+         */
+        boolean log (const CanMessage &m, uint32_t time);
+
+        /** Log a message received now */
+        boolean log (const CanMessage &m) { return log (m, micros ()); }
+
+        /**
+         * Write a full block if one is waiting.  Call this as often as
+         * possible from loop().
+         */
+        void poll ();
+
+        /**
+         * Write everything logged so far, including a partly filled
+         * block, e.g. before power is removed.
+         * @return False if a write failed.
+         */
+        boolean flush ();
+
+        /** Block number the next block will be written to */
+        uint32_t sector () const { return next_sector; }
+
+        const CanLoggerStats &stats () const { return s; }
+
+    private:
+        struct Slot {
+            uint32_t id;
+            uint8_t extended;
+            uint8_t rtr;
+            uint8_t len;
+            uint8_t data[CAN_BYTES_MAX];
+        };
+
+        void start_block (uint32_t time);
+        void finish_block ();
+        boolean write_full ();
+
+        can_logger_write_fn write_fn;
+        void *write_ctx;
+        uint32_t next_sector;
+        uint32_t seq;
+
+        uint8_t buf[2][CAN_LOGGER_BLOCK];
+        uint8_t active;         /**< Buffer being filled */
+        uint8_t full;           /**< Nonzero if the other buffer waits */
+        uint16_t used;          /**< Bytes used in the active buffer */
+        uint32_t last_time;     /**< Time of the previous record */
+
+        Slot slots[CAN_LOGGER_IDS];
+        uint8_t slot_count;
+        uint8_t next_slot;
+
+        CanLoggerStats s;
+};
+
+#endif
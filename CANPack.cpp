@@ -0,0 +1,391 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANPack.cpp
+ * Packed signal publishing.
+ */
+#include <string.h>
+
+#include "Arduino.h"
+#include "CANPack.h"
+#include "mcp2515_regs.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Signal packing copies variables as little-endian"
+#endif
+
+/** Bits in a message */
+#define FRAME_BITS          (CAN_BYTES_MAX * 8)
+
+/** Bit 31 marks an extended identifier in DBC files */
+#define DBC_EXTENDED        0x80000000UL
+
+CanPacker::CanPacker ()
+{
+    begin (0);
+}
+
+void CanPacker::begin (uint32_t base_id, uint8_t extended, uint8_t tx_bufs)
+{
+    this->base_id = base_id;
+    this->extended = extended ? 1 : 0;
+    this->tx_bufs = tx_bufs;
+
+    signal_count = 0;
+    frame_count = 0;
+    memset (&s, 0, sizeof(s));
+}
+
+int8_t CanPacker::addSignal (void *var, uint8_t bits, uint16_t latency,
+                             const char *name)
+{
+    Signal *sg;
+
+    if (signal_count >= CAN_PACK_SIGNALS || bits == 0 || bits > 32 ||
+        latency == 0)
+        return -1;
+
+    sg = &signals[signal_count];
+    sg->var = (uint8_t *)var;
+    sg->name = name;
+    sg->latency = latency;
+    sg->bits = bits;
+
+    /* Declaring a signal undoes any packing */
+    frame_count = 0;
+
+    return signal_count++;
+}
+
+/*
+ * Find the first bit a signal can start at in a message.  Whole-byte
+ * signals are byte aligned so they are copied with memcpy; others must
+ * fit in 32 bits with their shift.
+ * Returns -1 if there is no room.
+ */
+int8_t CanPacker::place (const Frame *f, uint8_t bits)
+{
+    uint8_t start = f->used;
+
+    if (bits % 8 == 0 || start % 8 + bits > 32)
+        start = (start + 7) & ~7;
+    if (start + bits > FRAME_BITS)
+        return -1;
+
+    return start;
+}
+
+boolean CanPacker::pack ()
+{
+    uint8_t order[CAN_PACK_SIGNALS];
+    CanMessage m;
+    Signal *sg;
+    Frame *f;
+    Step *st;
+    int8_t start = -1;
+    uint8_t i;
+    uint8_t j;
+    uint8_t n;
+
+    frame_count = 0;
+    memset (frames, 0, sizeof(frames));
+
+    /* Tightest latency first, and longest first among equals */
+    for (i = 0; i < signal_count; i++) {
+        for (j = i; j > 0; j--) {
+            sg = &signals[order[j - 1]];
+            if (sg->latency < signals[i].latency ||
+                (sg->latency == signals[i].latency &&
+                 sg->bits >= signals[i].bits))
+                break;
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+
+    for (i = 0; i < signal_count; i++) {
+        sg = &signals[order[i]];
+
+        /* Every open message is at least as fast as this signal needs */
+        for (f = frames; f < frames + frame_count; f++) {
+            start = place (f, sg->bits);
+            if (start >= 0)
+                break;
+        }
+        if (f == frames + frame_count) {
+            if (frame_count >= CAN_PACK_FRAMES) {
+                frame_count = 0;
+                return false;
+            }
+            frame_count++;
+            f->period = sg->latency;
+            start = place (f, sg->bits);
+        }
+
+        sg->frame = f - frames;
+        sg->start = start;
+        f->used = start + sg->bits;
+    }
+
+    /* Compile each message's signals into consecutive steps */
+    n = 0;
+    for (f = frames; f < frames + frame_count; f++) {
+        f->first = n;
+        for (sg = signals; sg < signals + signal_count; sg++) {
+            if (sg->frame != f - frames)
+                continue;
+
+            st = &plan[n++];
+            st->var = sg->var;
+            st->offset = sg->start / 8;
+            st->shift = sg->start % 8;
+            if (st->shift == 0 && sg->bits % 8 == 0) {
+                st->bits = 0;
+                st->width = sg->bits / 8;
+            } else {
+                st->bits = sg->bits;
+                st->width = (st->shift + sg->bits + 7) / 8;
+            }
+        }
+        f->steps = n - f->first;
+        f->len = (f->used + 7) / 8;
+    }
+
+    /* Compare the bus use with sending each signal alone */
+    m.extended = extended;
+    s.frames = frame_count;
+    s.packed_rate = 0;
+    s.packed_bits = 0;
+    s.unpacked_rate = 0;
+    s.unpacked_bits = 0;
+    for (f = frames; f < frames + frame_count; f++) {
+        m.len = f->len;
+        s.packed_rate += 1000 / f->period;
+        s.packed_bits += CAN.frameBits (m) * 1000UL / f->period;
+        /* The first poll sends every message */
+        f->last = micros () - f->period * 1000UL;
+    }
+    for (sg = signals; sg < signals + signal_count; sg++) {
+        m.len = (sg->bits + 7) / 8;
+        s.unpacked_rate += 1000 / sg->latency;
+        s.unpacked_bits += CAN.frameBits (m) * 1000UL / sg->latency;
+    }
+
+    return true;
+}
+
+void CanPacker::pack (const Frame *f, uint8_t *frame) const
+{
+    const Step *st;
+    uint32_t v;
+    uint32_t mask;
+    uint8_t j;
+
+    for (st = plan + f->first; st < plan + f->first + f->steps; st++) {
+        if (!st->bits) {
+            memcpy (frame + st->offset, st->var, st->width);
+            continue;
+        }
+
+        v = 0;
+        for (j = 0; j < (st->bits + 7) / 8; j++)
+            v |= (uint32_t)st->var[j] << (8 * j);
+
+        mask = (((uint32_t)1 << st->bits) - 1) << st->shift;
+        v = (v << st->shift) & mask;
+
+        for (j = 0; j < st->width; j++) {
+            frame[st->offset + j] =
+                (frame[st->offset + j] & ~(uint8_t)(mask >> (8 * j))) |
+                (uint8_t)(v >> (8 * j));
+        }
+    }
+}
+
+void CanPacker::unpack (const Frame *f, const uint8_t *frame) const
+{
+    const Step *st;
+    uint32_t v;
+    uint8_t j;
+
+    for (st = plan + f->first; st < plan + f->first + f->steps; st++) {
+        if (!st->bits) {
+            memcpy (st->var, frame + st->offset, st->width);
+            continue;
+        }
+
+        v = 0;
+        for (j = 0; j < st->width; j++)
+            v |= (uint32_t)frame[st->offset + j] << (8 * j);
+        v = (v >> st->shift) & (((uint32_t)1 << st->bits) - 1);
+
+        for (j = 0; j < (st->bits + 7) / 8; j++)
+            st->var[j] = v >> (8 * j);
+    }
+}
+
+void CanPacker::poll ()
+{
+    uint32_t now = micros ();
+    uint32_t period;
+    Frame *f;
+
+    for (f = frames; f < frames + frame_count; f++) {
+        period = f->period * 1000UL;
+        if (now - f->last < period)
+            continue;
+
+        if (f->pending)
+            s.late++;
+
+        /* Keep to the schedule unless a whole period was missed */
+        f->last += period;
+        if (now - f->last >= period)
+            f->last = now;
+
+        pack (f, f->data);
+        f->pending = 1;
+    }
+
+    send_pending ();
+}
+
+/*
+ * Load waiting messages into the free transmit buffers, in order
+ */
+void CanPacker::send_pending ()
+{
+    CanMessage m;
+    Frame *f;
+    uint8_t status;
+    uint8_t free = 0;
+    uint8_t buf;
+
+    for (f = frames; f < frames + frame_count; f++) {
+        if (f->pending)
+            break;
+    }
+    if (f == frames + frame_count)
+        return;
+
+    status = mcp2515_read_status ();
+    for (buf = 0; buf < 3; buf++) {
+        if ((tx_bufs & (1 << buf)) &&
+            !(status & (MCP2515_STATUS_TX0REQ << (buf << 1))))
+            free |= 1 << buf;
+    }
+
+    for (; f < frames + frame_count && free; f++) {
+        if (!f->pending)
+            continue;
+
+        for (buf = 0; !(free & (1 << buf)); buf++)
+            ;
+
+        m.id = base_id + (f - frames);
+        m.extended = extended;
+        m.len = f->len;
+        memcpy (m.data, f->data, f->len);
+
+        /* Over budget or bus-off; it stays pending */
+        if (!CAN.sendFrom (buf, m))
+            continue;
+        free &= ~(1 << buf);
+
+        f->pending = 0;
+        s.sent++;
+    }
+}
+
+boolean CanPacker::process (const CanMessage &m)
+{
+    const Frame *f;
+    uint32_t n;
+
+    if (m.rtr || (m.extended ? 1 : 0) != extended)
+        return false;
+
+    n = m.id - base_id;
+    if (m.id < base_id || n >= frame_count)
+        return false;
+
+    f = &frames[n];
+    if (m.len < f->len)
+        return false;
+
+    unpack (f, m.data);
+    s.received++;
+
+    return true;
+}
+
+boolean CanPacker::layout (uint8_t signal, uint32_t *id,
+                           uint8_t *start) const
+{
+    if (signal >= signal_count || !frame_count)
+        return false;
+
+    *id = base_id + signals[signal].frame;
+    *start = signals[signal].start;
+
+    return true;
+}
+
+void CanPacker::printDbc () const
+{
+    const Signal *sg;
+    const Frame *f;
+    uint32_t id;
+
+    for (f = frames; f < frames + frame_count; f++) {
+        id = base_id + (f - frames);
+        if (extended)
+            id |= DBC_EXTENDED;
+
+        Serial.print ("BO_ ");
+        Serial.print (id, DEC);
+        Serial.print (" PACK");
+        Serial.print ((unsigned int)(f - frames), DEC);
+        Serial.print (": ");
+        Serial.print (f->len, DEC);
+        Serial.println (" Vector__XXX");
+
+        for (sg = signals; sg < signals + signal_count; sg++) {
+            if (sg->frame != f - frames)
+                continue;
+
+            Serial.print (" SG_ ");
+            if (sg->name) {
+                Serial.print (sg->name);
+            } else {
+                Serial.print ("S");
+                Serial.print ((unsigned int)(sg - signals), DEC);
+            }
+            Serial.print (" : ");
+            Serial.print (sg->start, DEC);
+            Serial.print ("|");
+            Serial.print (sg->bits, DEC);
+            Serial.println ("@1+ (1,0) [0|0] \"\" Vector__XXX");
+        }
+        Serial.println ();
+    }
+
+    for (f = frames; f < frames + frame_count; f++) {
+        id = base_id + (f - frames);
+        if (extended)
+            id |= DBC_EXTENDED;
+
+        Serial.print ("BA_ \"GenMsgCycleTime\" BO_ ");
+        Serial.print (id, DEC);
+        Serial.print (" ");
+        Serial.print (f->period, DEC);
+        Serial.println (";");
+    }
+}
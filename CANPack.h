@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANPack.h
+ * Publishing of small values packed together into as few messages as
+ * their latency bounds allow.
+ */
+
+#ifndef CANPack_h
+#define CANPack_h
+
+#include "Arduino.h"
+
+#include <inttypes.h>
+#include "CAN.h"
+
+/** Maximum number of signals */
+#define CAN_PACK_SIGNALS        32
+
+/** Maximum number of packed messages (identifiers) */
+#define CAN_PACK_FRAMES         8
+
+/** Transmit buffers used for packed messages: TXB1.  TXB0 belongs to
+ *  CAN.send and TXB2 to CAN.publish. */
+#define CAN_PACK_TX_BUFS        0x02
+
+/** Signal statistics, from pack() and while running */
+struct CanPackStats {
+    uint8_t frames;         /**< Messages the signals were packed into */
+    uint16_t packed_rate;   /**< Packed messages per second */
+    uint16_t unpacked_rate; /**< Messages per second, one per signal */
+    uint32_t packed_bits;   /**< Bus bits per second, packed */
+    uint32_t unpacked_bits; /**< Bus bits per second, one per signal */
+    uint32_t sent;          /**< Messages sent */
+    uint32_t late;          /**< Messages still waiting when due again */
+    uint32_t received;      /**< Messages unpacked */
+};
+
+/**
+ * Signal publisher.  Each signal is an application variable of 1-32 bits
+ * with the longest time its value may wait before it is sent.  pack()
+ * places the signals into as few messages as it can: signals are taken
+ * tightest latency first, and each goes into the first message with room,
+ * so slower signals fill the space left in faster messages and a new
+ * message is only started, at the rate of its first signal, when none
+ * has room.  Messages get consecutive identifiers from a base.
+ *
+ * Each message is sent every period, sampling its signals as it is
+ * loaded, from its own transmit buffers so it does not wait behind
+ * CAN.send.  It goes through CAN.sendFrom, so CAN's bus load and rate
+ * limits apply, and a refused message stays pending.  Data is
+ * little-endian, copied from the variables in the processor's byte
+ * order, which must also be little-endian.
+ *
+ * The receiver declares the same signals in the same order, with its own
+ * variables, and calls pack() and process(); the layout depends only on
+ * the declarations, so both ends agree.  printDbc() prints the layout as
+ * a DBC file for other tools.
+ */
+class CanPacker {
+    public:
+        CanPacker();
+
+        /**
+         * Remove all signals and set where messages go.
+         * @param base_id  - Identifier of the first message
+         * @param extended - Nonzero for extended identifiers
+         * @param tx_bufs  - Transmit buffers to send from; bit n selects
+         *                   TXBn.  Leave TXB0 to CAN.send; TXB2 may be
+         *                   added if CAN.publish is not used.
+         */
+        void begin (uint32_t base_id, uint8_t extended = 0,
+                    uint8_t tx_bufs = CAN_PACK_TX_BUFS);
+
+        /**
+         * Declare a signal.
+         * @param var     - The variable; (bits + 7) / 8 bytes are used
+         * @param bits    - Length in bits, 1-32
+         * @param latency - Longest time between sends, in ms
+         * @param name    - Name for printDbc, or 0
+         * @return The signal number, or -1 if CAN_PACK_SIGNALS signals
+         *         exist or an argument is out of range.
+         */
+        int8_t addSignal (void *var, uint8_t bits, uint16_t latency,
+                          const char *name = 0);
+
+        /**
+         * Place the signals into messages.  Call this once all signals
+         * are declared.
+         * @return False if more than CAN_PACK_FRAMES messages are needed;
+         *         nothing is sent then.
+         */
+        boolean pack ();
+
+        /**
+         * Send the messages that are due.  Call this as often as possible
+         * from loop().
+         */
+        void poll ();
+
+        /**
+         * Handle a received message.
+         * @return True if it was one of the packed messages; its signals
+         *         have been written to their variables.
+         */
+        boolean process (const CanMessage &m);
+
+        /**
+         * Find where a signal was placed.
+         * @param signal - The signal
+         * @param id     - Set to the message identifier
+         * @param start  - Set to the first bit, counting from bit 0 of
+         *                 data byte 0
+         * @return False if the signal does not exist or is not packed.
+         */
+        boolean layout (uint8_t signal, uint32_t *id, uint8_t *start) const;
+
+        /** Print the messages and signals to Serial in DBC format */
+        void printDbc () const;
+
+        const CanPackStats &stats () const { return s; }
+
+    private:
+        struct Signal {
+            uint8_t *var;
+            const char *name;
+            uint16_t latency;
+            uint8_t bits;
+            uint8_t frame;      /**< Message it is packed into */
+            uint8_t start;      /**< First bit in the message */
+        };
+
+        /** Copy step; the steps of each message are consecutive */
+        struct Step {
+            uint8_t *var;
+            uint8_t offset;     /**< First byte in the frame */
+            uint8_t width;      /**< Bytes copied, or frame bytes spanned */
+            uint8_t shift;      /**< Bit offset in the first byte */
+            uint8_t bits;       /**< Length in bits; 0 if whole bytes */
+        };
+
+        struct Frame {
+            uint8_t first;      /**< First step */
+            uint8_t steps;
+            uint8_t len;        /**< Length in bytes */
+            uint8_t used;       /**< Bits placed while packing */
+            uint8_t pending;    /**< Nonzero if waiting to be sent */
+            uint16_t period;    /**< Time between sends, in ms */
+            uint32_t last;      /**< Time it was last due (us) */
+            uint8_t data[CAN_BYTES_MAX];
+        };
+
+        static int8_t place (const Frame *f, uint8_t bits);
+        void pack (const Frame *f, uint8_t *frame) const;
+        void unpack (const Frame *f, const uint8_t *frame) const;
+        void send_pending ();
+
+        uint32_t base_id;
+        uint8_t extended;
+        uint8_t tx_bufs;
+
+        Signal signals[CAN_PACK_SIGNALS];
+        uint8_t signal_count;
+        Step plan[CAN_PACK_SIGNALS];
+        Frame frames[CAN_PACK_FRAMES];
+        uint8_t frame_count;
+
+        CanPackStats s;
+};
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANTraffic.cpp
+ * Synthetic traffic generator and receive checker.
+ */
+#include "Arduino.h"
+#include "CANTraffic.h"
+
+/** Default pseudo-random seed */
+#define DEFAULT_SEED        0x2545F491UL
+
+/** Largest standard and extended identifiers */
+#define STD_ID_MAX          0x7FFUL
+#define EXT_ID_MAX          0x1FFFFFFFUL
+
+/*
+ * CanTrafficGen
+ */
+CanTrafficGen::CanTrafficGen ()
+{
+    sent = 0;
+    busy = 0;
+    dropped = 0;
+
+    setFixed (DEFAULT_CAN_ID);
+    weight_count = 0;
+    weight_total = 0;
+
+    setPayload (CAN_TRAFFIC_COUNT);
+    seq = 0;
+    seed (DEFAULT_SEED);
+
+    load = 0;
+    bit_time = CAN_SPEED_500000;
+    setBurst (0, 0);
+
+    running = 0;
+    waiting = 0;
+    due = 0;
+}
+
+void CanTrafficGen::setFixed (uint32_t id, uint8_t extended)
+{
+    setSequential (id, id, extended);
+    dist = CAN_TRAFFIC_FIXED;
+}
+
+void CanTrafficGen::setSequential (uint32_t first, uint32_t last,
+                                   uint8_t extended)
+{
+    uint32_t max = extended ? EXT_ID_MAX : STD_ID_MAX;
+
+    if (first > max)
+        first = max;
+    if (last > max)
+        last = max;
+    if (last < first)
+        last = first;
+
+    dist = CAN_TRAFFIC_SEQUENTIAL;
+    this->first = first;
+    this->last = last;
+    this->next = first;
+    this->extended = extended ? 1 : 0;
+}
+
+void CanTrafficGen::setRandom (uint32_t first, uint32_t last,
+                               uint8_t extended)
+{
+    setSequential (first, last, extended);
+    dist = CAN_TRAFFIC_RANDOM;
+}
+
+boolean CanTrafficGen::addWeighted (uint32_t id, uint8_t weight,
+                                    uint8_t extended)
+{
+    Weight *w;
+
+    if (weight_count >= CAN_TRAFFIC_WEIGHTS_MAX || weight == 0)
+        return false;
+
+    w = &weights[weight_count++];
+    w->id = id;
+    w->weight = weight;
+    w->extended = extended ? 1 : 0;
+    weight_total += weight;
+
+    dist = CAN_TRAFFIC_WEIGHTED;
+
+    return true;
+}
+
+void CanTrafficGen::clearWeighted ()
+{
+    weight_count = 0;
+    weight_total = 0;
+
+    if (dist == CAN_TRAFFIC_WEIGHTED)
+        dist = CAN_TRAFFIC_FIXED;
+}
+
+void CanTrafficGen::setPayload (uint8_t pattern, uint8_t len)
+{
+    if (len < 2)
+        len = 2;
+    if (len > CAN_BYTES_MAX)
+        len = CAN_BYTES_MAX;
+
+    this->pattern = pattern;
+    this->len = len;
+}
+
+void CanTrafficGen::setLoad (uint8_t percent, uint32_t bit_time)
+{
+    if (percent > 100)
+        percent = 100;
+
+    load = percent;
+    this->bit_time = bit_time;
+}
+
+void CanTrafficGen::setBurst (uint16_t count, uint16_t idle)
+{
+    burst = count;
+    this->idle = idle;
+    in_burst = 0;
+}
+
+void CanTrafficGen::seed (uint32_t s)
+{
+    state = s ? s : DEFAULT_SEED;
+}
+
+void CanTrafficGen::start ()
+{
+    seq = 0;
+    next = first;
+    in_burst = 0;
+    waiting = 0;
+    due = micros ();
+    running = 1;
+}
+
+void CanTrafficGen::stop ()
+{
+    running = 0;
+}
+
+/*
+ * xorshift32
+ */
+uint32_t CanTrafficGen::rand32 ()
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+
+    return state;
+}
+
+uint32_t CanTrafficGen::nextId ()
+{
+    uint32_t id;
+    uint16_t r;
+    Weight *w;
+
+    switch (dist) {
+    case CAN_TRAFFIC_SEQUENTIAL:
+        id = next;
+        next = (next >= last) ? first : next + 1;
+        return id;
+
+    case CAN_TRAFFIC_RANDOM:
+        return first + rand32 () % (last - first + 1);
+
+    case CAN_TRAFFIC_WEIGHTED:
+        if (weight_count == 0)
+            break;
+
+        r = rand32 () % weight_total;
+        for (w = weights; r >= w->weight; w++)
+            r -= w->weight;
+
+        extended = w->extended;
+        return w->id;
+    }
+
+    return first;
+}
+
+void CanTrafficGen::fill (CanMessage *m)
+{
+    uint8_t i;
+
+    m->clear ();
+    m->id = nextId ();
+    m->extended = extended;
+    m->len = len;
+
+    /* Big-endian network byte ordering */
+    m->data[0] = (uint8_t)(seq >> 8);
+    m->data[1] = (uint8_t)(seq);
+
+    for (i = 2; i < len; i++) {
+        switch (pattern) {
+        case CAN_TRAFFIC_COUNT:
+            m->data[i] = (uint8_t)(seq + i);
+            break;
+        case CAN_TRAFFIC_RANDOM_DATA:
+            m->data[i] = (uint8_t)rand32 ();
+            break;
+        case CAN_TRAFFIC_ALTERNATE:
+            m->data[i] = (i & 1) ? 0xAA : 0x55;
+            break;
+        default:
+            m->data[i] = 0;
+            break;
+        }
+    }
+}
+
+boolean CanTrafficGen::poll ()
+{
+    CanMessage m;
+    uint32_t now;
+    uint32_t period;
+
+    if (!running)
+        return false;
+
+    now = micros ();
+    if ((int32_t)(now - due) < 0)
+        return false;
+
+    if (!CAN.ready ()) {
+        if (!waiting)
+            busy++;
+        waiting = 1;
+        return false;
+    }
+    waiting = 0;
+
+    fill (&m);
+    if (CAN.send (m) == CAN_TX_DROPPED)
+        dropped++;
+    else
+        sent++;
+    seq++;
+
+    /* period (us) = bits * bit_time (ns) / 1000 * 100 / load */
+    period = load ? (uint32_t)CANClass::frameBits (m) * bit_time / 10 / load
+                  : 0;
+
+    /* Keep the average rate, but do not catch up after falling more than
+     * a message behind */
+    due += period;
+    if ((int32_t)(now - due) > (int32_t)period)
+        due = now;
+
+    if (burst && ++in_burst >= burst) {
+        in_burst = 0;
+        due += (uint32_t)idle * 1000;
+    }
+
+    return true;
+}
+
+/*
+ * CanTrafficCheck
+ */
+CanTrafficCheck::CanTrafficCheck ()
+{
+    reset ();
+}
+
+void CanTrafficCheck::reset ()
+{
+    received = 0;
+    lost = 0;
+    duplicated = 0;
+    reordered = 0;
+    started = 0;
+    expected = 0;
+    window = 0;
+}
+
+boolean CanTrafficCheck::check (const CanMessage &m)
+{
+    uint16_t seq;
+    uint16_t ahead;
+    uint16_t behind;
+
+    if (m.len < 2)
+        return false;
+
+    seq = ((uint16_t)m.data[0] << 8) | m.data[1];
+    received++;
+
+    if (!started) {
+        started = 1;
+        expected = seq + 1;
+        window = 1;
+        return true;
+    }
+
+    ahead = seq - expected;
+    if (ahead < 0x8000) {
+        /* In order, possibly after a gap */
+        lost += ahead;
+        if (ahead + 1 >= CAN_TRAFFIC_WINDOW)
+            window = 1;
+        else
+            window = (window << (ahead + 1)) | 1;
+        expected = seq + 1;
+        return true;
+    }
+
+    behind = expected - 1 - seq;
+    if (behind < CAN_TRAFFIC_WINDOW) {
+        if (window & (1UL << behind)) {
+            duplicated++;
+            return true;
+        }
+        window |= 1UL << behind;
+    }
+
+    /* A message that was counted as lost arrived late */
+    reordered++;
+    if (lost)
+        lost--;
+
+    return true;
+}
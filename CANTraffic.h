@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANTraffic.h
+ * Synthetic traffic generator and receive checker for bus saturation
+ * testing.
+ */
+
+#ifndef CANTraffic_h
+#define CANTraffic_h
+
+#include "Arduino.h"
+
+#include <inttypes.h>
+#include "CAN.h"
+
+/** Maximum number of identifiers in a weighted distribution */
+#define CAN_TRAFFIC_WEIGHTS_MAX 8
+
+/** Number of recent sequence numbers the checker remembers */
+#define CAN_TRAFFIC_WINDOW      32
+
+/** How the generator chooses message identifiers */
+enum CAN_TRAFFIC_IDS {
+    CAN_TRAFFIC_FIXED,      /**< Always the same identifier */
+    CAN_TRAFFIC_SEQUENTIAL, /**< Each identifier of a range in turn */
+    CAN_TRAFFIC_RANDOM,     /**< Uniformly from a range */
+    CAN_TRAFFIC_WEIGHTED,   /**< From a list, in proportion to weights */
+};
+
+/** What the generator puts in the data bytes after the sequence number */
+enum CAN_TRAFFIC_PAYLOAD {
+    CAN_TRAFFIC_ZEROS,      /**< All zeros; the most stuff bits */
+    CAN_TRAFFIC_COUNT,      /**< Bytes counting up from the sequence number */
+    CAN_TRAFFIC_RANDOM_DATA,/**< Pseudo-random bytes */
+    CAN_TRAFFIC_ALTERNATE,  /**< 0x55/0xAA; no stuff bits */
+};
+
+/**
+ * Generates test traffic with CAN.send.  Every message carries a 16 bit
+ * sequence number, big-endian, in its first two data bytes, for
+ * CanTrafficCheck on the receiving node.  The pseudo-random number
+ * generator is seeded explicitly, so a run can be repeated exactly.
+ *
+ * Messages are spaced to reach the target bus load on their own, counted
+ * with the worst case frame length of CANClass::frameBits.  With a burst
+ * profile, a number of messages is sent at that spacing followed by an
+ * idle time.
+ */
+class CanTrafficGen {
+    public:
+        CanTrafficGen();
+
+        /**
+         * Send every message with the same identifier.
+         * @param id       - The message identifier
+         * @param extended - Nonzero if id is an extended identifier
+         */
+        void setFixed (uint32_t id, uint8_t extended = 0);
+
+        /**
+         * Send identifiers first to last in turn, then start again.
+         * Both are limited to the largest 11-bit or 29-bit identifier.
+         * @param first    - The first identifier
+         * @param last     - The last identifier
+         * @param extended - Nonzero for extended identifiers
+         */
+        void setSequential (uint32_t first, uint32_t last,
+                            uint8_t extended = 0);
+
+        /**
+         * Choose identifiers uniformly from first to last.
+         * Both are limited to the largest 11-bit or 29-bit identifier.
+         * @param first    - The lowest identifier
+         * @param last     - The highest identifier
+         * @param extended - Nonzero for extended identifiers
+         */
+        void setRandom (uint32_t first, uint32_t last, uint8_t extended = 0);
+
+        /**
+         * Add an identifier to the weighted distribution and select it.
+         * Each identifier is chosen in proportion to its weight.
+         * @param id       - The message identifier
+         * @param weight   - Relative frequency, 1-255
+         * @param extended - Nonzero if id is an extended identifier
+         * @return False if CAN_TRAFFIC_WEIGHTS_MAX identifiers are
+         *         already set.
+         */
+        boolean addWeighted (uint32_t id, uint8_t weight,
+                             uint8_t extended = 0);
+
+        /** Remove all identifiers from the weighted distribution */
+        void clearWeighted ();
+
+        /**
+         * Set the message payload.
+         * @param pattern - One of the CAN_TRAFFIC_PAYLOAD values
+         * @param len     - Data length, 2-8; the first two bytes hold the
+         *                  sequence number.
+         */
+        void setPayload (uint8_t pattern, uint8_t len = CAN_BYTES_MAX);
+
+        /**
+         * Set the bus load to generate.
+         * @param percent  - Share of the bus bit rate, 1-100, or 0 to send
+         *                   as fast as the transmit buffer frees.
+         * @param bit_time - Bit width of the bus in nanoseconds.
+         */
+        void setLoad (uint8_t percent, uint32_t bit_time);
+
+        /**
+         * Send in bursts.
+         * @param count - Messages per burst, or 0 to send continuously
+         * @param idle  - Time between bursts in milliseconds
+         */
+        void setBurst (uint16_t count, uint16_t idle);
+
+        /** Seed the pseudo-random number generator; must not be 0 */
+        void seed (uint32_t s);
+
+        /** Start generating, from sequence number 0 */
+        void start ();
+
+        /** Stop generating */
+        void stop ();
+
+        /**
+         * Send the next message if it is due.  Call this as often as
+         * possible from loop().
+         * @return True if a message was sent.
+         */
+        boolean poll ();
+
+        /** Messages sent */
+        uint32_t sent;
+        /** Times a message was due but the transmit buffer was busy */
+        uint32_t busy;
+        /** Messages dropped by transmit shaping */
+        uint32_t dropped;
+
+    private:
+        uint32_t rand32 ();
+        uint32_t nextId ();
+        void fill (CanMessage *m);
+
+        struct Weight {
+            uint32_t id;
+            uint8_t weight;
+            uint8_t extended;
+        };
+
+        uint8_t dist;           /**< One of the CAN_TRAFFIC_IDS values */
+        uint32_t first;
+        uint32_t last;
+        uint32_t next;          /**< Next identifier of a sequence */
+        uint8_t extended;
+        Weight weights[CAN_TRAFFIC_WEIGHTS_MAX];
+        uint8_t weight_count;
+        uint16_t weight_total;
+
+        uint8_t pattern;
+        uint8_t len;
+        uint16_t seq;
+        uint32_t state;         /**< Pseudo-random generator state */
+
+        uint8_t load;           /**< Target load in percent */
+        uint32_t bit_time;
+        uint16_t burst;
+        uint16_t idle;
+        uint16_t in_burst;      /**< Messages sent in this burst */
+        uint8_t waiting;        /**< Nonzero if counted as busy */
+
+        uint8_t running;
+        uint32_t due;           /**< Time the next message is due (us) */
+};
+
+/**
+ * Checks received test traffic using the sequence numbers added by
+ * CanTrafficGen.  A gap in the sequence counts as lost messages; if a
+ * missing message arrives later it is counted as reordered instead.  A
+ * sequence number seen again within the last CAN_TRAFFIC_WINDOW messages
+ * counts as a duplicate, and one older than that as reordered.
+ */
+class CanTrafficCheck {
+    public:
+        CanTrafficCheck();
+
+        /** Clear the statistics and wait for a new sequence */
+        void reset ();
+
+        /**
+         * Check a received message.
+         * @param m - The message
+         * @return False if the message is too short to be test traffic.
+         */
+        boolean check (const CanMessage &m);
+
+        /** Messages checked */
+        uint32_t received;
+        /** Messages missing from the sequence */
+        uint32_t lost;
+        /** Messages received more than once */
+        uint32_t duplicated;
+        /** Messages received after a later one */
+        uint32_t reordered;
+
+    private:
+        uint8_t started;
+        uint16_t expected;      /**< Next sequence number expected */
+        uint32_t window;        /**< Bit n set if expected - 1 - n was seen */
+};
+
+#endif
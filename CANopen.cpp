@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANopen.cpp
+ * CANopen process data objects.
+ */
+#include <string.h>
+
+#include "Arduino.h"
+#include "CANopen.h"
+#include "mcp2515_regs.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "CANopen PDO mapping copies variables as little-endian"
+#endif
+
+/** Default COB-ID bases of PDO 0 */
+#define TPDO_BASE           0x180
+#define RPDO_BASE           0x200
+
+/** Indexes below this are dummy mapping entries */
+#define DUMMY_INDEX_END     0x1000
+
+CanOpenPdo::CanOpenPdo ()
+{
+    begin (1);
+}
+
+void CanOpenPdo::begin (uint8_t node_id, uint8_t tx_bufs)
+{
+    this->node_id = node_id;
+    this->tx_bufs = tx_bufs;
+
+    object_count = 0;
+    tpdo_count = 0;
+    rpdo_count = 0;
+    memset (&s, 0, sizeof(s));
+}
+
+boolean CanOpenPdo::addObject (uint16_t index, uint8_t sub, void *var,
+                               uint8_t size)
+{
+    Object *o;
+
+    if (object_count >= CANOPEN_OBJECTS_MAX || size == 0 ||
+        size > CAN_BYTES_MAX)
+        return false;
+
+    o = &objects[object_count++];
+    o->index = index;
+    o->sub = sub;
+    o->var = var;
+    o->size = size;
+
+    return true;
+}
+
+int8_t CanOpenPdo::addTpdo (uint8_t type, uint16_t inhibit, uint16_t event,
+                            uint32_t cob_id)
+{
+    Pdo *p;
+
+    if (tpdo_count >= CANOPEN_TPDO_MAX)
+        return -1;
+    if (type > CANOPEN_SYNC_MAX && type < CANOPEN_EVENT_MFR)
+        return -1;      /* RTR-only types */
+
+    p = &tpdos[tpdo_count];
+    memset (p, 0, sizeof(*p));
+    p->cob_id = cob_id ? cob_id : TPDO_BASE + 0x100 * tpdo_count + node_id;
+    p->type = type;
+    p->inhibit = inhibit;
+    p->event = event;
+    /* The first event may be sent at once */
+    p->last = micros () - inhibit * 100UL;
+
+    return tpdo_count++;
+}
+
+int8_t CanOpenPdo::addRpdo (uint8_t type, uint32_t cob_id)
+{
+    Pdo *p;
+
+    if (rpdo_count >= CANOPEN_RPDO_MAX)
+        return -1;
+
+    p = &rpdos[rpdo_count];
+    memset (p, 0, sizeof(*p));
+    p->cob_id = cob_id ? cob_id : RPDO_BASE + 0x100 * rpdo_count + node_id;
+    p->type = type;
+
+    return rpdo_count++;
+}
+
+/*
+ * Turn mapping entries into copy steps.  Whole-byte entries at byte
+ * boundaries become a single memcpy; others are shifted and masked, and
+ * must fit in 32 bits with their shift.
+ */
+boolean CanOpenPdo::compile (Pdo *p, const uint32_t *entries, uint8_t n)
+{
+    Step *st;
+    Object *o;
+    uint16_t index;
+    uint16_t bit = 0;
+    uint8_t sub;
+    uint8_t bits;
+    uint8_t i;
+    boolean ok = n <= CANOPEN_MAP_MAX;
+
+    p->steps = 0;
+    memset (p->frame, 0, sizeof(p->frame));
+
+    for (i = 0; ok && i < n; i++) {
+        index = entries[i] >> 16;
+        sub = entries[i] >> 8;
+        bits = entries[i];
+
+        if (bits == 0 || bit + bits > CAN_BYTES_MAX * 8) {
+            ok = false;
+            break;
+        }
+
+        if (index >= DUMMY_INDEX_END) {
+            for (o = objects; o < objects + object_count; o++) {
+                if (o->index == index && o->sub == sub)
+                    break;
+            }
+            if (o == objects + object_count || bits > o->size * 8) {
+                ok = false;
+                break;
+            }
+
+            st = &p->plan[p->steps++];
+            st->var = (uint8_t *)o->var;
+            st->offset = bit / 8;
+            st->shift = bit % 8;
+            if (st->shift == 0 && bits % 8 == 0) {
+                st->bits = 0;
+                st->width = bits / 8;
+            } else if (st->shift + bits <= 32) {
+                st->bits = bits;
+                st->width = (st->shift + bits + 7) / 8;
+            } else {
+                ok = false;
+                break;
+            }
+        }
+
+        bit += bits;
+    }
+
+    if (!ok) {
+        p->steps = 0;
+        p->len = 0;
+        return false;
+    }
+
+    p->len = (bit + 7) / 8;
+    return true;
+}
+
+boolean CanOpenPdo::mapTpdo (uint8_t pdo, const uint32_t *entries, uint8_t n)
+{
+    if (pdo >= tpdo_count)
+        return false;
+
+    return compile (&tpdos[pdo], entries, n);
+}
+
+boolean CanOpenPdo::mapRpdo (uint8_t pdo, const uint32_t *entries, uint8_t n)
+{
+    if (pdo >= rpdo_count)
+        return false;
+
+    return compile (&rpdos[pdo], entries, n);
+}
+
+void CanOpenPdo::pack (const Pdo *p, uint8_t *frame)
+{
+    const Step *st;
+    uint32_t v;
+    uint32_t mask;
+    uint8_t j;
+
+    for (st = p->plan; st < p->plan + p->steps; st++) {
+        if (!st->bits) {
+            memcpy (frame + st->offset, st->var, st->width);
+            continue;
+        }
+
+        v = 0;
+        for (j = 0; j < (st->bits + 7) / 8; j++)
+            v |= (uint32_t)st->var[j] << (8 * j);
+
+        mask = (((uint32_t)1 << st->bits) - 1) << st->shift;
+        v = (v << st->shift) & mask;
+
+        for (j = 0; j < st->width; j++) {
+            frame[st->offset + j] =
+                (frame[st->offset + j] & ~(uint8_t)(mask >> (8 * j))) |
+                (uint8_t)(v >> (8 * j));
+        }
+    }
+}
+
+void CanOpenPdo::unpack (const Pdo *p, const uint8_t *frame)
+{
+    const Step *st;
+    uint32_t v;
+    uint8_t j;
+
+    for (st = p->plan; st < p->plan + p->steps; st++) {
+        if (!st->bits) {
+            memcpy (st->var, frame + st->offset, st->width);
+            continue;
+        }
+
+        v = 0;
+        for (j = 0; j < st->width; j++)
+            v |= (uint32_t)frame[st->offset + j] << (8 * j);
+        v = (v >> st->shift) & (((uint32_t)1 << st->bits) - 1);
+
+        for (j = 0; j < (st->bits + 7) / 8; j++)
+            st->var[j] = v >> (8 * j);
+    }
+}
+
+void CanOpenPdo::trigger (uint8_t pdo)
+{
+    if (pdo < tpdo_count)
+        tpdos[pdo].triggered = 1;
+}
+
+boolean CanOpenPdo::process (const CanMessage &m)
+{
+    Pdo *p;
+
+    if (m.extended || m.rtr)
+        return false;
+
+    if (m.id == CANOPEN_SYNC_ID) {
+        sync (micros ());
+        return true;
+    }
+
+    for (p = rpdos; p < rpdos + rpdo_count; p++) {
+        if (p->cob_id != m.id)
+            continue;
+
+        if (m.len < p->len) {
+            s.short_rpdos++;
+        } else if (p->type <= CANOPEN_SYNC_MAX) {
+            /* Takes effect at the next SYNC */
+            memcpy (p->frame, m.data, p->len);
+            p->pending = 1;
+        } else {
+            unpack (p, m.data);
+            s.rpdos++;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Apply synchronous RPDOs, then sample the synchronous TPDOs that are due
+ * and send them
+ */
+void CanOpenPdo::sync (uint32_t now)
+{
+    Pdo *p;
+
+    s.syncs++;
+
+    for (p = rpdos; p < rpdos + rpdo_count; p++) {
+        if (p->pending) {
+            unpack (p, p->frame);
+            p->pending = 0;
+            s.rpdos++;
+        }
+    }
+
+    for (p = tpdos; p < tpdos + tpdo_count; p++) {
+        if (p->type > CANOPEN_SYNC_MAX)
+            continue;
+
+        if (p->type == CANOPEN_SYNC_ACYCLIC) {
+            if (!p->triggered)
+                continue;
+            p->triggered = 0;
+        } else if (++p->syncs < p->type) {
+            continue;
+        }
+        p->syncs = 0;
+
+        if (p->pending)
+            s.overruns++;
+
+        pack (p, p->frame);
+        p->pending = 1;
+        p->sync_time = now;
+    }
+
+    send_pending ();
+}
+
+void CanOpenPdo::poll ()
+{
+    uint32_t now = micros ();
+    Pdo *p;
+
+    for (p = tpdos; p < tpdos + tpdo_count; p++) {
+        if (p->type < CANOPEN_EVENT_MFR || p->pending)
+            continue;
+
+        if (!p->triggered &&
+            !(p->event && now - p->last >= p->event * 1000UL))
+            continue;
+        if (now - p->last < p->inhibit * 100UL)
+            continue;
+
+        p->triggered = 0;
+        pack (p, p->frame);
+        p->pending = 1;
+    }
+
+    send_pending ();
+}
+
+/*
+ * Load waiting TPDOs into the free transmit buffers, in TPDO order
+ */
+void CanOpenPdo::send_pending ()
+{
+    CanMessage m;
+    Pdo *p;
+    uint32_t now;
+    uint32_t latency;
+    uint8_t status;
+    uint8_t free = 0;
+    uint8_t buf;
+
+    for (p = tpdos; p < tpdos + tpdo_count; p++) {
+        if (p->pending)
+            break;
+    }
+    if (p == tpdos + tpdo_count)
+        return;
+
+    status = mcp2515_read_status ();
+    for (buf = 0; buf < 3; buf++) {
+        if ((tx_bufs & (1 << buf)) &&
+            !(status & (MCP2515_STATUS_TX0REQ << (buf << 1))))
+            free |= 1 << buf;
+    }
+
+    for (; p < tpdos + tpdo_count && free; p++) {
+        if (!p->pending)
+            continue;
+
+        for (buf = 0; !(free & (1 << buf)); buf++)
+            ;
+
+        m.id = p->cob_id;
+        m.len = p->len;
+        memcpy (m.data, p->frame, p->len);
+
+        /* Over budget or bus-off; it stays pending */
+        if (!CAN.sendFrom (buf, m))
+            continue;
+        free &= ~(1 << buf);
+
+        now = micros ();
+        p->pending = 0;
+        p->last = now;
+        s.tpdos++;
+
+        if (p->type <= CANOPEN_SYNC_MAX) {
+            latency = now - p->sync_time;
+            s.latency = latency;
+            s.latency_sum += latency;
+            if (latency > s.latency_max)
+                s.latency_max = latency;
+            s.sync_tpdos++;
+        }
+    }
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ * MCP2515 CAN library for arduino.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file CANopen.h
+ * CANopen process data objects (PDOs) mapped onto application variables.
+ */
+
+#ifndef CANopen_h
+#define CANopen_h
+
+#include "Arduino.h"
+
+#include <inttypes.h>
+#include "CAN.h"
+
+/** Maximum number of object dictionary entries */
+#define CANOPEN_OBJECTS_MAX     32
+
+/** Maximum number of transmit PDOs */
+#define CANOPEN_TPDO_MAX        4
+
+/** Maximum number of receive PDOs */
+#define CANOPEN_RPDO_MAX        4
+
+/** Maximum number of objects mapped into one PDO */
+#define CANOPEN_MAP_MAX         8
+
+/** COB-ID of the SYNC message */
+#define CANOPEN_SYNC_ID         0x080
+
+/** Transmit buffers used for TPDOs: TXB1.  TXB0 belongs to CAN.send and
+ *  TXB2 to CAN.publish. */
+#define CANOPEN_TX_BUFS         0x02
+
+/**
+ * Build a mapping entry as in the CANopen mapping parameter objects
+ * (0x1600, 0x1A00): index, sub-index and length in bits.
+ */
+#define CANOPEN_MAP(index, sub, bits) \
+    (((uint32_t)(index) << 16) | ((uint32_t)(sub) << 8) | (bits))
+
+/** PDO transmission types */
+enum CANOPEN_TYPE {
+    CANOPEN_SYNC_ACYCLIC    = 0,    /**< At the SYNC after a trigger */
+    CANOPEN_SYNC_EVERY      = 1,    /**< At every SYNC; 1-240 sends at
+                                      *  every nth SYNC */
+    CANOPEN_SYNC_MAX        = 240,
+    CANOPEN_EVENT_MFR       = 254,  /**< On trigger or event timer */
+    CANOPEN_EVENT           = 255,  /**< On trigger or event timer */
+};
+
+/** PDO statistics */
+struct CanOpenStats {
+    uint32_t syncs;         /**< SYNC messages received */
+    uint32_t tpdos;         /**< TPDOs sent */
+    uint32_t rpdos;         /**< RPDOs written to their variables */
+    uint32_t short_rpdos;   /**< RPDOs ignored for being too short */
+    uint32_t overruns;      /**< Synchronous TPDOs not yet sent at the
+                              *  next SYNC */
+    uint32_t sync_tpdos;    /**< Synchronous TPDOs sent */
+    uint32_t latency;       /**< Last SYNC to TPDO latency, in us */
+    uint32_t latency_max;   /**< Largest SYNC to TPDO latency, in us */
+    uint32_t latency_sum;   /**< Sum of SYNC to TPDO latencies, in us */
+};
+
+/**
+ * CANopen PDO engine.  Application variables are entered into an object
+ * dictionary with addObject, and PDOs map them with the usual CANopen
+ * mapping entries.  Each mapping is compiled, when it is set, into a
+ * plan of copy steps with a fixed frame offset, width and bit shift, so
+ * packing and unpacking a PDO takes the same time whatever the data.
+ * Data is little-endian as CANopen requires; variables are copied in
+ * the processor's byte order, which must also be little-endian (AVR,
+ * ARM and x86 are).
+ *
+ * Synchronous TPDOs are sampled when the SYNC message is processed and
+ * loaded into free transmit buffers straight away; the time from SYNC to
+ * loading is measured.  Event-driven TPDOs are sampled when they are
+ * sent, on trigger or by their event timer, no sooner than their
+ * inhibit time.  TPDOs use their own transmit buffers so they do not
+ * wait behind CAN.send, but go through CAN.sendFrom, so CAN's bus load
+ * and rate limits apply; a TPDO that is refused stays pending.  Received
+ * messages are passed to process; call poll from loop() for the timers.
+ */
+class CanOpenPdo {
+    public:
+        CanOpenPdo();
+
+        /**
+         * Set the node and remove all objects and PDOs.
+         * @param node_id - The CANopen node ID, 1-127
+         * @param tx_bufs - Transmit buffers to send TPDOs from; bit n
+         *                  selects TXBn.  Leave TXB0 to CAN.send; TXB2
+         *                  may be added if CAN.publish is not used.
+         */
+        void begin (uint8_t node_id, uint8_t tx_bufs = CANOPEN_TX_BUFS);
+
+        /**
+         * Enter a variable into the object dictionary.
+         * @param index - Object index
+         * @param sub   - Object sub-index
+         * @param var   - The variable
+         * @param size  - Size of the variable in bytes, 1-8
+         * @return False if CANOPEN_OBJECTS_MAX objects already exist.
+         */
+        boolean addObject (uint16_t index, uint8_t sub, void *var,
+                           uint8_t size);
+
+        /**
+         * Add a transmit PDO.
+         * @param type    - Transmission type; one of the CANOPEN_TYPE
+         *                  values or a SYNC count of 1-240
+         * @param inhibit - Minimum time between event-driven
+         *                  transmissions, in units of 100 us
+         * @param event   - Event timer for event-driven transmission,
+         *                  in ms, or 0 to send on trigger only
+         * @param cob_id  - COB-ID, or 0 for the default of TPDO n,
+         *                  0x180 + 0x100 * n + node ID
+         * @return The TPDO number, or -1 if the type is not supported or
+         *         CANOPEN_TPDO_MAX TPDOs exist.
+         */
+        int8_t addTpdo (uint8_t type, uint16_t inhibit = 0,
+                        uint16_t event = 0, uint32_t cob_id = 0);
+
+        /**
+         * Add a receive PDO.  Synchronous RPDOs are written to their
+         * variables at the next SYNC, others as they are received.
+         * @param type   - Transmission type
+         * @param cob_id - COB-ID, or 0 for the default of RPDO n,
+         *                 0x200 + 0x100 * n + node ID
+         * @return The RPDO number, or -1 if CANOPEN_RPDO_MAX RPDOs exist.
+         */
+        int8_t addRpdo (uint8_t type = CANOPEN_EVENT, uint32_t cob_id = 0);
+
+        /**
+         * Set the mapping of a transmit PDO.  Entries with an index below
+         * 0x1000 are dummy entries that leave their bits zero.
+         * @param pdo     - The TPDO
+         * @param entries - Mapping entries; see CANOPEN_MAP
+         * @param n       - Number of entries, up to CANOPEN_MAP_MAX
+         * @return False if an entry names no object, is longer than its
+         *         object, or does not fit; the mapping is then empty.
+         */
+        boolean mapTpdo (uint8_t pdo, const uint32_t *entries, uint8_t n);
+
+        /**
+         * Set the mapping of a receive PDO.  Entries with an index below
+         * 0x1000 are dummy entries whose bits are skipped.
+         * @see mapTpdo
+         */
+        boolean mapRpdo (uint8_t pdo, const uint32_t *entries, uint8_t n);
+
+        /**
+         * Signal an application event for a TPDO.  An event-driven TPDO
+         * is sent as soon as its inhibit time allows; a
+         * CANOPEN_SYNC_ACYCLIC TPDO is sent at the next SYNC.
+         */
+        void trigger (uint8_t pdo);
+
+        /**
+         * Handle a received message.
+         * @return True if the message was a SYNC or an RPDO.
+         */
+        boolean process (const CanMessage &m);
+
+        /**
+         * Run the event timers and send waiting TPDOs.  Call this as
+         * often as possible from loop().
+         */
+        void poll ();
+
+        /**
+         * Get PDO statistics.  The average SYNC to TPDO latency is
+         * latency_sum / sync_tpdos.
+         */
+        const CanOpenStats &stats () const { return s; }
+
+    private:
+        /** Copy step of a compiled mapping */
+        struct Step {
+            uint8_t *var;
+            uint8_t offset;     /**< First byte in the frame */
+            uint8_t width;      /**< Bytes copied, or frame bytes spanned */
+            uint8_t shift;      /**< Bit offset in the first byte */
+            uint8_t bits;       /**< Length in bits; 0 if whole bytes */
+        };
+
+        struct Object {
+            void *var;
+            uint16_t index;
+            uint8_t sub;
+            uint8_t size;
+        };
+
+        struct Pdo {
+            uint32_t cob_id;
+            Step plan[CANOPEN_MAP_MAX];
+            uint8_t steps;
+            uint8_t len;        /**< Frame length in bytes */
+            uint8_t type;
+            uint8_t syncs;      /**< SYNCs since the last transmission */
+            uint8_t triggered;
+            uint8_t pending;    /**< Nonzero if waiting to be sent */
+            uint16_t inhibit;
+            uint16_t event;
+            uint32_t last;      /**< Time of last transmission (us) */
+            uint32_t sync_time; /**< Time of the SYNC it answers (us) */
+            uint8_t frame[CAN_BYTES_MAX];
+        };
+
+        boolean compile (Pdo *p, const uint32_t *entries, uint8_t n);
+        static void pack (const Pdo *p, uint8_t *frame);
+        static void unpack (const Pdo *p, const uint8_t *frame);
+        void sync (uint32_t now);
+        void send_pending ();
+
+        uint8_t node_id;
+        uint8_t tx_bufs;
+
+        Object objects[CANOPEN_OBJECTS_MAX];
+        uint8_t object_count;
+        Pdo tpdos[CANOPEN_TPDO_MAX];
+        uint8_t tpdo_count;
+        Pdo rpdos[CANOPEN_RPDO_MAX];
+        uint8_t rpdo_count;
+
+        CanOpenStats s;
+};
+
+#endif
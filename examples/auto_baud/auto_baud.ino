@@ -0,0 +1,32 @@
+#include <SPI.h>
+#include <CAN.h>
+
+/* This program finds the bit rate of a CAN bus and then
+ * prints the messages on it, like the bus monitor.  It
+ * only listens, so it can be plugged into a bus of unknown
+ * speed without disturbing it.  If no rate is found, for
+ * example because the bus is quiet, it tries again.  */
+
+uint32_t bit_time;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  while (bit_time == 0) {
+    bit_time = CAN.autoBaud ();
+  }
+
+  Serial.print ("Bit rate: ");
+  Serial.println (1000000000UL / bit_time);
+}
+
+void loop()
+{
+  CanMessage message;
+
+  if (CAN.available ()) {
+    message = CAN.getMessage ();
+    message.print (HEX);
+  }
+}
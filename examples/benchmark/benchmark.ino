@@ -0,0 +1,81 @@
+#include <SPI.h>
+#include <CAN.h>
+
+/* This program measures how fast the driver runs on the
+ * board.  The controller is put in loopback mode so no bus
+ * is needed.  Each driver operation is timed over many
+ * calls, then messages are sent to ourselves and received
+ * as fast as possible.  Results are printed once as CSV
+ * lines in the same format as the host benchmark
+ * ("make bench"), with the time per call in microseconds
+ * and, for the loopback test, the frame rate. */
+
+#define ITERATIONS  1000
+
+CanMessage message;
+unsigned long start;
+unsigned long i;
+
+void report (const char *op, unsigned long n, unsigned long us)
+{
+  Serial.print (op);
+  Serial.print (",");
+  Serial.print (n);
+  Serial.print (",");
+  Serial.print ((float)us / n);
+  Serial.print (",");
+  Serial.println (n * 1000000.0 / us);
+}
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_LOOPBACK);
+
+  Serial.print ("begin_us,");
+  Serial.println (CAN.initTime ());
+
+  Serial.println ("operation,iterations,us_per_call,calls_per_s");
+
+  message.id = 0x321;
+  message.setLongData (0x12345678);
+  message.setLongData (0x9ABCDEF0);
+
+  start = micros ();
+  for (i = 0; i < ITERATIONS; i++)
+    CAN.ready ();
+  report ("ready", ITERATIONS, micros () - start);
+
+  start = micros ();
+  for (i = 0; i < ITERATIONS; i++)
+    CAN.available ();
+  report ("available_empty", ITERATIONS, micros () - start);
+
+  start = micros ();
+  for (i = 0; i < ITERATIONS; i++)
+    mcp2515_set_rx_mask (0, 0, 0);
+  report ("set_rx_mask_unchanged", ITERATIONS, micros () - start);
+
+  start = micros ();
+  for (i = 0; i < ITERATIONS; i++)
+    CAN.setMode (CAN_MODE_LOOPBACK);
+  report ("setMode_unchanged", ITERATIONS, micros () - start);
+
+  /* Send a message and wait until it has been received */
+  start = micros ();
+  for (i = 0; i < ITERATIONS; i++) {
+    while (!CAN.ready ())
+      ;
+    message.send ();
+    while (!CAN.available ())
+      ;
+    CAN.getMessage ();
+  }
+  report ("loopback_frame", ITERATIONS, micros () - start);
+}
+
+void loop()
+{
+}
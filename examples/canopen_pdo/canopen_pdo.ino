@@ -0,0 +1,91 @@
+#include <SPI.h>
+#include <CAN.h>
+#include <CANopen.h>
+
+/* This program is CANopen node 5 with one synchronous and one
+ * event-driven transmit PDO and one receive PDO.  At every
+ * SYNC, TPDO 0 sends the analog reading (0x6401:01, 16 bit)
+ * and a millisecond counter (0x2000:00, 32 bit).  TPDO 1
+ * sends the digital inputs (0x6000:01, 8 bit) whenever they
+ * change, at most every 10 ms and at least every second.
+ * RPDO 0 sets the digital outputs (0x6200:01, 8 bit).  The
+ * SYNC to TPDO latency is printed every five seconds.  */
+
+CanOpenPdo pdo;
+
+uint16_t analog;
+uint32_t counter;
+uint8_t inputs;
+uint8_t outputs;
+unsigned long last;
+
+const uint32_t tpdo0_map[] = {
+  CANOPEN_MAP (0x6401, 1, 16),
+  CANOPEN_MAP (0x2000, 0, 32),
+};
+const uint32_t tpdo1_map[] = {
+  CANOPEN_MAP (0x6000, 1, 8),
+};
+const uint32_t rpdo0_map[] = {
+  CANOPEN_MAP (0x6200, 1, 8),
+};
+
+void setup()
+{
+  int8_t n;
+
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_NORMAL);
+
+  pdo.begin (5);
+  pdo.addObject (0x6401, 1, &analog, sizeof(analog));
+  pdo.addObject (0x2000, 0, &counter, sizeof(counter));
+  pdo.addObject (0x6000, 1, &inputs, sizeof(inputs));
+  pdo.addObject (0x6200, 1, &outputs, sizeof(outputs));
+
+  n = pdo.addTpdo (CANOPEN_SYNC_EVERY);
+  pdo.mapTpdo (n, tpdo0_map, 2);
+  n = pdo.addTpdo (CANOPEN_EVENT, 100, 1000);
+  pdo.mapTpdo (n, tpdo1_map, 1);
+  n = pdo.addRpdo ();
+  pdo.mapRpdo (n, rpdo0_map, 1);
+
+  for (n = 2; n < 10; n++)
+    pinMode (n, n < 6 ? INPUT : OUTPUT);
+}
+
+void loop()
+{
+  uint8_t in = 0;
+  uint8_t i;
+
+  while (CAN.available ())
+    pdo.process (CAN.getMessage ());
+
+  analog = analogRead (A0);
+  counter = millis ();
+
+  for (i = 0; i < 4; i++)
+    in |= digitalRead (2 + i) << i;
+  if (in != inputs) {
+    inputs = in;
+    pdo.trigger (1);
+  }
+
+  for (i = 0; i < 4; i++)
+    digitalWrite (6 + i, (outputs >> i) & 1);
+
+  pdo.poll ();
+
+  if (millis () - last > 5000) {
+    const CanOpenStats &s = pdo.stats ();
+
+    last = millis ();
+    Serial.print ("SYNC to TPDO us avg ");
+    Serial.print (s.sync_tpdos ? s.latency_sum / s.sync_tpdos : 0);
+    Serial.print (" max ");
+    Serial.println (s.latency_max);
+  }
+}
@@ -0,0 +1,64 @@
+#include <SPI.h>
+#include <CAN.h>
+#include <CANDiag.h>
+
+/* This program reads the VIN (UDS ReadDataByIdentifier
+ * 0xF190) from the engine and transmission ECUs at once,
+ * every two seconds, and prints each answer as it arrives.
+ * Requests go to 0x7E0 and 0x7E1, answers come back on 0x7E8
+ * and 0x7E9.  Nothing waits for a response; loop () keeps
+ * running and blinks the LED meanwhile.  */
+
+const uint8_t read_vin[] = { 0x22, 0xF1, 0x90 };
+
+CanDiag diag;
+unsigned long last;
+
+void printResponse (uint8_t status, const uint8_t *data, uint16_t len,
+                    void *ctx)
+{
+  uint16_t i;
+
+  Serial.print ((const char *)ctx);
+  if (status == CAN_DIAG_OK) {
+    Serial.print (" VIN ");
+    for (i = 3; i < len; i++)
+      Serial.print ((char)data[i]);
+    Serial.println ();
+  } else if (status == CAN_DIAG_NEGATIVE) {
+    Serial.print (" negative response ");
+    Serial.println (data[2], HEX);
+  } else if (status == CAN_DIAG_TIMEOUT) {
+    Serial.println (" no response");
+  } else {
+    Serial.println (" error");
+  }
+}
+
+void setup()
+{
+  Serial.begin (115200);
+  pinMode (LED_BUILTIN, OUTPUT);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_NORMAL);
+
+  diag.begin ();
+}
+
+void loop()
+{
+  if (millis () - last >= 2000) {
+    last = millis ();
+    diag.request (0x7E0, 0x7E8, read_vin, sizeof(read_vin),
+                  printResponse, (void *)"engine");
+    diag.request (0x7E1, 0x7E9, read_vin, sizeof(read_vin),
+                  printResponse, (void *)"transmission");
+  }
+
+  if (CAN.available ())
+    diag.process (CAN.getMessage ());
+  diag.poll ();
+
+  digitalWrite (LED_BUILTIN, (millis () / 250) & 1);
+}
@@ -0,0 +1,43 @@
+#include <SPI.h>
+#include <CAN.h>
+#include <mcp2515_driver.h>
+
+/* This program shows the template driver core.  CAN.begin
+ * sets up SPI and the controller as usual, then messages
+ * are sent through a driver instance that writes the SPI
+ * and port registers directly instead of calling
+ * digitalWrite, so each transaction takes a fraction of the
+ * time.  Pin 10 on an Uno is bit 2 of port B.
+ *
+ * The message counter is sent as fast as the bus allows,
+ * and the number of messages sent per second is printed. */
+
+typedef Mcp2515Driver<Mcp2515SpiAvr, Mcp2515SsPortB<2> > Fast;
+
+unsigned long last;
+unsigned long sent;
+unsigned long counter;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_NORMAL);
+}
+
+void loop()
+{
+  /* Bit 2 of READ STATUS is TXREQ of transmit buffer 0 */
+  if (!(Fast::readStatus () & MCP2515_STATUS_TX0REQ)) {
+    Fast::send (0, 0x321, 0, (const uint8_t *)&counter, sizeof(counter));
+    counter++;
+    sent++;
+  }
+
+  if (millis () - last >= 1000) {
+    last = millis ();
+    Serial.println (sent);
+    sent = 0;
+  }
+}
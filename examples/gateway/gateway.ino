@@ -0,0 +1,54 @@
+#include <SPI.h>
+#include <CAN.h>
+#include <CANGateway.h>
+
+/* This program bridges two CAN buses using two MCP2515
+ * controllers.  Controller A uses the default slave select
+ * pin (10) and controller B uses pin 9.  Everything on bus A
+ * is forwarded to bus B except identifier 0x7DF, and message
+ * 0x100 is sent on to bus B as 0x600 at most ten times per
+ * second.  Only message 0x650 is forwarded from bus B to A.
+ * Forwarding statistics are printed every five seconds.  */
+
+CanGateway gateway;
+CanRoute *remap;
+unsigned long last;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  gateway.begin (9, CAN_SPEED_500000, CAN_SPEED_250000);
+
+  gateway.addRoute (CAN_GATEWAY_A_TO_B, 0x7DF, 0x7FF, CAN_ROUTE_DROP);
+  remap = gateway.addRoute (CAN_GATEWAY_A_TO_B, 0x100, 0x7FF,
+                            CAN_ROUTE_REMAP, 0x600);
+  remap->interval = 100;
+
+  gateway.addRoute (CAN_GATEWAY_B_TO_A, 0x650, 0x7FF, CAN_ROUTE_PASS);
+  gateway.setDefault (CAN_GATEWAY_B_TO_A, CAN_ROUTE_DROP);
+}
+
+void loop()
+{
+  CanRoute *r;
+
+  gateway.poll ();
+
+  if (millis () - last > 5000) {
+    last = millis ();
+
+    r = gateway.defaultRoute (CAN_GATEWAY_A_TO_B);
+    Serial.print ("A->B forwarded ");
+    Serial.print (r->forwarded);
+    Serial.print (" delayed ");
+    Serial.print (r->delayed);
+    Serial.print (" max latency us ");
+    Serial.println (r->latency_max);
+
+    Serial.print ("0x100 forwarded ");
+    Serial.print (remap->forwarded);
+    Serial.print (" rate limited ");
+    Serial.println (remap->dropped);
+  }
+}
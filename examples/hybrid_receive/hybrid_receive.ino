@@ -0,0 +1,49 @@
+#include <SPI.h>
+#include <CAN.h>
+
+/* This program counts messages at high bus load without
+ * spending SPI time on an idle bus.  The controller's INT
+ * pin is wired to digital pin 2.  While the bus is quiet
+ * CAN.available () only checks a flag set by the interrupt;
+ * during a burst the controller is polled until it has been
+ * idle for 2 ms.  Every five seconds the number of messages
+ * per wakeup and the share of time spent polling are
+ * printed.  */
+
+#define INT_PIN 2
+
+unsigned long count;
+unsigned long last;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_NORMAL);
+
+  CAN.beginHybrid (digitalPinToInterrupt (INT_PIN), 2000);
+}
+
+void loop()
+{
+  while (CAN.available ()) {
+    CAN.getMessage ();
+    count++;
+  }
+
+  if (millis () - last > 5000) {
+    const CanHybridStats &s = CAN.hybridStats ();
+
+    last = millis ();
+    Serial.print ("messages ");
+    Serial.print (count);
+    Serial.print (" per wakeup ");
+    Serial.print (s.wakeups ? (float)s.frames / s.wakeups : 0);
+    Serial.print (" max ");
+    Serial.print (s.max_batch);
+    Serial.print (" polling ");
+    Serial.print (100.0 * s.poll_time / (s.poll_time + s.irq_time + 1));
+    Serial.println ("%");
+  }
+}
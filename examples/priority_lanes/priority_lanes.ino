@@ -0,0 +1,73 @@
+#include <SPI.h>
+#include <CAN.h>
+
+/* This program keeps control messages apart from bulk
+ * traffic.  Receive buffer 0 only accepts identifiers
+ * 0x000-0x0FF (filters 0 and 1), which go to the control
+ * lane; everything else arrives through buffer 1 into the
+ * bulk lane.  Control messages are always handled first,
+ * however much bulk traffic is waiting.  Every five seconds
+ * the average and worst queueing delay of each lane is
+ * printed.  */
+
+CanLaneEntry control_ring[4];
+CanLaneEntry bulk_ring[32];
+int8_t control;
+int8_t bulk;
+unsigned long last;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+
+  mcp2515_set_rx_mask (0, 0x700, 0);
+  mcp2515_set_rx_filter (0, 0x000, 0);
+  mcp2515_set_rx_filter (1, 0x000, 0);
+  mcp2515_set_rx_mask (1, 0, 0);
+  mcp2515_set_rx_filter (2, 0, 0);
+  mcp2515_set_rx_filter (3, 0, 1);
+
+  CAN.changeMode (CAN_MODE_NORMAL);
+
+  control = CAN.addLane (control_ring, 4);
+  CAN.setLaneFilters (control, 0x03);
+  bulk = CAN.addLane (bulk_ring, 32, CAN_LANE_DROP_OLD);
+}
+
+void print_lane (const char *name, int8_t lane)
+{
+  const CanLaneStats &s = CAN.laneStats (lane);
+
+  Serial.print (name);
+  Serial.print (" received ");
+  Serial.print (s.received);
+  Serial.print (" dropped ");
+  Serial.print (s.dropped);
+  Serial.print (" delay us avg ");
+  Serial.print (s.delivered ? s.delay_sum / s.delivered : 0);
+  Serial.print (" max ");
+  Serial.println (s.delay_max);
+}
+
+void loop()
+{
+  CanMessage m;
+
+  switch (CAN.getPriorityMessage (&m)) {
+  case 0:
+    /* Control message: act on it at once */
+    break;
+  case 1:
+    /* Bulk message: log it */
+    m.print (HEX);
+    break;
+  }
+
+  if (millis () - last > 5000) {
+    last = millis ();
+    print_lane ("control", control);
+    print_lane ("bulk", bulk);
+  }
+}
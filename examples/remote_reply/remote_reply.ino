@@ -0,0 +1,42 @@
+#include <SPI.h>
+#include <CAN.h>
+
+/* This program is a sensor node that is polled with remote
+ * transmission requests.  The latest reading of the analog
+ * input is published under identifier 0x180, and the
+ * library answers every remote request for 0x180 as soon as
+ * it reads it, without the request reaching loop ().  Other
+ * messages, and remote requests for other identifiers, are
+ * printed.  */
+
+#define SENSOR_ID 0x180
+
+unsigned long last;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_NORMAL);
+}
+
+void loop()
+{
+  CanMessage m;
+  uint8_t data[2];
+  int reading;
+
+  if (millis () - last >= 10) {
+    last = millis ();
+    reading = analogRead (A0);
+    data[0] = reading >> 8;
+    data[1] = reading;
+    CAN.publish (SENSOR_ID, data, 2);
+  }
+
+  if (CAN.available ()) {
+    m = CAN.getMessage ();
+    m.print (HEX);
+  }
+}
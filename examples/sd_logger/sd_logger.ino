@@ -0,0 +1,68 @@
+#include <SPI.h>
+#include <SD.h>
+#include <CAN.h>
+#include <CANLogger.h>
+
+/* This program logs every message on the bus to an SD card,
+ * written as raw blocks from the start of the card, so the
+ * card must not be used for anything else.  Read it back on
+ * a PC with "logger" from the host directory, e.g.
+ *     dd if=/dev/sdX of=card.img bs=512 count=100000
+ *     ./host/logger card.img > card.log
+ * The logger is flushed and statistics printed when the
+ * button on pin 2 is pressed.
+ *
+ * The logger needs about 1.5 KB of RAM, so this program does
+ * not fit an Uno's 2 KB; use a Mega or an ARM board.  A
+ * smaller CAN_LOGGER_IDS does not help much, as the two
+ * block buffers alone take 1 KB.  */
+
+#define SD_CS 4
+#define BUTTON 2
+
+Sd2Card card;
+CanLogger logger;
+
+boolean writeBlock (uint32_t sector, const uint8_t *block, void *ctx)
+{
+  return card.writeBlock (sector, block);
+}
+
+void setup()
+{
+  Serial.begin (115200);
+  pinMode (BUTTON, INPUT_PULLUP);
+
+  if (!card.init (SPI_FULL_SPEED, SD_CS)) {
+    Serial.println ("no SD card");
+    for (;;)
+      ;
+  }
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.setMode (CAN_MODE_LISTEN_ONLY);
+
+  logger.begin (writeBlock);
+}
+
+void loop()
+{
+  if (CAN.available ())
+    logger.log (CAN.getMessage ());
+
+  logger.poll ();
+
+  if (digitalRead (BUTTON) == LOW) {
+    logger.flush ();
+    const CanLoggerStats &s = logger.stats ();
+    Serial.print ("messages ");
+    Serial.print (s.messages);
+    Serial.print (" dropped ");
+    Serial.print (s.dropped);
+    Serial.print (" blocks ");
+    Serial.print (s.blocks);
+    Serial.print (" errors ");
+    Serial.println (s.errors);
+    delay (500);
+  }
+}
@@ -0,0 +1,87 @@
+#include <SPI.h>
+#include <CAN.h>
+#include <CANPack.h>
+
+/* This program publishes eight small values that would
+ * otherwise go out one per message.  Each is declared with
+ * its length in bits and the longest it may wait to be sent,
+ * and the library packs them into messages 0x500 onwards.
+ * A receiving node runs the same declarations, with
+ * RECEIVER defined, and gets the values back in its own
+ * variables.  At startup the layout is printed as a DBC file,
+ * followed by the messages per second and bus bits per
+ * second, packed and sent one value per message.  */
+
+/* #define RECEIVER */
+
+uint16_t rpm;
+uint8_t gear;
+uint8_t flags;
+uint16_t temp;
+uint16_t volts;
+uint8_t doors;
+uint16_t fuel;
+uint32_t odometer;
+
+CanPacker packer;
+unsigned long last;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (CAN_SPEED_500000);
+  CAN.changeMode (CAN_MODE_NORMAL);
+
+  packer.begin (0x500);
+  packer.addSignal (&rpm, 14, 10, "rpm");
+  packer.addSignal (&gear, 3, 20, "gear");
+  packer.addSignal (&flags, 5, 10, "flags");
+  packer.addSignal (&temp, 10, 100, "temp");
+  packer.addSignal (&volts, 12, 50, "volts");
+  packer.addSignal (&doors, 4, 100, "doors");
+  packer.addSignal (&fuel, 10, 500, "fuel");
+  packer.addSignal (&odometer, 24, 1000, "odometer");
+  packer.pack ();
+
+  packer.printDbc ();
+
+  const CanPackStats &s = packer.stats ();
+  Serial.print ("messages/s ");
+  Serial.print (s.packed_rate);
+  Serial.print (" packed, ");
+  Serial.print (s.unpacked_rate);
+  Serial.println (" unpacked");
+  Serial.print ("bits/s ");
+  Serial.print (s.packed_bits);
+  Serial.print (" packed, ");
+  Serial.print (s.unpacked_bits);
+  Serial.println (" unpacked");
+}
+
+void loop()
+{
+#ifdef RECEIVER
+  if (CAN.available ())
+    packer.process (CAN.getMessage ());
+
+  if (millis () - last >= 1000) {
+    last = millis ();
+    Serial.print ("rpm ");
+    Serial.print (rpm);
+    Serial.print (" temp ");
+    Serial.print (temp);
+    Serial.print (" odometer ");
+    Serial.println (odometer);
+  }
+#else
+  rpm = analogRead (A0) * 8;
+  temp = analogRead (A1);
+  volts = analogRead (A2) * 4;
+  fuel = analogRead (A3);
+  gear = digitalRead (2) | (digitalRead (3) << 1) | (digitalRead (4) << 2);
+  odometer = millis () / 1000;
+
+  packer.poll ();
+#endif
+}
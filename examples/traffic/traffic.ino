@@ -0,0 +1,81 @@
+#include <SPI.h>
+#include <CAN.h>
+#include <CANTraffic.h>
+
+/* This program measures message loss against bus load.  Load
+ * it on two boards on the same bus, one with SENDER set to 1
+ * and one with it set to 0.  The sender steps the load from
+ * 10% to 100% of the bus, spending ten seconds at each step
+ * with a pause in between.  The receiver checks the sequence
+ * numbers and prints one line of statistics per step:
+ *   received lost duplicated reordered
+ * The sequence restarts at 0 with each step, which the
+ * receiver uses to tell the steps apart.  */
+
+#define SENDER      1
+
+#define BIT_TIME    CAN_SPEED_500000
+#define STEP_TIME   10000
+#define PAUSE_TIME  1000
+
+CanTrafficGen gen;
+CanTrafficCheck check;
+unsigned long step_start;
+uint8_t load = 10;
+boolean paused;
+
+void setup()
+{
+  Serial.begin (115200);
+
+  CAN.begin (BIT_TIME);
+  CAN.changeMode (CAN_MODE_NORMAL);
+
+  gen.setSequential (0x100, 0x10F);
+  gen.setPayload (CAN_TRAFFIC_RANDOM_DATA);
+  gen.seed (1);
+  gen.setLoad (load, BIT_TIME);
+
+  if (SENDER)
+    gen.start ();
+  step_start = millis ();
+}
+
+void print_step ()
+{
+  Serial.print (check.received);
+  Serial.print (" ");
+  Serial.print (check.lost);
+  Serial.print (" ");
+  Serial.print (check.duplicated);
+  Serial.print (" ");
+  Serial.println (check.reordered);
+  check.reset ();
+}
+
+void loop()
+{
+  CanMessage m;
+
+  if (SENDER) {
+    gen.poll ();
+
+    if (!paused && millis () - step_start > STEP_TIME) {
+      gen.stop ();
+      paused = true;
+    } else if (paused && millis () - step_start > STEP_TIME + PAUSE_TIME) {
+      load = load >= 100 ? 10 : load + 10;
+      gen.setLoad (load, BIT_TIME);
+      gen.start ();
+      paused = false;
+      step_start = millis ();
+    }
+  } else if (CAN.available ()) {
+    m = CAN.getMessage ();
+
+    /* Sequence number 0 starts a new step */
+    if (m.len >= 2 && m.data[0] == 0 && m.data[1] == 0 && check.received)
+      print_step ();
+    check.check (m);
+  }
+}
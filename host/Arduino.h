@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/Arduino.h
+ * The parts of the Arduino core used by the CAN library, implemented for
+ * building on a host computer.  Slave select lines are connected to
+ * simulated MCP2515 devices; see mcp2515_sim.h.
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define FALLING         2
+
+#define DEC             10
+#define HEX             16
+
+#define MSBFIRST        1
+
+void pinMode (uint8_t pin, uint8_t mode);
+void digitalWrite (uint8_t pin, uint8_t val);
+int digitalRead (uint8_t pin);
+
+unsigned long millis (void);
+unsigned long micros (void);
+void delay (unsigned long ms);
+void delayMicroseconds (unsigned int us);
+
+#define digitalPinToInterrupt(p)    (p)
+void attachInterrupt (uint8_t irq, void (*isr)(void), int mode);
+void detachInterrupt (uint8_t irq);
+void noInterrupts (void);
+void interrupts (void);
+
+/**
+ * Run the handler attached to an interrupt, as if it had triggered.
+ * @return False if no handler is attached.
+ */
+bool host_interrupt (uint8_t irq);
+
+/** Serial port writing to standard output */
+class HostSerial {
+    public:
+        void begin (unsigned long baud) { (void)baud; }
+        void print (const char *s) { fputs (s, stdout); }
+        void print (char c) { putchar (c); }
+        void print (unsigned long n, int base = DEC);
+        void print (long n, int base = DEC);
+        void print (unsigned int n, int base = DEC) { print ((unsigned long)n, base); }
+        void print (int n, int base = DEC) { print ((long)n, base); }
+        void print (unsigned char n, int base = DEC) { print ((unsigned long)n, base); }
+        void print (double n, int digits = 2) { printf ("%.*f", digits, n); }
+        void println () { putchar ('\n'); }
+        template <class T> void println (T v) { print (v); println (); }
+        template <class T> void println (T v, int f) { print (v, f); println (); }
+        int available () { return 0; }
+        int read () { return -1; }
+};
+
+extern HostSerial Serial;
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/SPI.h
+ * Arduino SPI library for host builds.  Transfers go to the simulated
+ * MCP2515 whose slave select line is asserted.
+ */
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include <stdint.h>
+
+#define SPI_MODE0           0x00
+#define SPI_CLOCK_DIV4      0x00
+
+class SPIClass {
+    public:
+        void begin () {}
+        void end () {}
+        void setDataMode (uint8_t mode) { (void)mode; }
+        void setBitOrder (uint8_t order) { (void)order; }
+        void setClockDivider (uint8_t div) { (void)div; }
+        uint8_t transfer (uint8_t byte);
+};
+
+extern SPIClass SPI;
+
+#endif
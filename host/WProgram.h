@@ -0,0 +1,2 @@
+/* Pre-1.0 Arduino core header */
+#include "Arduino.h"
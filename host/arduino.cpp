@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/arduino.cpp
+ * Arduino core functions for host builds.
+ */
+#include <time.h>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "mcp2515_sim.h"
+
+HostSerial Serial;
+SPIClass SPI;
+
+/** Nonzero for pins that are driven low */
+static uint8_t pin_low[SIM_PINS];
+
+static uint64_t now_us (void)
+{
+    static uint64_t start;
+    struct timespec ts;
+    uint64_t us;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start == 0)
+        start = us;
+
+    return us - start;
+}
+
+void pinMode (uint8_t pin, uint8_t mode)
+{
+    (void)pin;
+    (void)mode;
+}
+
+/*
+ * Every pin drives the slave select line of a simulated MCP2515
+ */
+void digitalWrite (uint8_t pin, uint8_t val)
+{
+    Mcp2515Sim *sim = Mcp2515Sim::at (pin);
+
+    if (!sim)
+        return;
+
+    if (val == LOW && !pin_low[pin])
+        sim->select ();
+    else if (val != LOW && pin_low[pin])
+        sim->deselect ();
+
+    pin_low[pin] = (val == LOW);
+}
+
+int digitalRead (uint8_t pin)
+{
+    return (pin < SIM_PINS && pin_low[pin]) ? LOW : HIGH;
+}
+
+unsigned long millis (void)
+{
+    return (unsigned long)(now_us () / 1000);
+}
+
+unsigned long micros (void)
+{
+    return (unsigned long)now_us ();
+}
+
+void delay (unsigned long ms)
+{
+    delayMicroseconds (ms * 1000);
+}
+
+void delayMicroseconds (unsigned int us)
+{
+    uint64_t end = now_us () + us;
+
+    while (now_us () < end)
+        ;
+}
+
+/** Attached interrupt handlers */
+static void (*isrs[SIM_PINS]) (void);
+
+void attachInterrupt (uint8_t irq, void (*isr)(void), int mode)
+{
+    (void)mode;
+
+    if (irq < SIM_PINS)
+        isrs[irq] = isr;
+}
+
+void detachInterrupt (uint8_t irq)
+{
+    if (irq < SIM_PINS)
+        isrs[irq] = NULL;
+}
+
+bool host_interrupt (uint8_t irq)
+{
+    if (irq >= SIM_PINS || !isrs[irq])
+        return false;
+
+    isrs[irq] ();
+    return true;
+}
+
+void noInterrupts (void)
+{
+}
+
+void interrupts (void)
+{
+}
+
+void HostSerial::print (unsigned long n, int base)
+{
+    if (base == HEX)
+        printf ("%lX", n);
+    else
+        printf ("%lu", n);
+}
+
+void HostSerial::print (long n, int base)
+{
+    if (base == HEX)
+        printf ("%lX", (unsigned long)n);
+    else
+        printf ("%ld", n);
+}
+
+uint8_t SPIClass::transfer (uint8_t byte)
+{
+    if (!Mcp2515Sim::selected)
+        return 0xFF;
+
+    return Mcp2515Sim::selected->transfer (byte);
+}
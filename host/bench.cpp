@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/bench.cpp
+ * Driver benchmark.  Runs each driver operation against the simulated
+ * MCP2515 and prints, as CSV, the SPI transactions and bytes it costs,
+ * the time those bytes take on the wire at the default SPI clock, and the
+ * host CPU time per call.
+ *
+ * Usage: bench [iterations]
+ */
+#include <stdlib.h>
+#include <time.h>
+
+#include "Arduino.h"
+#include "CAN.h"
+#include "mcp2515_sim.h"
+
+/** SPI clock used by CAN.begin (16 MHz / 4) */
+#define SPI_HZ              4000000UL
+
+#define DEFAULT_ITERATIONS  100000UL
+
+/** Slave select pin of the controller used by CAN */
+#define CAN_SS_PIN          10
+
+static Mcp2515Sim *sim;
+
+static uint32_t start_transactions;
+static uint32_t start_bytes;
+static uint64_t start_ns;
+
+static uint64_t cpu_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void start (void)
+{
+    start_transactions = Mcp2515Sim::total_transactions;
+    start_bytes = Mcp2515Sim::total_bytes;
+    start_ns = cpu_ns ();
+}
+
+static void report (const char *op, unsigned long n)
+{
+    uint64_t ns = cpu_ns () - start_ns;
+    double transactions = Mcp2515Sim::total_transactions - start_transactions;
+    double bytes = Mcp2515Sim::total_bytes - start_bytes;
+
+    printf ("%s,%lu,%.2f,%.2f,%.2f,%.1f\n", op, n,
+            transactions / n,
+            bytes / n,
+            bytes * 8 * 1000000 / SPI_HZ / n,
+            (double)ns / n);
+}
+
+/* Put a message in a receive buffer without going through SPI */
+static void inject (unsigned long i)
+{
+    uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, (uint8_t)i };
+
+    sim->receive (0x123, 0, data, 8);
+}
+
+int main (int argc, char **argv)
+{
+    unsigned long n = DEFAULT_ITERATIONS;
+    unsigned long i;
+    CanMessage m;
+
+    if (argc > 1)
+        n = strtoul (argv[1], NULL, 0);
+
+    sim = Mcp2515Sim::at (CAN_SS_PIN);
+
+    printf ("operation,iterations,transactions,bytes,spi_us,cpu_ns\n");
+
+    start ();
+    for (i = 0; i < n; i++)
+        CAN.begin (CAN_SPEED_500000);
+    report ("begin", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        mcp2515_init (i & 1 ? CAN_SPEED_500000 : CAN_SPEED_250000);
+    report ("mcp2515_init", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        mcp2515_init (CAN_SPEED_500000);
+    report ("mcp2515_init_unchanged", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        mcp2515_set_rx_mask (i & 1, i & 0x7FF, 0);
+    report ("set_rx_mask", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        mcp2515_set_rx_mask (0, 0, 0);
+    report ("set_rx_mask_unchanged", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        mcp2515_set_rx_filter (i % 6, i & 0x7FF, 0);
+    report ("set_rx_filter", n);
+
+    /* Leave the filters as begin sets them */
+    CAN.begin (CAN_SPEED_500000);
+
+    start ();
+    for (i = 0; i < n; i++)
+        CAN.changeMode (i & 1 ? CAN_MODE_CONFIG : CAN_MODE_NORMAL);
+    report ("changeMode", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        CAN.setMode (CAN_MODE_NORMAL);
+    report ("setMode_unchanged", n);
+
+    CAN.changeMode (CAN_MODE_NORMAL);
+
+    m.id = 0x321;
+    m.setLongData (0x12345678);
+    m.setLongData (0x9ABCDEF0);
+
+    start ();
+    for (i = 0; i < n; i++)
+        m.send ();
+    report ("send", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        CAN.ready ();
+    report ("ready", n);
+
+    start ();
+    for (i = 0; i < n; i++)
+        CAN.available ();
+    report ("available_empty", n);
+
+    inject (0);
+    start ();
+    for (i = 0; i < n; i++)
+        CAN.available ();
+    report ("available_full", n);
+    CAN.getMessage ();
+
+    start ();
+    for (i = 0; i < n; i++) {
+        inject (i);
+        m = CAN.getMessage ();
+    }
+    report ("getMessage", n);
+
+    start ();
+    for (i = 0; i < n; i++) {
+        inject (i);
+        if (CAN.available ())
+            m = CAN.getMessage ();
+    }
+    report ("receive_loop", n);
+
+    return 0;
+}
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_capture.cpp
+ * Indexed binary capture files.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "can_capture.h"
+
+/* The layout is the file format; keep it free of padding */
+static_assert (sizeof(CanCaptureHeader) == 64, "capture header size");
+static_assert (sizeof(CanCaptureRecord) == 24, "capture record size");
+static_assert (sizeof(CanCaptureChunk) == 344, "capture chunk size");
+
+#define STD_ID_MASK         0x7FFUL
+
+static uint16_t ext_hash (uint32_t id)
+{
+    /* Fibonacci hashing to CAN_CAPTURE_EXT_BITS (2^9) buckets */
+    return (uint16_t)((uint32_t)(id * 2654435761U) >> (32 - 9));
+}
+
+static void chunk_add_id (CanCaptureChunk *c, uint32_t id)
+{
+    uint16_t bit;
+
+    if (id & CAN_CAPTURE_EXTENDED) {
+        bit = ext_hash (id & CAN_CAPTURE_ID_MASK);
+        c->ext_ids[bit >> 3] |= 1 << (bit & 7);
+    } else {
+        bit = id & STD_ID_MASK;
+        c->std_ids[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+void can_capture_decode (const CanCaptureRecord *r, CanLogFrame *frame)
+{
+    frame->time = r->time;
+    frame->rtr = (r->id & CAN_CAPTURE_RTR) ? 1 : 0;
+    frame->msg.clear ();
+    frame->msg.id = r->id & CAN_CAPTURE_ID_MASK;
+    frame->msg.extended = (r->id & CAN_CAPTURE_EXTENDED) ? 1 : 0;
+    frame->msg.len = r->len > CAN_BYTES_MAX ? CAN_BYTES_MAX : r->len;
+    memcpy (frame->msg.data, r->data, sizeof(r->data));
+}
+
+void can_capture_encode (const CanLogFrame *frame, CanCaptureRecord *r)
+{
+    memset (r, 0, sizeof(*r));
+    r->time = frame->time;
+    r->id = frame->msg.id & CAN_CAPTURE_ID_MASK;
+    if (frame->msg.extended)
+        r->id |= CAN_CAPTURE_EXTENDED;
+    if (frame->rtr)
+        r->id |= CAN_CAPTURE_RTR;
+    r->len = frame->msg.len > CAN_BYTES_MAX ? CAN_BYTES_MAX : frame->msg.len;
+    if (!frame->rtr)
+        memcpy (r->data, frame->msg.data, r->len);
+}
+
+/*
+ * CanCaptureWriter
+ */
+CanCaptureWriter::CanCaptureWriter ()
+{
+    f = NULL;
+    chunks = NULL;
+    chunk_count = 0;
+    chunk_alloc = 0;
+    records = 0;
+    error = false;
+}
+
+CanCaptureWriter::~CanCaptureWriter ()
+{
+    close ();
+}
+
+bool CanCaptureWriter::open (const char *path)
+{
+    CanCaptureHeader h;
+
+    close ();
+
+    f = fopen (path, "wb");
+    if (!f)
+        return false;
+
+    /* The header is written again with the totals by close */
+    memset (&h, 0, sizeof(h));
+    memcpy (h.magic, CAN_CAPTURE_MAGIC, sizeof(h.magic));
+    h.version = CAN_CAPTURE_VERSION;
+    h.record_size = sizeof(CanCaptureRecord);
+    h.chunk_records = CAN_CAPTURE_CHUNK;
+
+    records = 0;
+    chunk_count = 0;
+    memset (&cur, 0, sizeof(cur));
+    error = fwrite (&h, sizeof(h), 1, f) != 1;
+
+    return !error;
+}
+
+void CanCaptureWriter::endChunk ()
+{
+    CanCaptureChunk *p;
+
+    if (chunk_count == chunk_alloc) {
+        chunk_alloc = chunk_alloc ? chunk_alloc * 2 : 64;
+        p = (CanCaptureChunk *)realloc (chunks, chunk_alloc * sizeof(*p));
+        if (!p) {
+            error = true;
+            return;
+        }
+        chunks = p;
+    }
+
+    chunks[chunk_count++] = cur;
+    memset (&cur, 0, sizeof(cur));
+}
+
+bool CanCaptureWriter::write (const CanLogFrame *frame)
+{
+    CanCaptureRecord r;
+
+    if (!f || error)
+        return false;
+
+    if (cur.records && frame->time < cur.last)
+        return false;
+    if (!cur.records && chunk_count && frame->time < chunks[chunk_count - 1].last)
+        return false;
+
+    can_capture_encode (frame, &r);
+    if (fwrite (&r, sizeof(r), 1, f) != 1) {
+        error = true;
+        return false;
+    }
+
+    if (cur.records == 0)
+        cur.first = r.time;
+    cur.last = r.time;
+    chunk_add_id (&cur, r.id);
+    records++;
+
+    if (++cur.records == CAN_CAPTURE_CHUNK)
+        endChunk ();
+
+    return true;
+}
+
+bool CanCaptureWriter::close ()
+{
+    CanCaptureHeader h;
+    bool ok;
+
+    if (!f)
+        return false;
+
+    if (cur.records)
+        endChunk ();
+
+    if (!error && chunk_count &&
+        fwrite (chunks, sizeof(*chunks), chunk_count, f) != chunk_count)
+        error = true;
+
+    if (!error) {
+        memset (&h, 0, sizeof(h));
+        memcpy (h.magic, CAN_CAPTURE_MAGIC, sizeof(h.magic));
+        h.version = CAN_CAPTURE_VERSION;
+        h.record_size = sizeof(CanCaptureRecord);
+        h.chunk_records = CAN_CAPTURE_CHUNK;
+        h.records = records;
+        h.index = sizeof(h) + records * sizeof(CanCaptureRecord);
+
+        if (fseek (f, 0, SEEK_SET) != 0 || fwrite (&h, sizeof(h), 1, f) != 1)
+            error = true;
+    }
+
+    ok = !error && fclose (f) == 0;
+    f = NULL;
+
+    free (chunks);
+    chunks = NULL;
+    chunk_alloc = 0;
+
+    return ok;
+}
+
+/*
+ * CanCapture
+ */
+CanCaptureQuery::CanCaptureQuery ()
+{
+    id = 0;
+    mask = 0;
+    extended = 0;
+    start = 0;
+    end = UINT64_MAX;
+}
+
+CanCapture::CanCapture ()
+{
+    map = NULL;
+    map_size = 0;
+    base = NULL;
+    records = 0;
+    chunks = NULL;
+    built = NULL;
+    chunk_count = 0;
+    chunks_read = 0;
+}
+
+CanCapture::~CanCapture ()
+{
+    close ();
+}
+
+bool CanCapture::open (const char *path)
+{
+    const CanCaptureHeader *h;
+    struct stat st;
+    int fd;
+
+    close ();
+
+    fd = ::open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (fstat (fd, &st) != 0 || (size_t)st.st_size < sizeof(*h)) {
+        ::close (fd);
+        return false;
+    }
+
+    map_size = st.st_size;
+    map = mmap (NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        return false;
+    }
+
+    h = (const CanCaptureHeader *)map;
+    if (memcmp (h->magic, CAN_CAPTURE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CAN_CAPTURE_VERSION ||
+        h->record_size != sizeof(CanCaptureRecord) ||
+        h->chunk_records != CAN_CAPTURE_CHUNK) {
+        close ();
+        return false;
+    }
+
+    base = (const CanCaptureRecord *)(h + 1);
+
+    if (h->index == 0) {
+        /* Not closed; use every whole record and index them */
+        records = (map_size - sizeof(*h)) / sizeof(CanCaptureRecord);
+        if (!buildIndex ()) {
+            close ();
+            return false;
+        }
+        return true;
+    }
+
+    records = h->records;
+    chunk_count = (records + CAN_CAPTURE_CHUNK - 1) / CAN_CAPTURE_CHUNK;
+    if (h->index != sizeof(*h) + records * sizeof(CanCaptureRecord) ||
+        h->index + chunk_count * sizeof(CanCaptureChunk) > map_size) {
+        close ();
+        return false;
+    }
+    chunks = (const CanCaptureChunk *)((const uint8_t *)map + h->index);
+
+    return true;
+}
+
+bool CanCapture::buildIndex ()
+{
+    CanCaptureChunk *c;
+    uint64_t i;
+
+    chunk_count = (records + CAN_CAPTURE_CHUNK - 1) / CAN_CAPTURE_CHUNK;
+    if (chunk_count == 0)
+        return true;
+
+    built = (CanCaptureChunk *)calloc (chunk_count, sizeof(*built));
+    if (!built)
+        return false;
+
+    for (i = 0; i < records; i++) {
+        c = &built[i / CAN_CAPTURE_CHUNK];
+        if (c->records == 0)
+            c->first = base[i].time;
+        c->last = base[i].time;
+        c->records++;
+        chunk_add_id (c, base[i].id);
+    }
+
+    chunks = built;
+    return true;
+}
+
+void CanCapture::close ()
+{
+    if (map)
+        munmap (map, map_size);
+    free (built);
+
+    map = NULL;
+    map_size = 0;
+    base = NULL;
+    records = 0;
+    chunks = NULL;
+    built = NULL;
+    chunk_count = 0;
+}
+
+/*
+ * Returns false if the chunk cannot hold a message matching the query
+ */
+bool CanCapture::chunkMatches (const CanCaptureChunk *c,
+                               const CanCaptureQuery *q) const
+{
+    uint16_t bit;
+
+    if (c->last < q->start || c->first > q->end)
+        return false;
+
+    /* The bitmaps only help when the whole identifier is compared */
+    if (q->extended && q->mask == CAN_CAPTURE_ID_MASK) {
+        bit = ext_hash (q->id & CAN_CAPTURE_ID_MASK);
+        return c->ext_ids[bit >> 3] & (1 << (bit & 7));
+    }
+    if (!q->extended && q->mask == STD_ID_MASK) {
+        bit = q->id & STD_ID_MASK;
+        return c->std_ids[bit >> 3] & (1 << (bit & 7));
+    }
+
+    return true;
+}
+
+/*
+ * Returns the first chunk whose last message is at or after time
+ */
+uint64_t CanCapture::firstChunk (uint64_t time) const
+{
+    uint64_t lo = 0;
+    uint64_t hi = chunk_count;
+    uint64_t mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (chunks[mid].last < time)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+const CanCaptureRecord *CanCapture::find (const CanCaptureQuery *q,
+                                          uint64_t *pos)
+{
+    const CanCaptureRecord *r;
+    uint64_t ci;
+    uint64_t end;
+    uint64_t lo;
+    uint64_t hi;
+    uint64_t mid;
+    uint32_t id;
+
+    if (*pos == 0 && chunk_count)
+        *pos = firstChunk (q->start) * CAN_CAPTURE_CHUNK;
+
+    while (*pos < records) {
+        ci = *pos / CAN_CAPTURE_CHUNK;
+        end = (ci + 1) * CAN_CAPTURE_CHUNK;
+        if (end > records)
+            end = records;
+
+        if (chunks[ci].first > q->end)
+            break;
+
+        if (!chunkMatches (&chunks[ci], q)) {
+            *pos = end;
+            continue;
+        }
+
+        if (*pos % CAN_CAPTURE_CHUNK == 0)
+            chunks_read++;
+
+        /* Skip to the start time within the chunk */
+        if (base[*pos].time < q->start) {
+            lo = *pos;
+            hi = end;
+            while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (base[mid].time < q->start)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            *pos = lo;
+        }
+
+        for (; *pos < end; (*pos)++) {
+            r = &base[*pos];
+            if (r->time > q->end) {
+                *pos = records;
+                return NULL;
+            }
+
+            if (q->mask) {
+                id = r->id & CAN_CAPTURE_ID_MASK;
+                if (((r->id & CAN_CAPTURE_EXTENDED) ? 1 : 0) != q->extended ||
+                    (id & q->mask) != (q->id & q->mask))
+                    continue;
+            }
+
+            (*pos)++;
+            return r;
+        }
+    }
+
+    return NULL;
+}
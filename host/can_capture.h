@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_capture.h
+ * Indexed binary capture files.
+ *
+ * A capture file is a header, the messages as fixed size records in time
+ * order, and an index written when the file is closed:
+ *
+ *     header | chunk 0 | chunk 1 | ... | chunk index
+ *
+ * Every chunk holds CAN_CAPTURE_CHUNK records, except the last.  Its index
+ * entry holds the time span of the chunk and a bitmap of the identifiers
+ * in it: one bit per standard identifier, and a hashed bitmap of the
+ * extended ones.  A query reads only the index, finds the chunks of its
+ * time range with a binary search, skips the chunks whose bitmap rules out
+ * its identifier, and binary searches the records of the first chunk for
+ * the start time.
+ *
+ * The file is meant to be mapped into memory; records and index entries
+ * are naturally aligned and all fields are in host byte order.  If a
+ * capture was not closed, e.g. because the writer crashed, the reader
+ * rebuilds the index from the records.
+ */
+
+#ifndef HOST_CAN_CAPTURE_H
+#define HOST_CAN_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "can_log.h"
+
+/** Records per chunk */
+#define CAN_CAPTURE_CHUNK       4096
+
+/** Bits in the bitmap of extended identifiers of a chunk */
+#define CAN_CAPTURE_EXT_BITS    512
+
+#define CAN_CAPTURE_MAGIC       "CANCAP\r\n"
+#define CAN_CAPTURE_VERSION     1
+
+/** Record identifier flags */
+#define CAN_CAPTURE_EXTENDED    0x80000000UL
+#define CAN_CAPTURE_RTR         0x40000000UL
+#define CAN_CAPTURE_ID_MASK     0x1FFFFFFFUL
+
+/** File header */
+struct CanCaptureHeader {
+    char magic[8];              /**< CAN_CAPTURE_MAGIC */
+    uint32_t version;           /**< CAN_CAPTURE_VERSION */
+    uint32_t record_size;       /**< sizeof(CanCaptureRecord) */
+    uint32_t chunk_records;     /**< CAN_CAPTURE_CHUNK */
+    uint32_t reserved;
+    uint64_t records;           /**< Number of records; 0 if not closed */
+    uint64_t index;             /**< Offset of the index; 0 if not closed */
+    uint64_t reserved2[3];
+};
+
+/** A message */
+struct CanCaptureRecord {
+    uint64_t time;              /**< Time in microseconds */
+    uint32_t id;                /**< Identifier and CAN_CAPTURE_ flags */
+    uint8_t len;
+    uint8_t reserved[3];
+    uint8_t data[8];
+};
+
+/** Index entry of a chunk */
+struct CanCaptureChunk {
+    uint64_t first;             /**< Time of the first record */
+    uint64_t last;              /**< Time of the last record */
+    uint32_t records;           /**< Number of records in the chunk */
+    uint32_t reserved;
+    /** Bit n set if the chunk holds standard identifier n */
+    uint8_t std_ids[2048 / 8];
+    /** Bit hash(id) set if the chunk holds extended identifier id */
+    uint8_t ext_ids[CAN_CAPTURE_EXT_BITS / 8];
+};
+
+/** Convert a record to a log frame */
+void can_capture_decode (const CanCaptureRecord *r, CanLogFrame *frame);
+
+/** Convert a log frame to a record */
+void can_capture_encode (const CanLogFrame *frame, CanCaptureRecord *r);
+
+/**
+ * Writes a capture file.  Messages must be added in time order.
+ */
+class CanCaptureWriter {
+    public:
+        CanCaptureWriter ();
+        ~CanCaptureWriter ();
+
+        /**
+         * Create a capture file.
+         * @return False if the file could not be created.
+         */
+        bool open (const char *path);
+
+        /**
+         * Add a message.
+         * @return False if the message is older than the last one or the
+         *         file could not be written.
+         */
+        bool write (const CanLogFrame *frame);
+
+        /**
+         * Write the index and close the file.
+         * @return False if the file could not be written.
+         */
+        bool close ();
+
+        /** Number of messages written */
+        uint64_t records;
+
+    private:
+        void endChunk ();
+
+        FILE *f;
+        CanCaptureChunk *chunks;
+        uint64_t chunk_count;
+        uint64_t chunk_alloc;
+        CanCaptureChunk cur;
+        bool error;
+};
+
+/** Selects messages from a capture */
+struct CanCaptureQuery {
+    uint32_t id;                /**< Identifier to match */
+    uint32_t mask;              /**< Bits of id to compare; 0 for all */
+    uint8_t extended;           /**< Extended flag to match, if mask is set */
+    uint64_t start;             /**< Earliest time */
+    uint64_t end;               /**< Latest time */
+
+    /** Match every message */
+    CanCaptureQuery ();
+};
+
+/**
+ * A capture file mapped into memory.
+ */
+class CanCapture {
+    public:
+        CanCapture ();
+        ~CanCapture ();
+
+        /**
+         * Map a capture file.
+         * @return False if the file could not be read or is not a capture.
+         */
+        bool open (const char *path);
+
+        void close ();
+
+        /** Number of messages */
+        uint64_t size () const { return records; }
+
+        /** Message by position */
+        const CanCaptureRecord *record (uint64_t i) const { return base + i; }
+
+        /** Number of chunks */
+        uint64_t chunkCount () const { return chunk_count; }
+
+        /** Index entry of a chunk */
+        const CanCaptureChunk *chunk (uint64_t i) const { return chunks + i; }
+
+        /**
+         * Find the next message matching a query.
+         * @param q   - The query
+         * @param pos - Position to search from, 0 to start; on return the
+         *              position after the message found.
+         * @return The message, or NULL if there are no more.
+         */
+        const CanCaptureRecord *find (const CanCaptureQuery *q,
+                                      uint64_t *pos);
+
+        /** Number of chunks searched by find since open */
+        uint64_t chunks_read;
+
+    private:
+        bool chunkMatches (const CanCaptureChunk *c,
+                           const CanCaptureQuery *q) const;
+        uint64_t firstChunk (uint64_t time) const;
+        bool buildIndex ();
+
+        void *map;
+        size_t map_size;
+        const CanCaptureRecord *base;
+        uint64_t records;
+        const CanCaptureChunk *chunks;
+        CanCaptureChunk *built;     /**< Index rebuilt by open, if any */
+        uint64_t chunk_count;
+};
+
+#endif
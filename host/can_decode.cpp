@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_decode.cpp
+ * Batch decoding of signals from many messages into columns.
+ */
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "can_decode.h"
+
+/*
+ * A signal as a shift and width within the message as one 64 bit word,
+ * little-endian (byte 0 least significant) or big-endian (byte 0 most
+ * significant).
+ */
+struct Extract {
+    uint8_t shift;
+    uint8_t left;               /**< 64 - length */
+    uint8_t big;
+    uint8_t is_signed;
+    double factor;
+    double offset;
+};
+
+static void plan (const CanSignal *s, Extract *e)
+{
+    uint8_t msb;
+
+    e->left = 64 - s->length;
+    e->big = s->order == CAN_SIGNAL_BIG_ENDIAN;
+    e->is_signed = s->is_signed;
+    e->factor = s->factor;
+    e->offset = s->offset;
+
+    if (e->big) {
+        /* Position of the most significant bit counted from the most
+         * significant bit of the big-endian word */
+        msb = (s->start / 8) * 8 + (7 - s->start % 8);
+        e->shift = 64 - msb - s->length;
+    } else {
+        e->shift = s->start;
+    }
+}
+
+static inline uint64_t load_le (const uint8_t *p)
+{
+    uint64_t w;
+
+    memcpy (&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64 (w);
+#endif
+    return w;
+}
+
+/*
+ * Extract one signal from a block of words.  The field is moved to the
+ * top of the word and back down, which masks it and, with an arithmetic
+ * shift, sign extends it.
+ */
+static void extract (const Extract *e, const uint64_t *words, size_t n,
+                     double *out)
+{
+    const uint8_t up = e->left - e->shift;
+    const uint8_t down = e->left;
+    const double factor = e->factor;
+    const double offset = e->offset;
+    size_t i;
+
+    if (e->is_signed) {
+        for (i = 0; i < n; i++)
+            out[i] = (double)((int64_t)(words[i] << up) >> down) * factor +
+                     offset;
+    } else {
+        for (i = 0; i < n; i++)
+            out[i] = (double)((words[i] << up) >> down) * factor + offset;
+    }
+}
+
+/*
+ * Decode messages first to first + n of a job, n <= CAN_DECODE_BLOCK
+ */
+static void decode_block (const CanDecodeJob *job, const Extract *plans,
+                          size_t first, size_t n)
+{
+    uint64_t le[CAN_DECODE_BLOCK];
+    uint64_t be[CAN_DECODE_BLOCK];
+    const uint8_t *p = job->data + first * job->stride;
+    bool need_be = false;
+    size_t i;
+
+    for (i = 0; i < job->signal_count; i++)
+        need_be |= plans[i].big;
+
+    for (i = 0; i < n; i++, p += job->stride)
+        le[i] = load_le (p);
+
+    if (need_be) {
+        for (i = 0; i < n; i++)
+            be[i] = __builtin_bswap64 (le[i]);
+    }
+
+    for (i = 0; i < job->signal_count; i++) {
+        if (plans[i].big)
+            extract (&plans[i], be, n, job->columns[i] + first);
+        else
+            extract (&plans[i], le, n, job->columns[i] + first);
+    }
+}
+
+static void plan_job (const CanDecodeJob *job, std::vector<Extract> *plans)
+{
+    size_t i;
+
+    plans->resize (job->signal_count);
+    for (i = 0; i < job->signal_count; i++)
+        plan (&job->signals[i], &(*plans)[i]);
+}
+
+void can_decode (const CanDecodeJob *job)
+{
+    std::vector<Extract> plans;
+    size_t first;
+    size_t n;
+
+    plan_job (job, &plans);
+
+    for (first = 0; first < job->count; first += n) {
+        n = job->count - first;
+        if (n > CAN_DECODE_BLOCK)
+            n = CAN_DECODE_BLOCK;
+        decode_block (job, plans.data (), first, n);
+    }
+}
+
+void can_decode_parallel (const CanDecodeJob *jobs, size_t n,
+                          unsigned threads)
+{
+    std::vector<std::vector<Extract> > plans (n);
+    std::vector<size_t> blocks (n + 1);
+    std::vector<std::thread> pool;
+    std::atomic<size_t> next (0);
+    size_t i;
+
+    /* blocks[i] is the number of blocks before job i */
+    blocks[0] = 0;
+    for (i = 0; i < n; i++) {
+        plan_job (&jobs[i], &plans[i]);
+        blocks[i + 1] = blocks[i] +
+                        (jobs[i].count + CAN_DECODE_BLOCK - 1) / CAN_DECODE_BLOCK;
+    }
+
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency ();
+    if (threads == 0)
+        threads = 1;
+    if (threads > blocks[n])
+        threads = blocks[n] ? blocks[n] : 1;
+
+    auto work = [&] () {
+        size_t b;
+        size_t j = 0;
+        size_t first;
+        size_t count;
+
+        while ((b = next.fetch_add (1, std::memory_order_relaxed)) < blocks[n]) {
+            while (blocks[j + 1] <= b)
+                j++;
+
+            first = (b - blocks[j]) * CAN_DECODE_BLOCK;
+            count = jobs[j].count - first;
+            if (count > CAN_DECODE_BLOCK)
+                count = CAN_DECODE_BLOCK;
+
+            decode_block (&jobs[j], plans[j].data (), first, count);
+        }
+    };
+
+    for (i = 1; i < threads; i++)
+        pool.emplace_back (work);
+    work ();
+
+    for (i = 0; i < pool.size (); i++)
+        pool[i].join ();
+}
+
+double can_decode_signal (const uint8_t *data, const CanSignal *s)
+{
+    uint64_t raw = 0;
+    uint8_t bit = s->start;
+    uint8_t i;
+
+    /* Walk from the most significant bit of the signal down */
+    if (s->order == CAN_SIGNAL_BIG_ENDIAN) {
+        for (i = 0; i < s->length; i++) {
+            raw = (raw << 1) | ((data[bit / 8] >> (bit % 8)) & 1);
+            /* Next bit down: lower in the byte, or the top of the next
+             * byte */
+            bit = (bit % 8 == 0) ? bit + 15 : bit - 1;
+        }
+    } else {
+        for (i = 0; i < s->length; i++) {
+            bit = s->start + s->length - 1 - i;
+            raw = (raw << 1) | ((data[bit / 8] >> (bit % 8)) & 1);
+        }
+    }
+
+    if (s->is_signed && s->length < 64 && (raw >> (s->length - 1)) & 1)
+        raw |= ~0ULL << s->length;
+
+    if (s->is_signed)
+        return (double)(int64_t)raw * s->factor + s->offset;
+    return (double)raw * s->factor + s->offset;
+}
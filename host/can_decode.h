@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_decode.h
+ * Batch decoding of signals from many messages into columns.
+ *
+ * Instead of unpacking one message at a time, the decoder loads the data
+ * bytes of a block of messages as 64 bit words, byte swapped once per
+ * message for big-endian signals, and then extracts each signal from the
+ * whole block with a shift, mask, sign extension and scale.  These loops
+ * have no branches or byte accesses, so the compiler vectorizes them.
+ * Each signal is written to its own contiguous array.
+ */
+
+#ifndef HOST_CAN_DECODE_H
+#define HOST_CAN_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Messages decoded at a time; the words of a block stay in cache */
+#define CAN_DECODE_BLOCK        1024
+
+/** Byte order of a signal */
+enum CAN_SIGNAL_ORDER {
+    CAN_SIGNAL_LITTLE_ENDIAN,   /**< Intel */
+    CAN_SIGNAL_BIG_ENDIAN,      /**< Motorola */
+};
+
+/**
+ * Layout of a signal.  Bits are numbered as in DBC files: bit n is bit
+ * n % 8 of data byte n / 8.  For a little-endian signal start is its
+ * least significant bit; for a big-endian signal it is its most
+ * significant bit.  The signal must lie within the eight data bytes.
+ * The physical value is raw * factor + offset.
+ */
+struct CanSignal {
+    uint8_t start;
+    uint8_t length;             /**< 1-64 bits */
+    uint8_t order;              /**< One of the CAN_SIGNAL_ORDER values */
+    uint8_t is_signed;          /**< Nonzero for two's complement */
+    double factor;
+    double offset;
+};
+
+/**
+ * Messages of one identifier and where to put their signals.  The data
+ * bytes of message i are at data + i * stride, so arrays of CanMessage,
+ * CanLogFrame or CanCaptureRecord can be decoded in place.  All eight
+ * bytes are read, whatever the message length.
+ */
+struct CanDecodeJob {
+    const uint8_t *data;        /**< Data bytes of the first message */
+    size_t stride;              /**< Distance between messages in bytes */
+    size_t count;               /**< Number of messages */
+    const CanSignal *signals;
+    size_t signal_count;
+    double **columns;           /**< One array of count values per signal */
+};
+
+/**
+ * Decode the messages of a job.
+ */
+void can_decode (const CanDecodeJob *job);
+
+/**
+ * Decode several jobs in parallel.  The jobs are split into blocks that
+ * the threads take in turn, so a single large job also uses every thread.
+ * @param jobs    - The jobs
+ * @param n       - Number of jobs
+ * @param threads - Number of threads, or 0 for one per processor
+ */
+void can_decode_parallel (const CanDecodeJob *jobs, size_t n,
+                          unsigned threads);
+
+/**
+ * Decode one signal of one message, one bit at a time.  This is slow, and
+ * is meant as a reference for checking the batch decoder.
+ */
+double can_decode_signal (const uint8_t *data, const CanSignal *s);
+
+#endif
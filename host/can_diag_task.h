@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_diag_task.h
+ * C++20 coroutine interface to CanDiag (CANDiag.h) for host programs such
+ * as testers.  A tester's sequence for one ECU is written as straight
+ * line code that co_awaits each request, and one coroutine is started
+ * per ECU:
+ *
+ *     CanDiagTask check (CanDiag &diag, uint32_t tx, uint32_t rx)
+ *     {
+ *         CanDiagResult r = co_await CanDiagRequest (diag, tx, rx,
+ *                                                    {0x22, 0xF1, 0x90});
+ *         if (r.status == CAN_DIAG_OK)
+ *             ...
+ *     }
+ *
+ * Coroutines run until their first request and are resumed from
+ * CanDiag::process or CanDiag::poll when it ends.  Needs -std=c++20.
+ */
+
+#ifndef HOST_CAN_DIAG_TASK_H
+#define HOST_CAN_DIAG_TASK_H
+
+#if __cplusplus < 202002L
+#error "host/can_diag_task.h needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <stdint.h>
+
+#include <coroutine>
+#include <exception>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+#include "CANDiag.h"
+
+/** Status of a request that could not be made: too long, or every
+ *  request in use */
+#define CAN_DIAG_REFUSED    0xFF
+
+/** Outcome of a request */
+struct CanDiagResult {
+    uint8_t status;             /**< CAN_DIAG_STATUS or CAN_DIAG_REFUSED */
+    std::vector<uint8_t> data;  /**< The response */
+};
+
+/**
+ * Awaitable diagnostic request.  The request is made when it is awaited.
+ */
+class CanDiagRequest {
+    public:
+        CanDiagRequest (CanDiag &diag, uint32_t tx_id, uint32_t rx_id,
+                        std::vector<uint8_t> data, uint8_t extended = 0)
+            : diag (diag), tx_id (tx_id), rx_id (rx_id),
+              extended (extended), req (std::move (data)) {}
+
+        CanDiagRequest (CanDiag &diag, uint32_t tx_id, uint32_t rx_id,
+                        std::initializer_list<uint8_t> data,
+                        uint8_t extended = 0)
+            : diag (diag), tx_id (tx_id), rx_id (rx_id),
+              extended (extended), req (data) {}
+
+        bool await_ready () const noexcept { return false; }
+
+        bool await_suspend (std::coroutine_handle<> h)
+        {
+            waiter = h;
+            if (diag.request (tx_id, rx_id, req.data (), req.size (), done,
+                              this, extended) < 0) {
+                result.status = CAN_DIAG_REFUSED;
+                return false;   /* Carry on at once */
+            }
+            return true;
+        }
+
+        CanDiagResult await_resume () { return std::move (result); }
+
+    private:
+        static void done (uint8_t status, const uint8_t *data, uint16_t len,
+                          void *ctx)
+        {
+            CanDiagRequest *r = (CanDiagRequest *)ctx;
+
+            r->result.status = status;
+            r->result.data.assign (data, data + len);
+            r->waiter.resume ();
+        }
+
+        CanDiag &diag;
+        uint32_t tx_id;
+        uint32_t rx_id;
+        uint8_t extended;
+        std::vector<uint8_t> req;
+        std::coroutine_handle<> waiter;
+        CanDiagResult result;
+};
+
+/**
+ * Coroutine returning nothing.  It starts at once and is destroyed with
+ * the task object, which must outlive it.
+ */
+class CanDiagTask {
+    public:
+        struct promise_type {
+            CanDiagTask get_return_object ()
+            {
+                return CanDiagTask (
+                    std::coroutine_handle<promise_type>::from_promise (*this));
+            }
+            std::suspend_never initial_suspend () noexcept { return {}; }
+            std::suspend_always final_suspend () noexcept { return {}; }
+            void return_void () {}
+            void unhandled_exception () { std::terminate (); }
+        };
+
+        CanDiagTask (CanDiagTask &&o) : h (std::exchange (o.h, nullptr)) {}
+        CanDiagTask (const CanDiagTask &) = delete;
+        CanDiagTask &operator= (const CanDiagTask &) = delete;
+        ~CanDiagTask () { if (h) h.destroy (); }
+
+        /** Whether the coroutine has returned */
+        bool done () const { return !h || h.done (); }
+
+    private:
+        explicit CanDiagTask (std::coroutine_handle<promise_type> h)
+            : h (h) {}
+
+        std::coroutine_handle<promise_type> h;
+};
+
+#endif
@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_hub.cpp
+ * Single-producer, multi-consumer broadcast ring.
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "Arduino.h"
+#include "can_hub.h"
+
+static_assert (std::atomic<uint64_t>::is_always_lock_free,
+               "the hub needs lock-free 64-bit atomics");
+
+static uint32_t round_slots (uint32_t slots)
+{
+    uint32_t n = 1;
+
+    while (n < slots && n < 0x80000000UL)
+        n <<= 1;
+
+    return n;
+}
+
+static size_t ring_size (uint32_t slots)
+{
+    return sizeof(CanHubHeader) + (size_t)slots * sizeof(CanHubSlot);
+}
+
+/*
+ * Set up the header and slots of a zeroed ring
+ */
+static void ring_init (void *mem, uint32_t slots)
+{
+    CanHubHeader *hdr = new (mem) CanHubHeader;
+    CanHubSlot *s = (CanHubSlot *)(hdr + 1);
+    uint32_t i;
+
+    for (i = 0; i < slots; i++) {
+        new (&s[i]) CanHubSlot;
+        s[i].seq.store (0, std::memory_order_relaxed);
+    }
+
+    hdr->version = CAN_HUB_VERSION;
+    hdr->slots = slots;
+    hdr->head.store (0, std::memory_order_relaxed);
+
+    /* The magic marks the ring as ready */
+    std::atomic_thread_fence (std::memory_order_release);
+    memcpy (hdr->magic, CAN_HUB_MAGIC, sizeof(hdr->magic));
+}
+
+/*
+ * CanHub
+ */
+CanHub::CanHub ()
+{
+    hdr = NULL;
+    slots = NULL;
+    head = 0;
+    mask = 0;
+    map_size = 0;
+    shm_name = NULL;
+}
+
+CanHub::~CanHub ()
+{
+    close ();
+}
+
+bool CanHub::create (uint32_t n)
+{
+    void *mem;
+
+    close ();
+
+    n = round_slots (n);
+    mem = calloc (1, ring_size (n));
+    if (!mem)
+        return false;
+
+    ring_init (mem, n);
+    hdr = (CanHubHeader *)mem;
+    slots = (CanHubSlot *)(hdr + 1);
+    mask = n - 1;
+    head = 0;
+
+    return true;
+}
+
+bool CanHub::createShared (const char *name, uint32_t n)
+{
+    void *mem;
+    size_t size;
+    int fd;
+
+    close ();
+
+    n = round_slots (n);
+    size = ring_size (n);
+
+    shm_unlink (name);
+    fd = shm_open (name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    if (ftruncate (fd, size) < 0) {
+        ::close (fd);
+        shm_unlink (name);
+        return false;
+    }
+
+    mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink (name);
+        return false;
+    }
+
+    /* ftruncate filled the object with zeros */
+    ring_init (mem, n);
+    hdr = (CanHubHeader *)mem;
+    slots = (CanHubSlot *)(hdr + 1);
+    mask = n - 1;
+    head = 0;
+    map_size = size;
+    shm_name = strdup (name);
+
+    return true;
+}
+
+void CanHub::close ()
+{
+    if (!hdr)
+        return;
+
+    if (map_size) {
+        munmap (hdr, map_size);
+        shm_unlink (shm_name);
+        free (shm_name);
+    } else {
+        free (hdr);
+    }
+
+    hdr = NULL;
+    slots = NULL;
+    map_size = 0;
+    shm_name = NULL;
+}
+
+void CanHub::publish (const CanLogFrame *frame)
+{
+    CanHubSlot *slot = &slots[head & mask];
+    uint64_t word;
+    uint64_t data = 0;
+    uint8_t len;
+    uint8_t i;
+
+    len = frame->msg.len > CAN_BYTES_MAX ? CAN_BYTES_MAX : frame->msg.len;
+
+    word = frame->msg.id & CAN_HUB_ID_MASK;
+    if (frame->msg.extended)
+        word |= CAN_HUB_EXTENDED;
+    if (frame->rtr)
+        word |= CAN_HUB_RTR;
+    word |= (uint64_t)len << 32;
+
+    if (!frame->rtr) {
+        for (i = 0; i < len; i++)
+            data |= (uint64_t)frame->msg.data[i] << (8 * i);
+    }
+
+    /* Readers that see an odd or changed sequence number retry */
+    slot->seq.store (2 * head + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+
+    slot->time.store (frame->time, std::memory_order_relaxed);
+    slot->word.store (word, std::memory_order_relaxed);
+    slot->data.store (data, std::memory_order_relaxed);
+
+    slot->seq.store (2 * head + 2, std::memory_order_release);
+
+    head++;
+    hdr->head.store (head, std::memory_order_release);
+}
+
+uint32_t CanHub::pump ()
+{
+    CanLogFrame frame;
+    uint32_t n = 0;
+
+    while (CAN.available ()) {
+        frame.msg = CAN.getMessage ();
+        frame.rtr = frame.msg.rtr;
+        frame.time = micros ();
+        publish (&frame);
+        n++;
+    }
+
+    return n;
+}
+
+uint64_t CanHub::published () const
+{
+    return head;
+}
+
+/*
+ * CanHubSubscriber
+ */
+CanHubSubscriber::CanHubSubscriber ()
+{
+    hdr = NULL;
+    slots = NULL;
+    cursor = 0;
+    size = 0;
+    map_size = 0;
+    clearFilter ();
+    memset (&s, 0, sizeof(s));
+}
+
+CanHubSubscriber::~CanHubSubscriber ()
+{
+    detach ();
+}
+
+bool CanHubSubscriber::attach (const CanHub *hub)
+{
+    detach ();
+
+    hdr = hub->header ();
+    if (!hdr)
+        return false;
+
+    slots = (const CanHubSlot *)(hdr + 1);
+    size = hdr->slots;
+    cursor = hdr->head.load (std::memory_order_acquire);
+    memset (&s, 0, sizeof(s));
+
+    return true;
+}
+
+bool CanHubSubscriber::attachShared (const char *name)
+{
+    CanHubHeader probe;
+    const CanHubHeader *h;
+    void *mem;
+    size_t size;
+    int fd;
+
+    detach ();
+
+    fd = shm_open (name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    if (read (fd, &probe, sizeof(probe)) != (ssize_t)sizeof(probe) ||
+        memcmp (probe.magic, CAN_HUB_MAGIC, sizeof(probe.magic)) != 0 ||
+        probe.version != CAN_HUB_VERSION) {
+        ::close (fd);
+        return false;
+    }
+
+    size = ring_size (probe.slots);
+    mem = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (mem == MAP_FAILED)
+        return false;
+
+    h = (const CanHubHeader *)mem;
+    hdr = h;
+    slots = (const CanHubSlot *)(h + 1);
+    this->size = h->slots;
+    cursor = h->head.load (std::memory_order_acquire);
+    map_size = size;
+    memset (&s, 0, sizeof(s));
+
+    return true;
+}
+
+void CanHubSubscriber::detach ()
+{
+    if (map_size)
+        munmap ((void *)hdr, map_size);
+
+    hdr = NULL;
+    slots = NULL;
+    map_size = 0;
+}
+
+void CanHubSubscriber::setFilter (uint32_t filter, uint32_t mask,
+                                  uint8_t extended)
+{
+    filtering = 1;
+    this->mask = (mask & CAN_HUB_ID_MASK) | CAN_HUB_EXTENDED;
+    this->filter = (filter & mask & CAN_HUB_ID_MASK) |
+                   (extended ? CAN_HUB_EXTENDED : 0);
+}
+
+void CanHubSubscriber::clearFilter ()
+{
+    filtering = 0;
+    filter = 0;
+    mask = 0;
+}
+
+bool CanHubSubscriber::next (CanLogFrame *frame)
+{
+    const CanHubSlot *slot;
+    uint64_t head;
+    uint64_t lag;
+    uint64_t seq;
+    uint64_t time;
+    uint64_t word;
+    uint64_t data;
+    uint8_t i;
+
+    if (!hdr)
+        return false;
+
+    for (;;) {
+        head = hdr->head.load (std::memory_order_acquire);
+        if (cursor >= head)
+            return false;
+
+        lag = head - cursor;
+        if (lag > size) {
+            /* The producer has lapped us; skip to the oldest message it
+             * has not overwritten yet */
+            s.overruns += lag - size;
+            cursor = head - size;
+            lag = size;
+        }
+        if (lag > s.max_lag)
+            s.max_lag = lag;
+
+        slot = &slots[cursor & (size - 1)];
+        seq = slot->seq.load (std::memory_order_acquire);
+        if (seq != 2 * cursor + 2)
+            continue;   /* Overwritten since head was read */
+
+        time = slot->time.load (std::memory_order_relaxed);
+        word = slot->word.load (std::memory_order_relaxed);
+        data = slot->data.load (std::memory_order_relaxed);
+
+        std::atomic_thread_fence (std::memory_order_acquire);
+        if (slot->seq.load (std::memory_order_relaxed) != seq)
+            continue;   /* Overwritten while it was read */
+
+        cursor++;
+
+        if (filtering && ((uint32_t)word & mask) != filter) {
+            s.filtered++;
+            continue;
+        }
+
+        frame->time = time;
+        frame->rtr = (word & CAN_HUB_RTR) ? 1 : 0;
+        frame->msg.clear ();
+        frame->msg.rtr = frame->rtr;
+        frame->msg.id = word & CAN_HUB_ID_MASK;
+        frame->msg.extended = (word & CAN_HUB_EXTENDED) ? 1 : 0;
+        frame->msg.len = (word >> 32) & 0x0F;
+        for (i = 0; i < frame->msg.len; i++)
+            frame->msg.data[i] = data >> (8 * i);
+
+        s.received++;
+        return true;
+    }
+}
+
+uint64_t CanHubSubscriber::lag () const
+{
+    if (!hdr)
+        return 0;
+
+    return hdr->head.load (std::memory_order_acquire) - cursor;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_hub.h
+ * Receive fan-out for host deployments: one producer broadcasts every
+ * received message to any number of subscribers in other threads or
+ * processes.
+ *
+ * Messages go into a ring of slots.  Each slot is guarded by a sequence
+ * number, odd while the producer writes it (a seqlock), so the producer
+ * never waits for anyone: a subscriber that falls more than the ring
+ * size behind loses the oldest messages, counts them as overruns and
+ * carries on from the oldest message still in the ring.  Subscribers only
+ * read the ring and keep their own cursor, filter and counters, so they
+ * do not slow each other down either.
+ *
+ * The ring is either private to the process or in POSIX shared memory,
+ * where subscribers in other processes map it and read messages in place.
+ * All fields are lock-free 64-bit atomics, which are address-free, so the
+ * same protocol works across processes.
+ */
+
+#ifndef HOST_CAN_HUB_H
+#define HOST_CAN_HUB_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "can_log.h"
+
+#define CAN_HUB_MAGIC           "CANHUB\r\n"
+#define CAN_HUB_VERSION         1
+
+/** Default number of slots in the ring */
+#define CAN_HUB_SLOTS           4096
+
+/** Slot identifier flags */
+#define CAN_HUB_EXTENDED        0x80000000UL
+#define CAN_HUB_RTR             0x40000000UL
+#define CAN_HUB_ID_MASK         0x1FFFFFFFUL
+
+/** A message in the ring */
+struct CanHubSlot {
+    /** 2n + 2 once message n is written; odd while it is being written */
+    std::atomic<uint64_t> seq;
+    std::atomic<uint64_t> time;     /**< Time in microseconds */
+    /** Identifier and CAN_HUB_ flags, and the length in bits 32-39 */
+    std::atomic<uint64_t> word;
+    std::atomic<uint64_t> data;     /**< Data bytes, first in the low byte */
+};
+
+/** Start of the ring */
+struct CanHubHeader {
+    char magic[8];                  /**< CAN_HUB_MAGIC */
+    uint32_t version;               /**< CAN_HUB_VERSION */
+    uint32_t slots;                 /**< Number of slots; a power of two */
+    uint64_t reserved[6];
+    /** Number of messages published; on its own cache line */
+    std::atomic<uint64_t> head;
+    uint64_t reserved2[7];
+};
+
+/**
+ * The producer side of a hub.  Only one thread may publish.
+ */
+class CanHub {
+    public:
+        CanHub ();
+        ~CanHub ();
+
+        /**
+         * Create a ring private to this process.
+         * @param slots - Number of slots, rounded up to a power of two
+         * @return False if memory could not be allocated.
+         */
+        bool create (uint32_t slots = CAN_HUB_SLOTS);
+
+        /**
+         * Create a ring in POSIX shared memory that other processes can
+         * subscribe to with CanHubSubscriber::attachShared.  An existing
+         * object with the name is replaced.
+         * @param name  - Shared memory object name, e.g. "/can0"
+         * @param slots - Number of slots, rounded up to a power of two
+         * @return False if the object could not be created; see errno.
+         */
+        bool createShared (const char *name, uint32_t slots = CAN_HUB_SLOTS);
+
+        /** Release the ring, and remove the shared memory object */
+        void close ();
+
+        /** Broadcast a message */
+        void publish (const CanLogFrame *frame);
+
+        /**
+         * Broadcast every message the library has received, as read with
+         * CAN.available and CAN.getMessage.
+         * @return The number of messages published.
+         */
+        uint32_t pump ();
+
+        /** Messages published */
+        uint64_t published () const;
+
+        /** The ring, for CanHubSubscriber::attach */
+        CanHubHeader *header () const { return hdr; }
+
+    private:
+        CanHubHeader *hdr;
+        CanHubSlot *slots;
+        uint64_t head;
+        uint64_t mask;
+        size_t map_size;
+        char *shm_name;
+};
+
+/** Subscriber statistics */
+struct CanHubStats {
+    uint64_t received;      /**< Messages returned */
+    uint64_t filtered;      /**< Messages skipped by the filter */
+    uint64_t overruns;      /**< Messages lost by falling behind */
+    uint64_t max_lag;       /**< Most messages waiting at once */
+};
+
+/**
+ * A consumer of a hub.  Each subscriber belongs to one thread; any number
+ * of subscribers may read the same hub.
+ */
+class CanHubSubscriber {
+    public:
+        CanHubSubscriber ();
+        ~CanHubSubscriber ();
+
+        /**
+         * Subscribe to a hub in this process.  Only messages published
+         * from now on are received.
+         */
+        bool attach (const CanHub *hub);
+
+        /**
+         * Subscribe to a hub in shared memory.
+         * @param name - Name given to CanHub::createShared
+         * @return False if the object does not exist or is not a hub.
+         */
+        bool attachShared (const char *name);
+
+        /** Stop reading the hub */
+        void detach ();
+
+        /**
+         * Receive only messages with (id & mask) == (filter & mask).
+         * @param filter   - Identifier to match
+         * @param mask     - Identifier bits that must match
+         * @param extended - Nonzero for extended identifiers
+         */
+        void setFilter (uint32_t filter, uint32_t mask, uint8_t extended = 0);
+
+        /** Receive every message */
+        void clearFilter ();
+
+        /**
+         * Take the next message.  Never blocks or waits for the producer.
+         * @return False if no message is waiting.
+         */
+        bool next (CanLogFrame *frame);
+
+        /** Messages waiting to be read, including any about to be lost */
+        uint64_t lag () const;
+
+        const CanHubStats &stats () const { return s; }
+
+    private:
+        const CanHubHeader *hdr;
+        const CanHubSlot *slots;
+        uint64_t cursor;
+        uint64_t size;
+        size_t map_size;        /**< Nonzero if attached to shared memory */
+
+        uint8_t filtering;
+        uint32_t filter;
+        uint32_t mask;
+
+        CanHubStats s;
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_log.cpp
+ * Streaming reader and writer for text CAN logs.
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "can_log.h"
+
+/** Longest log line that can be read */
+#define LINE_MAX_LEN        512
+
+/** Largest standard identifier */
+#define STD_ID_MAX          0x7FF
+
+static const char *skip_space (const char *p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+static const char *skip_word (const char *p)
+{
+    while (*p && !isspace ((unsigned char)*p))
+        p++;
+    return p;
+}
+
+/*
+ * Parse a time in seconds with up to six decimals into microseconds
+ */
+static const char *parse_time (const char *p, uint64_t *us)
+{
+    char *end;
+    uint64_t frac = 0;
+    uint8_t digits = 0;
+
+    *us = strtoull (p, &end, 10) * 1000000;
+    if (end == p)
+        return NULL;
+
+    p = end;
+    if (*p == '.') {
+        for (p++; isdigit ((unsigned char)*p); p++) {
+            if (digits < 6) {
+                frac = frac * 10 + (*p - '0');
+                digits++;
+            }
+        }
+        while (digits++ < 6)
+            frac *= 10;
+    }
+
+    *us += frac;
+    return p;
+}
+
+static int hex_nibble (char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+CanLogReader::CanLogReader (FILE *f)
+{
+    this->f = f;
+    errors = 0;
+    asc_dec = 0;
+}
+
+/*
+ * candump formats, with the timestamp optional:
+ *   (1436509052.249713) can0 123#DEADBEEF
+ *   (1436509052.249713) can0 12345678#R
+ *   (1436509052.249713)  can0  123   [4]  DE AD BE EF
+ */
+bool CanLogReader::parseCandump (const char *p, CanLogFrame *frame)
+{
+    const char *id_start;
+    char *end;
+    int hi;
+    int lo;
+    unsigned long len;
+
+    frame->time = 0;
+    frame->rtr = 0;
+    frame->msg.clear ();
+
+    if (*p == '(') {
+        p = parse_time (p + 1, &frame->time);
+        if (!p || *p != ')')
+            return false;
+        p = skip_space (p + 1);
+    }
+
+    /* Interface name */
+    p = skip_space (skip_word (p));
+
+    id_start = p;
+    frame->msg.id = strtoul (p, &end, 16);
+    if (end == p)
+        return false;
+    p = end;
+    frame->msg.extended = (p - id_start) > 3 || frame->msg.id > STD_ID_MAX;
+
+    if (*p == '#') {
+        p++;
+        if (*p == '#')
+            return false;   /* CAN FD */
+
+        if (*p == 'R' || *p == 'r') {
+            frame->rtr = 1;
+            if (isdigit ((unsigned char)p[1]))
+                frame->msg.len = p[1] - '0';
+            return true;
+        }
+
+        while (frame->msg.len < CAN_BYTES_MAX) {
+            if (*p == '.')
+                p++;
+            hi = hex_nibble (p[0]);
+            lo = hi < 0 ? -1 : hex_nibble (p[1]);
+            if (lo < 0)
+                break;
+            frame->msg.data[frame->msg.len++] = (hi << 4) | lo;
+            p += 2;
+        }
+        return true;
+    }
+
+    p = skip_space (p);
+    if (*p != '[')
+        return false;
+
+    len = strtoul (p + 1, &end, 10);
+    if (*end != ']' || len > CAN_BYTES_MAX)
+        return false;
+    p = skip_space (end + 1);
+
+    if (strncmp (p, "remote", 6) == 0) {
+        frame->rtr = 1;
+        frame->msg.len = len;
+        return true;
+    }
+
+    while (frame->msg.len < len) {
+        hi = hex_nibble (p[0]);
+        lo = hi < 0 ? -1 : hex_nibble (p[1]);
+        if (lo < 0)
+            return false;
+        frame->msg.data[frame->msg.len++] = (hi << 4) | lo;
+        p = skip_space (p + 2);
+    }
+
+    return true;
+}
+
+/*
+ * Vector ASC message lines:
+ *   0.010000 1  123             Rx   d 8 00 11 22 33 44 55 66 77
+ *   0.020000 1  18FEF100x       Rx   r
+ */
+bool CanLogReader::parseAsc (const char *p, CanLogFrame *frame)
+{
+    char *end;
+    unsigned long val;
+    unsigned long len;
+    int base = asc_dec ? 10 : 16;
+
+    frame->rtr = 0;
+    frame->msg.clear ();
+
+    p = parse_time (p, &frame->time);
+    if (!p)
+        return false;
+
+    /* Channel */
+    p = skip_space (p);
+    if (!isdigit ((unsigned char)*p))
+        return false;
+    p = skip_space (skip_word (p));
+
+    frame->msg.id = strtoul (p, &end, base);
+    if (end == p)
+        return false;
+    p = end;
+    frame->msg.extended = 0;
+    if (*p == 'x') {
+        frame->msg.extended = 1;
+        p++;
+    }
+
+    /* Direction */
+    p = skip_space (p);
+    if (strncmp (p, "Rx", 2) != 0 && strncmp (p, "Tx", 2) != 0)
+        return false;
+    p = skip_space (p + 2);
+
+    if (*p == 'r') {
+        frame->rtr = 1;
+        p = skip_space (p + 1);
+        len = strtoul (p, &end, 16);
+        frame->msg.len = (end != p && len <= CAN_BYTES_MAX) ? len : 0;
+        return true;
+    }
+    if (*p != 'd')
+        return false;
+
+    len = strtoul (p + 1, &end, 16);
+    if (end == p + 1 || len > CAN_BYTES_MAX)
+        return false;
+    p = end;
+
+    while (frame->msg.len < len) {
+        p = skip_space (p);
+        val = strtoul (p, &end, base);
+        if (end == p)
+            return false;
+        frame->msg.data[frame->msg.len++] = (uint8_t)val;
+        p = end;
+    }
+
+    return true;
+}
+
+bool CanLogReader::next (CanLogFrame *frame)
+{
+    char line[LINE_MAX_LEN];
+    const char *p;
+    bool ok;
+
+    while (fgets (line, sizeof(line), f)) {
+        p = skip_space (line);
+
+        if (*p == '\0' || *p == '\n' || *p == '\r' || *p == '#' ||
+            strncmp (p, "//", 2) == 0)
+            continue;
+
+        if (strncmp (p, "base ", 5) == 0) {
+            asc_dec = strncmp (skip_space (p + 5), "dec", 3) == 0;
+            continue;
+        }
+
+        if (*p == '(') {
+            ok = parseCandump (p, frame);
+        } else if (isdigit ((unsigned char)*p)) {
+            /* ASC lines start with a time; skip events that are not
+             * messages, such as error frames and statistics */
+            ok = parseAsc (p, frame);
+            if (!ok)
+                continue;
+        } else if (isalpha ((unsigned char)*p)) {
+            /* Untimed candump lines start with the interface name; ASC
+             * header lines start with a keyword */
+            ok = strchr (p, '#') || strchr (p, '[');
+            if (ok)
+                ok = parseCandump (p, frame);
+            else
+                continue;
+        } else {
+            ok = false;
+        }
+
+        if (ok)
+            return true;
+        errors++;
+    }
+
+    return false;
+}
+
+void can_log_write (FILE *f, const CanLogFrame *frame, const char *iface)
+{
+    uint8_t i;
+
+    fprintf (f, "(%llu.%06llu) %s ",
+             (unsigned long long)(frame->time / 1000000),
+             (unsigned long long)(frame->time % 1000000), iface);
+
+    if (frame->msg.extended)
+        fprintf (f, "%08lX#", (unsigned long)frame->msg.id);
+    else
+        fprintf (f, "%03lX#", (unsigned long)frame->msg.id);
+
+    if (frame->rtr) {
+        fputc ('R', f);
+    } else {
+        for (i = 0; i < frame->msg.len && i < CAN_BYTES_MAX; i++)
+            fprintf (f, "%02X", frame->msg.data[i]);
+    }
+
+    fputc ('\n', f);
+}
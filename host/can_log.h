@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_log.h
+ * Streaming reader and writer for text CAN logs: candump (both the "-l"
+ * log file format and the bracketed console format with timestamps) and
+ * Vector ASC.
+ */
+
+#ifndef HOST_CAN_LOG_H
+#define HOST_CAN_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "CAN.h"
+
+/** A message read from or written to a log */
+struct CanLogFrame {
+    /** Time of the message in microseconds */
+    uint64_t time;
+    /** Nonzero for a remote transmission request */
+    uint8_t rtr;
+    /** The message */
+    CanMessage msg;
+};
+
+/**
+ * Reads messages from a log one line at a time, so logs of any size can
+ * be read.  The format is detected from each line; lines that are not
+ * messages (comments, ASC headers and events) are skipped.
+ */
+class CanLogReader {
+    public:
+        /** @param f - The log file, positioned at its start */
+        CanLogReader (FILE *f);
+
+        /**
+         * Read the next message.
+         * @return False at the end of the log.
+         */
+        bool next (CanLogFrame *frame);
+
+        /** Number of lines that looked like messages but could not be read */
+        uint32_t errors;
+
+    private:
+        bool parseCandump (const char *line, CanLogFrame *frame);
+        bool parseAsc (const char *line, CanLogFrame *frame);
+
+        FILE *f;
+        /** Nonzero if ASC identifiers and data are in decimal */
+        uint8_t asc_dec;
+};
+
+/**
+ * Write a message in candump log file format.
+ * @param f     - The output file
+ * @param frame - The message
+ * @param iface - Interface name to write, e.g. "can0"
+ */
+void can_log_write (FILE *f, const CanLogFrame *frame, const char *iface);
+
+#endif
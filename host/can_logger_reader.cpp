@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_logger_reader.cpp
+ * Reader for compressed CanLogger logs.
+ */
+#include <string.h>
+
+#include "can_logger_reader.h"
+
+static uint16_t get16 (const uint8_t *p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t get32 (const uint8_t *p)
+{
+    return get16 (p) | ((uint32_t)get16 (p + 2) << 16);
+}
+
+static uint16_t fletcher16 (const uint8_t *p, uint16_t n)
+{
+    uint16_t a = 0;
+    uint16_t b = 0;
+
+    while (n--) {
+        a = (a + *p++) % 255;
+        b = (b + a) % 255;
+    }
+
+    return (b << 8) | a;
+}
+
+CanLoggerReader::CanLoggerReader (FILE *f)
+{
+    this->f = f;
+    blocks = 0;
+    bad_blocks = 0;
+    skipped = 0;
+
+    pos = 0;
+    end = 0;
+    started = false;
+    synced = false;
+    seq = 0;
+    base = 0;
+    time = 0;
+    first = 0;
+    slot_max = 0;
+    slot_count = 0;
+    next_slot = 0;
+}
+
+/*
+ * Read blocks until one whose records can be decoded
+ */
+bool CanLoggerReader::readBlock ()
+{
+    uint32_t block_seq;
+    uint32_t start;
+    uint16_t n;
+
+    for (;;) {
+        if (fread (block, sizeof(block), 1, f) != 1)
+            return false;
+
+        if (block[0] != 'C' || block[1] != 'L' ||
+            block[2] != CAN_LOGGER_VERSION)
+            return false;
+
+        block_seq = get32 (block + 8);
+        if (started && block_seq < seq)
+            return false;   /* An older log */
+
+        n = get16 (block + 4);
+        if (n > CAN_LOGGER_BLOCK - CAN_LOGGER_HEADER ||
+            fletcher16 (block + CAN_LOGGER_HEADER, n) != get16 (block + 6)) {
+            bad_blocks++;
+            synced = false;
+            seq = block_seq + 1;
+            continue;
+        }
+
+        blocks++;
+        if (block_seq != seq)
+            synced = false;
+        seq = block_seq + 1;
+
+        if (block[3] & CAN_LOGGER_KEY) {
+            slot_max = block[3] >> CAN_LOGGER_IDS_SHIFT;
+            synced = slot_max != 0;
+            slot_count = 0;
+            next_slot = 0;
+        }
+        if (!synced) {
+            skipped++;
+            continue;
+        }
+
+        /* Times are 32 bit and wrap; blocks are assumed less than one
+         * wrap (71 minutes) apart */
+        start = get32 (block + 12);
+        if (!started) {
+            time = start;
+            first = start;
+            started = true;
+        } else {
+            time += (uint32_t)(start - (uint32_t)time);
+        }
+
+        pos = CAN_LOGGER_HEADER;
+        end = CAN_LOGGER_HEADER + n;
+        return true;
+    }
+}
+
+/*
+ * Decode the record at pos.  Returns false if the record runs past the
+ * end of the block.
+ */
+bool CanLoggerReader::decode (CanLogFrame *frame)
+{
+    const uint8_t *p = block + pos;
+    const uint8_t *e = block + end;
+    Slot *sl;
+    uint32_t delta = 0;
+    uint8_t tag;
+    uint8_t slot;
+    uint8_t changed;
+    uint8_t shift;
+    uint8_t i;
+
+    tag = *p++;
+    slot = tag & CAN_LOGGER_NEW_ID;
+
+    if (slot == CAN_LOGGER_NEW_ID) {
+        slot = next_slot;
+        next_slot = (next_slot + 1) % slot_max;
+        if (slot_count < slot_max)
+            slot_count++;
+
+        sl = &slots[slot];
+        if (p + 2 > e)
+            return false;
+        if (*p & 0x80) {
+            if (p + 4 > e)
+                return false;
+            sl->id = ((uint32_t)(p[0] & 0x7F) << 24) |
+                     ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+            sl->extended = 1;
+            p += 4;
+        } else {
+            sl->id = ((uint32_t)p[0] << 8) | p[1];
+            sl->extended = 0;
+            p += 2;
+        }
+    } else if (slot >= slot_count) {
+        return false;
+    }
+    sl = &slots[slot];
+
+    for (shift = 0; ; shift += 7) {
+        if (p >= e || shift > 28)
+            return false;
+        delta |= (uint32_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80))
+            break;
+    }
+
+    switch (tag >> 6) {
+    case CAN_LOGGER_SAME:
+        break;
+    case CAN_LOGGER_XOR:
+        if (p >= e)
+            return false;
+        changed = *p++;
+        for (i = 0; i < sl->len; i++) {
+            if (changed & (1 << i)) {
+                if (p >= e)
+                    return false;
+                sl->data[i] ^= *p++;
+            }
+        }
+        break;
+    case CAN_LOGGER_RAW:
+        if (p >= e)
+            return false;
+        sl->len = *p & 0x0F;
+        sl->rtr = (*p++ >> 4) & 1;
+        if (sl->len > CAN_BYTES_MAX)
+            return false;
+        if (!sl->rtr) {
+            if (p + sl->len > e)
+                return false;
+            memcpy (sl->data, p, sl->len);
+            p += sl->len;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    time += delta;
+
+    frame->time = time - first + base;
+    frame->rtr = sl->rtr;
+    frame->msg.clear ();
+    frame->msg.rtr = sl->rtr;
+    frame->msg.id = sl->id;
+    frame->msg.extended = sl->extended;
+    frame->msg.len = sl->len;
+    if (!sl->rtr)
+        memcpy (frame->msg.data, sl->data, sl->len);
+
+    pos = p - block;
+    return true;
+}
+
+bool CanLoggerReader::next (CanLogFrame *frame)
+{
+    for (;;) {
+        if (pos >= end && !readBlock ())
+            return false;
+
+        if (decode (frame))
+            return true;
+
+        /* A damaged record loses the rest of the block and the table */
+        bad_blocks++;
+        synced = false;
+        pos = end;
+    }
+}
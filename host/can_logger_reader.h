@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_logger_reader.h
+ * Reader for logs written by CanLogger (CANLogger.h), e.g. from an image
+ * of the SD card.
+ */
+
+#ifndef HOST_CAN_LOGGER_READER_H
+#define HOST_CAN_LOGGER_READER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "CANLogger.h"
+#include "can_log.h"
+
+/**
+ * Decodes a CanLogger log block by block.  A block with a bad checksum,
+ * or a gap in the block sequence, loses the messages up to the next block
+ * that clears the identifier table.  The log ends at the first block that
+ * is not a log block, or whose sequence number goes backwards, as when an
+ * older log follows on the card.
+ */
+class CanLoggerReader {
+    public:
+        /** @param f - The log, positioned at its first block */
+        CanLoggerReader (FILE *f);
+
+        /**
+         * Read the next message.  Times count from the first block, plus
+         * the base set with setBase.
+         * @return False at the end of the log.
+         */
+        bool next (CanLogFrame *frame);
+
+        /** Add base microseconds to every time, e.g. the wall clock time
+         *  at which logging started */
+        void setBase (uint64_t base) { this->base = base; }
+
+        uint32_t blocks;        /**< Blocks read */
+        uint32_t bad_blocks;    /**< Blocks with a bad checksum or record */
+        uint32_t skipped;       /**< Blocks skipped waiting for a key block */
+
+    private:
+        struct Slot {
+            uint32_t id;
+            uint8_t extended;
+            uint8_t rtr;
+            uint8_t len;
+            uint8_t data[CAN_BYTES_MAX];
+        };
+
+        bool readBlock ();
+        bool decode (CanLogFrame *frame);
+
+        FILE *f;
+        uint8_t block[CAN_LOGGER_BLOCK];
+        uint16_t pos;           /**< Next record in block */
+        uint16_t end;           /**< End of the records in block */
+
+        bool started;           /**< A block has been read */
+        bool synced;            /**< The identifier table is valid */
+        uint32_t seq;           /**< Sequence number of the next block */
+        uint64_t base;
+        uint64_t time;          /**< Time of the last record */
+        uint64_t first;         /**< Start time of the first block */
+
+        Slot slots[CAN_LOGGER_NEW_ID];
+        uint8_t slot_max;       /**< Table size of the writer */
+        uint8_t slot_count;
+        uint8_t next_slot;
+};
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_replay.cpp
+ * Replay of captured CAN traffic from a log.
+ */
+#include <string.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "can_replay.h"
+#include "../mcp2515_regs.h"
+
+/** Waits longer than this sleep instead of spinning (us) */
+#define SLEEP_THRESHOLD     2000
+
+double CanReplayStats::requestedRate () const
+{
+    return requested ? frames * 1e6 / requested : 0;
+}
+
+double CanReplayStats::achievedRate () const
+{
+    return elapsed ? frames * 1e6 / elapsed : 0;
+}
+
+CanReplay::CanReplay (CanLogReader *reader)
+{
+    this->reader = reader;
+    timing = CAN_REPLAY_ORIGINAL;
+    scale = 1.0;
+    sink = sendSink;
+    sink_ctx = NULL;
+    idle_fn = NULL;
+    idle_ctx = NULL;
+    started = false;
+    first = 0;
+    start = 0;
+    memset (&s, 0, sizeof(s));
+}
+
+void CanReplay::setTiming (uint8_t timing, double scale)
+{
+    this->timing = timing;
+    this->scale = (timing == CAN_REPLAY_SCALED && scale > 0) ? scale : 1.0;
+}
+
+void CanReplay::setSink (replay_sink_fn fn, void *ctx)
+{
+    sink = fn;
+    sink_ctx = ctx;
+}
+
+void CanReplay::setIdle (replay_idle_fn fn, void *ctx)
+{
+    idle_fn = fn;
+    idle_ctx = ctx;
+}
+
+void CanReplay::idle ()
+{
+    if (idle_fn)
+        idle_fn (idle_ctx);
+}
+
+bool CanReplay::step ()
+{
+    CanLogFrame frame;
+    uint64_t due;
+    uint64_t now;
+    uint64_t late;
+
+    if (!reader->next (&frame))
+        return false;
+
+    now = micros ();
+    if (!started) {
+        started = true;
+        first = frame.time;
+        start = now;
+    }
+
+    if (frame.time < first)
+        frame.time = first;     /* Out of order; send at once */
+
+    due = start + (uint64_t)((frame.time - first) / scale);
+    s.requested = due - start;
+
+    if (timing != CAN_REPLAY_MAX_RATE) {
+        while (now < due) {
+            if (due - now > SLEEP_THRESHOLD && !idle_fn)
+                usleep (due - now - SLEEP_THRESHOLD / 2);
+            else
+                idle ();
+            now = micros ();
+        }
+    }
+
+    while (!sink (&frame, sink_ctx))
+        idle ();
+
+    if (timing != CAN_REPLAY_MAX_RATE) {
+        now = micros ();
+        late = now > due ? now - due : 0;
+        if (late > CAN_REPLAY_LATE_US)
+            s.delayed++;
+        if (late > s.max_late)
+            s.max_late = late;
+    }
+
+    s.frames++;
+    s.elapsed = micros () - start;
+
+    return true;
+}
+
+void CanReplay::run ()
+{
+    while (step ())
+        ;
+}
+
+bool CanReplay::sendSink (const CanLogFrame *frame, void *ctx)
+{
+    CanMessage m = frame->msg;
+
+    (void)ctx;
+
+    if (!CAN.ready ())
+        return false;
+
+    m.rtr = frame->rtr;
+    CAN.send (m);
+    return true;
+}
+
+bool CanReplay::receiveSink (const CanLogFrame *frame, void *ctx)
+{
+    Mcp2515Sim *sim = (Mcp2515Sim *)ctx;
+
+    /* Wait for the firmware to empty the receive buffer */
+    if (sim->regs[CANINTF] & (1 << RX0IF))
+        return false;
+
+    sim->receive (frame->msg.id, frame->msg.extended, frame->msg.data,
+                  frame->msg.len, frame->rtr);
+    return true;
+}
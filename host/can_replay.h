@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/can_replay.h
+ * Replay of captured CAN traffic from a log, either through CAN.send or
+ * into the receive buffers of a simulated MCP2515.
+ */
+
+#ifndef HOST_CAN_REPLAY_H
+#define HOST_CAN_REPLAY_H
+
+#include <stdint.h>
+
+#include "can_log.h"
+#include "mcp2515_sim.h"
+
+/** Replay timing */
+enum CAN_REPLAY_TIMING {
+    CAN_REPLAY_ORIGINAL,    /**< At the logged timestamps */
+    CAN_REPLAY_SCALED,      /**< At the timestamps divided by a factor */
+    CAN_REPLAY_MAX_RATE,    /**< As fast as the destination accepts */
+};
+
+/** Lateness beyond which a message counts as delayed, in microseconds */
+#define CAN_REPLAY_LATE_US      100
+
+/**
+ * Delivers one message.
+ * @return False if the destination cannot take the message yet; the
+ *         replay calls the idle function and tries again.
+ */
+typedef bool (*replay_sink_fn) (const CanLogFrame *frame, void *ctx);
+
+/** Called while the replay waits, e.g. to let firmware under test run */
+typedef void (*replay_idle_fn) (void *ctx);
+
+/** Replay statistics */
+struct CanReplayStats {
+    uint32_t frames;            /**< Messages delivered */
+    uint32_t delayed;           /**< Messages more than CAN_REPLAY_LATE_US late */
+    uint32_t max_late;          /**< Largest lateness in microseconds */
+    uint64_t requested;         /**< Log time span after scaling (us) */
+    uint64_t elapsed;           /**< Time the replay took (us) */
+
+    /** Rate asked for by the log and timing, in messages per second */
+    double requestedRate () const;
+    /** Rate achieved, in messages per second */
+    double achievedRate () const;
+};
+
+class CanReplay {
+    public:
+        /** @param reader - Source of the messages */
+        CanReplay (CanLogReader *reader);
+
+        /**
+         * Set the replay timing.
+         * @param timing - One of the CAN_REPLAY_TIMING values
+         * @param scale  - For CAN_REPLAY_SCALED, the speed-up factor; 2.0
+         *                 replays twice as fast as logged.
+         */
+        void setTiming (uint8_t timing, double scale = 1.0);
+
+        /** Set where messages go.  The default is sendSink. */
+        void setSink (replay_sink_fn fn, void *ctx);
+
+        /** Set the function called while waiting */
+        void setIdle (replay_idle_fn fn, void *ctx);
+
+        /**
+         * Replay the next message, waiting until it is due.
+         * @return False at the end of the log.
+         */
+        bool step ();
+
+        /** Replay the whole log */
+        void run ();
+
+        const CanReplayStats &stats () const { return s; }
+
+        /** Sink sending messages through CAN.send; ctx is unused */
+        static bool sendSink (const CanLogFrame *frame, void *ctx);
+
+        /** Sink receiving messages into the Mcp2515Sim given as ctx */
+        static bool receiveSink (const CanLogFrame *frame, void *ctx);
+
+    private:
+        void idle ();
+
+        CanLogReader *reader;
+        uint8_t timing;
+        double scale;
+        replay_sink_fn sink;
+        void *sink_ctx;
+        replay_idle_fn idle_fn;
+        void *idle_ctx;
+
+        bool started;
+        uint64_t first;         /**< Log time of the first message */
+        uint64_t start;         /**< Wall time of the first message */
+        CanReplayStats s;
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/capture.cpp
+ * Converts candump or ASC logs to indexed capture files, and prints the
+ * messages of a capture that match a query in candump log format.
+ *
+ * Usage:
+ *   capture -w out.cap [log]
+ *   capture [-i id[/mask]] [-x] [-b start] [-e end] [-v] in.cap
+ *
+ *   -w file   Write the log (standard input if not given) to a capture
+ *   -i id     Print only messages with this identifier (hexadecimal),
+ *             optionally comparing only the bits of mask
+ *   -x        The identifier is extended
+ *   -b, -e    Print only messages from start to end, in seconds
+ *   -v        Report the number of chunks searched on standard error
+ */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "can_capture.h"
+
+static void usage (void)
+{
+    fprintf (stderr,
+             "usage: capture -w out.cap [log]\n"
+             "       capture [-i id[/mask]] [-x] [-b start] [-e end] [-v] in.cap\n");
+    exit (2);
+}
+
+/*
+ * Parse a time in seconds into microseconds without losing precision
+ */
+static uint64_t parse_seconds (const char *s)
+{
+    char *end;
+    uint64_t us;
+    uint64_t scale = 100000;
+
+    us = strtoull (s, &end, 10) * 1000000;
+    if (*end == '.') {
+        for (end++; isdigit ((unsigned char)*end) && scale; end++) {
+            us += (*end - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    return us;
+}
+
+static int write_capture (const char *out, const char *in)
+{
+    CanCaptureWriter w;
+    CanLogFrame frame;
+    FILE *f = stdin;
+    uint64_t skipped = 0;
+
+    if (in) {
+        f = fopen (in, "r");
+        if (!f) {
+            perror (in);
+            return 1;
+        }
+    }
+
+    if (!w.open (out)) {
+        perror (out);
+        return 1;
+    }
+
+    CanLogReader reader (f);
+    while (reader.next (&frame)) {
+        if (!w.write (&frame))
+            skipped++;
+    }
+
+    if (!w.close ()) {
+        perror (out);
+        return 1;
+    }
+
+    if (skipped || reader.errors)
+        fprintf (stderr, "%llu out of order messages skipped, "
+                 "%lu unreadable lines\n",
+                 (unsigned long long)skipped, (unsigned long)reader.errors);
+
+    if (f != stdin)
+        fclose (f);
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    CanCaptureQuery q;
+    CanCapture cap;
+    CanLogFrame frame;
+    const CanCaptureRecord *r;
+    const char *out = NULL;
+    bool verbose = false;
+    bool have_id = false;
+    uint64_t pos = 0;
+    uint64_t n = 0;
+    char *end;
+    int c;
+
+    while ((c = getopt (argc, argv, "w:i:xb:e:v")) != -1) {
+        switch (c) {
+        case 'w':
+            out = optarg;
+            break;
+        case 'i':
+            q.id = strtoul (optarg, &end, 16);
+            q.mask = (*end == '/') ? strtoul (end + 1, NULL, 16) : 0;
+            have_id = true;
+            break;
+        case 'x':
+            q.extended = 1;
+            break;
+        case 'b':
+            q.start = parse_seconds (optarg);
+            break;
+        case 'e':
+            q.end = parse_seconds (optarg);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage ();
+        }
+    }
+
+    if (out) {
+        if (optind < argc - 1)
+            usage ();
+        return write_capture (out, optind < argc ? argv[optind] : NULL);
+    }
+
+    if (optind != argc - 1)
+        usage ();
+
+    if (have_id && q.mask == 0)
+        q.mask = q.extended ? CAN_CAPTURE_ID_MASK : 0x7FF;
+
+    if (!cap.open (argv[optind])) {
+        fprintf (stderr, "%s: cannot read capture\n", argv[optind]);
+        return 1;
+    }
+
+    while ((r = cap.find (&q, &pos)) != NULL) {
+        can_capture_decode (r, &frame);
+        can_log_write (stdout, &frame, "can0");
+        n++;
+    }
+
+    if (verbose)
+        fprintf (stderr, "%llu messages, %llu of %llu chunks searched\n",
+                 (unsigned long long)n, (unsigned long long)cap.chunks_read,
+                 (unsigned long long)cap.chunkCount ());
+
+    return 0;
+}
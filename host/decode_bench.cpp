@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/decode_bench.cpp
+ * Signal decoding benchmark.  Decodes random capture records of several
+ * identifiers one signal at a time, in batches on one thread, and in
+ * batches on every thread, checks that the results agree, and prints the
+ * throughput of each as CSV.
+ *
+ * Usage: decode_bench [messages per identifier]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "can_capture.h"
+#include "can_decode.h"
+
+#define DEFAULT_MESSAGES    1000000UL
+
+/** Number of identifiers, each with the same layout */
+#define IDS                 4
+
+static const CanSignal layout[] = {
+    {  0, 16, CAN_SIGNAL_LITTLE_ENDIAN, 0, 0.125, 0 },
+    { 16, 12, CAN_SIGNAL_LITTLE_ENDIAN, 1, 0.1, -40 },
+    { 28,  4, CAN_SIGNAL_LITTLE_ENDIAN, 0, 1, 0 },
+    { 32,  1, CAN_SIGNAL_LITTLE_ENDIAN, 0, 1, 0 },
+    { 39, 16, CAN_SIGNAL_BIG_ENDIAN,    0, 0.01, 0 },
+    { 47,  8, CAN_SIGNAL_BIG_ENDIAN,    1, 0.5, 0 },
+    { 55,  8, CAN_SIGNAL_BIG_ENDIAN,    0, 1, 0 },
+    {  7, 64, CAN_SIGNAL_BIG_ENDIAN,    1, 1, 0 },
+};
+
+#define SIGNALS             (sizeof(layout) / sizeof(layout[0]))
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char *method, unsigned threads, double signals,
+                    double seconds)
+{
+    printf ("%s,%u,%.0f,%.4f,%.1f\n", method, threads, signals, seconds,
+            signals / seconds / 1e6);
+}
+
+/*
+ * Compare the columns with the reference decoder and clear them
+ */
+static unsigned long verify (const std::vector<CanCaptureRecord> &records,
+                             std::vector<double> columns[IDS][SIGNALS],
+                             unsigned long n)
+{
+    unsigned long bad = 0;
+    unsigned long i;
+    size_t j;
+    size_t k;
+
+    for (j = 0; j < IDS; j++) {
+        for (k = 0; k < SIGNALS; k++) {
+            for (i = 0; i < n; i++) {
+                if (columns[j][k][i] !=
+                    can_decode_signal (records[j * n + i].data, &layout[k]))
+                    bad++;
+            }
+            std::fill (columns[j][k].begin (), columns[j][k].end (), 0);
+        }
+    }
+
+    return bad;
+}
+
+int main (int argc, char **argv)
+{
+    unsigned long n = DEFAULT_MESSAGES;
+    std::vector<CanCaptureRecord> records;
+    std::vector<double> columns[IDS][SIGNALS];
+    double *column_ptrs[IDS][SIGNALS];
+    CanDecodeJob jobs[IDS];
+    double total;
+    double t;
+    double sum = 0;
+    unsigned long i;
+    unsigned long bad = 0;
+    size_t j;
+    size_t k;
+
+    if (argc > 1)
+        n = strtoul (argv[1], NULL, 0);
+
+    records.resize (IDS * n);
+    srand (1);
+    for (i = 0; i < records.size (); i++) {
+        records[i].time = i;
+        records[i].id = 0x100 + i / n;
+        records[i].len = 8;
+        for (k = 0; k < 8; k++)
+            records[i].data[k] = rand ();
+    }
+
+    for (j = 0; j < IDS; j++) {
+        for (k = 0; k < SIGNALS; k++) {
+            columns[j][k].resize (n);
+            column_ptrs[j][k] = columns[j][k].data ();
+        }
+
+        jobs[j].data = records[j * n].data;
+        jobs[j].stride = sizeof(CanCaptureRecord);
+        jobs[j].count = n;
+        jobs[j].signals = layout;
+        jobs[j].signal_count = SIGNALS;
+        jobs[j].columns = column_ptrs[j];
+    }
+
+    total = (double)IDS * n * SIGNALS;
+    printf ("method,threads,signals,seconds,msignals_per_s\n");
+
+    t = now ();
+    for (i = 0; i < records.size (); i++) {
+        for (k = 0; k < SIGNALS; k++)
+            sum += can_decode_signal (records[i].data, &layout[k]);
+    }
+    report ("bitwise", 1, total, now () - t);
+
+    t = now ();
+    for (j = 0; j < IDS; j++)
+        can_decode (&jobs[j]);
+    report ("batch", 1, total, now () - t);
+    bad += verify (records, columns, n);
+
+    t = now ();
+    can_decode_parallel (jobs, IDS, 0);
+    report ("parallel", std::thread::hardware_concurrency (), total,
+            now () - t);
+    bad += verify (records, columns, n);
+
+    /* Keep the reference loop from being optimized away */
+    if (sum == 0.5)
+        printf ("\n");
+
+    if (bad) {
+        fprintf (stderr, "%lu signals decoded differently\n", bad);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/diag_bench.cpp
+ * Diagnostic client benchmark.  A tester runs the same four requests
+ * against each of a number of simulated ECUs on the simulated MCP2515's
+ * bus: a session change, a read of a 17 character VIN (a multi-frame
+ * response), a 16 byte write (a multi-frame request) and a routine that
+ * answers "response pending" before its result.  ECUs take 2-6 ms to
+ * answer and the routine another 40 ms; the bus carries one frame per
+ * 270 us, as at 500 kbit/s.
+ *
+ * The tester runs three ways: one request at a time, as a loop waiting on
+ * CAN.available does; all requests given to CanDiag at once, with
+ * callbacks; and one coroutine per ECU.  Every response is checked.
+ * Prints the time each way takes as CSV.
+ *
+ * Usage: diag_bench [ecus]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include "Arduino.h"
+#include "CAN.h"
+#include "CANDiag.h"
+#include "can_diag_task.h"
+#include "mcp2515_sim.h"
+
+#define CAN_SS_PIN          10
+
+#define DEFAULT_ECUS        40
+#define MAX_ECUS            0x80
+
+/** ECU n receives requests on REQ_BASE + n and responds on RESP_BASE + n */
+#define REQ_BASE            0x600
+#define RESP_BASE           0x680
+
+/** Bus time of an 8 byte frame at 500 kbit/s */
+#define FRAME_US            270
+
+/** Time the routine runs after its response pending */
+#define ROUTINE_US          40000
+
+#define STEPS               4
+
+struct Frame {
+    uint32_t id;
+    uint8_t data[CAN_BYTES_MAX];
+};
+
+/** A simulated ECU's ISO-TP server */
+struct Ecu {
+    uint8_t req[64];
+    uint16_t req_len;
+    uint16_t req_pos;
+    uint8_t resp[64];
+    uint16_t resp_len;
+    bool wait_fc;           /**< First frame sent, waiting for flow control */
+};
+
+static Mcp2515Sim *sim;
+static CanDiag diag;
+static Ecu ecus[MAX_ECUS];
+static unsigned ecu_count;
+
+/** Frames waiting for the bus, by the time they are ready */
+static std::multimap<uint64_t, Frame> queue;
+static uint64_t bus_free;
+
+static unsigned long errors;
+static unsigned long completed;
+
+static void schedule (uint64_t time, uint32_t id, const uint8_t *data)
+{
+    Frame f;
+
+    f.id = id;
+    memcpy (f.data, data, CAN_BYTES_MAX);
+    queue.insert (std::make_pair (time, f));
+}
+
+static void vin (unsigned ecu, uint8_t *out)
+{
+    char buf[18];
+
+    snprintf (buf, sizeof(buf), "TESTVIN%010u", ecu);
+    memcpy (out, buf, 17);
+}
+
+/* Start sending a response, as a single or first frame */
+static void respond (unsigned n, const uint8_t *resp, uint16_t len,
+                     uint64_t at)
+{
+    Ecu *e = &ecus[n];
+    uint8_t f[CAN_BYTES_MAX];
+
+    memset (f, CAN_DIAG_PAD, sizeof(f));
+    if (len <= 7) {
+        f[0] = len;
+        memcpy (f + 1, resp, len);
+    } else {
+        f[0] = 0x10 | (len >> 8);
+        f[1] = len;
+        memcpy (f + 2, resp, 6);
+        memcpy (e->resp, resp, len);
+        e->resp_len = len;
+        e->wait_fc = true;
+    }
+    schedule (at, RESP_BASE + n, f);
+}
+
+/* Answer a complete request */
+static void handle (unsigned n, uint64_t now)
+{
+    Ecu *e = &ecus[n];
+    uint64_t at = now + 2000 + (n % 5) * 1000;
+    uint8_t r[64];
+    uint8_t i;
+
+    r[0] = e->req[0] + 0x40;
+
+    if (e->req[0] == 0x10 && e->req_len == 2) {
+        static const uint8_t session[] = { 0x50, 0, 0x00, 0x32, 0x01, 0xF4 };
+        memcpy (r, session, sizeof(session));
+        r[1] = e->req[1];
+        respond (n, r, sizeof(session), at);
+    } else if (e->req[0] == 0x22 && e->req_len == 3) {
+        memcpy (r, e->req, 3);
+        r[0] = 0x62;
+        vin (n, r + 3);
+        respond (n, r, 20, at);
+    } else if (e->req[0] == 0x2E && e->req_len == 19) {
+        for (i = 0; i < 16 && e->req[3 + i] == (uint8_t)(i ^ n); i++)
+            ;
+        if (i < 16) {
+            r[0] = 0x7F;
+            r[1] = 0x2E;
+            r[2] = 0x31;
+            respond (n, r, 3, at);
+        } else {
+            memcpy (r, e->req, 3);
+            r[0] = 0x6E;
+            respond (n, r, 3, at);
+        }
+    } else if (e->req[0] == 0x31 && e->req_len == 4) {
+        r[0] = 0x7F;
+        r[1] = 0x31;
+        r[2] = CAN_DIAG_PENDING_NRC;
+        respond (n, r, 3, at);
+        memcpy (r, e->req, 4);
+        r[0] = 0x71;
+        respond (n, r, 4, at + ROUTINE_US);
+    } else {
+        r[0] = 0x7F;
+        r[1] = e->req[0];
+        r[2] = 0x11;
+        respond (n, r, 3, at);
+    }
+}
+
+/* A frame from the tester to ECU n */
+static void ecu_frame (unsigned n, const uint8_t *d, uint64_t now)
+{
+    Ecu *e = &ecus[n];
+    uint8_t f[CAN_BYTES_MAX];
+    uint16_t len;
+    uint16_t pos;
+    uint8_t sn;
+
+    switch (d[0] >> 4) {
+    case 0:
+        e->req_len = d[0] & 0x0F;
+        memcpy (e->req, d + 1, e->req_len);
+        handle (n, now);
+        break;
+    case 1:
+        e->req_len = ((d[0] & 0x0F) << 8) | d[1];
+        if (e->req_len > sizeof(e->req))
+            e->req_len = sizeof(e->req);
+        memcpy (e->req, d + 2, 6);
+        e->req_pos = 6;
+        memset (f, CAN_DIAG_PAD, sizeof(f));
+        f[0] = 0x30;
+        f[1] = 0;
+        f[2] = 0;
+        schedule (now + 500, RESP_BASE + n, f);
+        break;
+    case 2:
+        len = e->req_len - e->req_pos;
+        if (len > 7)
+            len = 7;
+        memcpy (e->req + e->req_pos, d + 1, len);
+        e->req_pos += len;
+        if (e->req_pos >= e->req_len)
+            handle (n, now);
+        break;
+    case 3:
+        if (!e->wait_fc)
+            break;
+        e->wait_fc = false;
+        for (pos = 6, sn = 1; pos < e->resp_len; pos += 7, sn++) {
+            memset (f, CAN_DIAG_PAD, sizeof(f));
+            f[0] = 0x20 | (sn & 0x0F);
+            len = e->resp_len - pos;
+            memcpy (f + 1, e->resp + pos, len > 7 ? 7 : len);
+            schedule (now + 200 * sn, RESP_BASE + n, f);
+        }
+        break;
+    }
+}
+
+static void on_transmit (Mcp2515Sim *s, const uint8_t *raw, void *ctx)
+{
+    uint64_t now = micros ();
+    uint32_t id = ((uint32_t)raw[0] << 3) | (raw[1] >> 5);
+
+    (void)s;
+    (void)ctx;
+
+    if (bus_free < now)
+        bus_free = now;
+    bus_free += FRAME_US;
+
+    if (id >= REQ_BASE && id < REQ_BASE + ecu_count)
+        ecu_frame (id - REQ_BASE, raw + 5, now);
+}
+
+/* Put the next ready frame on the bus if it is free */
+static void bus_pump ()
+{
+    uint64_t now = micros ();
+    std::multimap<uint64_t, Frame>::iterator it = queue.begin ();
+
+    if (it == queue.end () || it->first > now || bus_free > now)
+        return;
+
+    /* A full receiver loses nothing here; the frame waits */
+    if (!sim->receive (it->second.id, 0, it->second.data, CAN_BYTES_MAX))
+        return;
+
+    bus_free = now + FRAME_US;
+    queue.erase (it);
+}
+
+static void run_once ()
+{
+    bus_pump ();
+    while (CAN.available ()) {
+        CanMessage m = CAN.getMessage ();
+        diag.process (m);
+    }
+    diag.poll ();
+}
+
+/* The request of a step to ECU n */
+static std::vector<uint8_t> step_request (unsigned step, unsigned n)
+{
+    std::vector<uint8_t> r;
+    uint8_t i;
+
+    switch (step) {
+    case 0:
+        r = { 0x10, 0x03 };
+        break;
+    case 1:
+        r = { 0x22, 0xF1, 0x90 };
+        break;
+    case 2:
+        r = { 0x2E, 0xF1, 0x98 };
+        for (i = 0; i < 16; i++)
+            r.push_back (i ^ n);
+        break;
+    default:
+        r = { 0x31, 0x01, 0xFF, 0x00 };
+        break;
+    }
+
+    return r;
+}
+
+static void check (unsigned step, unsigned n, uint8_t status,
+                   const uint8_t *data, uint16_t len)
+{
+    uint8_t expect[20];
+    uint16_t expect_len;
+
+    completed++;
+
+    switch (step) {
+    case 0:
+        expect_len = 6;
+        memcpy (expect, "\x50\x03\x00\x32\x01\xF4", 6);
+        break;
+    case 1:
+        expect_len = 20;
+        memcpy (expect, "\x62\xF1\x90", 3);
+        vin (n, expect + 3);
+        break;
+    case 2:
+        expect_len = 3;
+        memcpy (expect, "\x6E\xF1\x98", 3);
+        break;
+    default:
+        expect_len = 4;
+        memcpy (expect, "\x71\x01\xFF\x00", 4);
+        break;
+    }
+
+    if (status != CAN_DIAG_OK || len != expect_len ||
+        memcmp (data, expect, len) != 0) {
+        fprintf (stderr, "ECU %u step %u: status %u, %u bytes\n",
+                 n, step, status, len);
+        errors++;
+    }
+}
+
+struct Pending {
+    unsigned step;
+    unsigned n;
+    bool done;
+};
+
+static void pending_done (uint8_t status, const uint8_t *data, uint16_t len,
+                          void *ctx)
+{
+    Pending *p = (Pending *)ctx;
+
+    check (p->step, p->n, status, data, len);
+    p->done = true;
+}
+
+/* One request at a time */
+static void run_serial ()
+{
+    std::vector<uint8_t> r;
+    Pending p;
+
+    for (p.n = 0; p.n < ecu_count; p.n++) {
+        for (p.step = 0; p.step < STEPS; p.step++) {
+            r = step_request (p.step, p.n);
+            p.done = false;
+            diag.request (REQ_BASE + p.n, RESP_BASE + p.n, r.data (),
+                          r.size (), pending_done, &p);
+            while (!p.done)
+                run_once ();
+        }
+    }
+}
+
+/* Every request at once; CanDiag queues each ECU's in order */
+static void run_callbacks ()
+{
+    std::vector<Pending> all (ecu_count * STEPS);
+    std::vector<uint8_t> r;
+    size_t next = 0;
+    Pending *p;
+
+    for (p = &all[0]; p < &all[0] + all.size (); p++) {
+        p->step = (p - &all[0]) / ecu_count;
+        p->n = (p - &all[0]) % ecu_count;
+        p->done = false;
+    }
+
+    while (completed < all.size ()) {
+        /* Top up the request table as it empties */
+        while (next < all.size ()) {
+            p = &all[next];
+            r = step_request (p->step, p->n);
+            if (diag.request (REQ_BASE + p->n, RESP_BASE + p->n, r.data (),
+                              r.size (), pending_done, p) < 0)
+                break;
+            next++;
+        }
+        run_once ();
+    }
+}
+
+static CanDiagTask ecu_task (unsigned n)
+{
+    unsigned step;
+
+    for (step = 0; step < STEPS; step++) {
+        CanDiagResult r = co_await CanDiagRequest (
+            diag, REQ_BASE + n, RESP_BASE + n, step_request (step, n));
+        check (step, n, r.status, r.data.data (), r.data.size ());
+    }
+}
+
+/* One coroutine per ECU */
+static void run_coroutines ()
+{
+    std::vector<CanDiagTask> tasks;
+    unsigned n;
+
+    for (n = 0; n < ecu_count; n++)
+        tasks.push_back (ecu_task (n));
+
+    while (completed < ecu_count * STEPS)
+        run_once ();
+}
+
+static void report (const char *mode, void (*run) ())
+{
+    unsigned long start;
+    unsigned long elapsed;
+
+    diag.begin ();
+    queue.clear ();
+    memset (ecus, 0, sizeof(ecus));
+    errors = 0;
+    completed = 0;
+
+    start = micros ();
+    run ();
+    elapsed = micros () - start;
+
+    const CanDiagStats &s = diag.stats ();
+    printf ("%s,%u,%lu,%.1f,%lu,%lu,%lu,%lu,%lu\n", mode, ecu_count,
+            (unsigned long)s.requests, elapsed / 1000.0, errors,
+            (unsigned long)s.timeouts, (unsigned long)s.pending,
+            (unsigned long)s.frames_sent, (unsigned long)s.frames_received);
+}
+
+int main (int argc, char **argv)
+{
+    ecu_count = argc > 1 ? atoi (argv[1]) : DEFAULT_ECUS;
+    if (ecu_count == 0 || ecu_count > MAX_ECUS) {
+        fprintf (stderr, "usage: %s [ecus]  (1-%u)\n", argv[0], MAX_ECUS);
+        return 1;
+    }
+
+    sim = Mcp2515Sim::at (CAN_SS_PIN);
+    sim->onTransmit (on_transmit, NULL);
+    CAN.begin (CAN_SPEED_500000);
+    CAN.changeMode (CAN_MODE_NORMAL);
+
+    printf ("mode,ecus,requests,ms,errors,timeouts,pending,"
+            "frames_sent,frames_received\n");
+    report ("serial", run_serial);
+    report ("callbacks", run_callbacks);
+    report ("coroutines", run_coroutines);
+
+    return 0;
+}
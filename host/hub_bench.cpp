@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/hub_bench.cpp
+ * Receive hub benchmark.  A producer thread publishes numbered messages
+ * at the rate of a busy bus, while three subscribers read them: one reads
+ * everything, one filters on an identifier range, and one is deliberately
+ * slow.  Each subscriber checks that the messages it gets are intact and
+ * in order.  Prints the producer rate and, per subscriber, the messages
+ * received, filtered and lost and the worst lag, as CSV.
+ *
+ * Exits with status 1 if any message was corrupt or out of order, or if,
+ * at a set rate, a subscriber that keeps up lost any.
+ *
+ * Usage: hub_bench [-p name] [-r rate] [messages]
+ *   -p name - Put the ring in shared memory under name
+ *   -r rate - Publish rate messages per second, or 0 to publish as fast as
+ *             possible, which overruns every subscriber
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+#include "can_hub.h"
+
+#define DEFAULT_MESSAGES    80000UL
+
+/** A 1 Mbit/s bus full of 8 byte standard frames (about 125 bits each) */
+#define DEFAULT_RATE        8000UL
+
+/** Identifiers cycle through 0x100-0x17F */
+#define ID_BASE             0x100
+#define ID_COUNT            0x80
+
+static std::atomic<bool> done;
+
+struct Consumer {
+    const char *name;
+    uint32_t filter;
+    uint32_t mask;
+    unsigned spin;          /**< Busy work per message */
+    bool keeps_up;          /**< Must lose nothing at a bus rate */
+    CanHubStats stats;
+    uint64_t errors;        /**< Messages corrupt or out of order */
+};
+
+static double now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void produce (CanHub *hub, unsigned long n, unsigned long rate)
+{
+    CanLogFrame frame;
+    double start = now ();
+    double ahead;
+    unsigned long i;
+    uint8_t j;
+
+    frame.rtr = 0;
+    frame.msg.len = 8;
+
+    for (i = 0; i < n; i++) {
+        frame.time = i;
+        frame.msg.id = ID_BASE + i % ID_COUNT;
+        for (j = 0; j < 8; j++)
+            frame.msg.data[j] = i >> (8 * j);
+        hub->publish (&frame);
+
+        if (rate) {
+            ahead = start + (double)(i + 1) / rate - now ();
+            if (ahead > 0)
+                usleep (ahead * 1e6);
+        }
+    }
+
+    done.store (true);
+}
+
+static void consume (const CanHub *hub, const char *shm, Consumer *c)
+{
+    CanHubSubscriber sub;
+    CanLogFrame frame;
+    uint64_t last = 0;
+    uint64_t seq;
+    volatile unsigned k;
+    bool first = true;
+    uint8_t j;
+
+    if (shm ? !sub.attachShared (shm) : !sub.attach (hub)) {
+        fprintf (stderr, "%s: cannot attach\n", c->name);
+        return;
+    }
+    if (c->mask)
+        sub.setFilter (c->filter, c->mask);
+
+    for (;;) {
+        if (!sub.next (&frame)) {
+            if (done.load () && sub.lag () == 0)
+                break;
+            std::this_thread::yield ();
+            continue;
+        }
+
+        seq = 0;
+        for (j = 0; j < 8; j++)
+            seq |= (uint64_t)frame.msg.data[j] << (8 * j);
+
+        if (seq != frame.time ||
+            frame.msg.id != ID_BASE + seq % ID_COUNT ||
+            (!first && seq <= last))
+            c->errors++;
+        last = seq;
+        first = false;
+
+        for (k = 0; k < c->spin; k++)
+            ;
+    }
+
+    c->stats = sub.stats ();
+}
+
+int main (int argc, char **argv)
+{
+    unsigned long n = DEFAULT_MESSAGES;
+    unsigned long rate = DEFAULT_RATE;
+    const char *shm = NULL;
+    Consumer consumers[] = {
+        { "all", 0, 0, 0, true, {}, 0 },
+        { "filtered", 0x100, 0x7F0, 0, true, {}, 0 },
+        { "slow", 0, 0, 2000, false, {}, 0 },
+    };
+    const unsigned count = sizeof(consumers) / sizeof(consumers[0]);
+    std::thread threads[count];
+    CanHub hub;
+    double start;
+    double seconds;
+    unsigned i;
+    int status = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "p:r:")) != -1) {
+        switch (opt) {
+        case 'p':
+            shm = optarg;
+            break;
+        case 'r':
+            rate = strtoul (optarg, NULL, 0);
+            break;
+        default:
+            fprintf (stderr, "usage: %s [-p name] [-r rate] [messages]\n",
+                     argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        n = strtoul (argv[optind], NULL, 0);
+
+    if (shm ? !hub.createShared (shm) : !hub.create ()) {
+        perror ("hub");
+        return 1;
+    }
+
+    for (i = 0; i < count; i++)
+        threads[i] = std::thread (consume, &hub, shm, &consumers[i]);
+
+    /* Let the subscribers attach before anything is published */
+    usleep (100000);
+
+    start = now ();
+    produce (&hub, n, rate);
+    seconds = now () - start;
+
+    for (i = 0; i < count; i++)
+        threads[i].join ();
+
+    printf ("subscriber,received,filtered,overruns,max_lag,errors\n");
+    printf ("producer,%lu,0,0,0,0\n", n);
+    for (i = 0; i < count; i++) {
+        printf ("%s,%llu,%llu,%llu,%llu,%llu\n", consumers[i].name,
+                (unsigned long long)consumers[i].stats.received,
+                (unsigned long long)consumers[i].stats.filtered,
+                (unsigned long long)consumers[i].stats.overruns,
+                (unsigned long long)consumers[i].stats.max_lag,
+                (unsigned long long)consumers[i].errors);
+    }
+    fprintf (stderr, "published %.0f messages/s\n", n / seconds);
+
+    for (i = 0; i < count; i++) {
+        if (consumers[i].errors) {
+            fprintf (stderr, "%s: messages corrupt or out of order\n",
+                     consumers[i].name);
+            status = 1;
+        }
+        if (rate && consumers[i].keeps_up && consumers[i].stats.overruns) {
+            fprintf (stderr, "%s: lost messages at %lu messages/s\n",
+                     consumers[i].name, rate);
+            status = 1;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/logger.cpp
+ * Compressed log tool.  Decodes a log written by CanLogger, e.g. an image
+ * of the SD card, to candump log format.  It can also compress a candump
+ * or ASC log with CanLogger, the same code that runs on the board, and
+ * report the compression.
+ *
+ * Usage: logger [-b seconds] image          (decode to stdout)
+ *        logger -c log image                (compress log into image)
+ *   -b seconds - Add to every time, e.g. the wall clock time at which
+ *                logging started
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "CANLogger.h"
+#include "can_log.h"
+#include "can_logger_reader.h"
+
+static boolean write_block (uint32_t sector, const uint8_t *block, void *ctx)
+{
+    FILE *f = (FILE *)ctx;
+
+    if (fseek (f, (long)sector * CAN_LOGGER_BLOCK, SEEK_SET) != 0)
+        return false;
+
+    return fwrite (block, CAN_LOGGER_BLOCK, 1, f) == 1;
+}
+
+/* Length of the line CanMessage::print writes for a message */
+static unsigned long print_size (const CanMessage &m)
+{
+    char buf[16];
+    unsigned long n;
+    uint8_t i;
+
+    n = snprintf (buf, sizeof(buf), "%lX [%u]:", (unsigned long)m.id, m.len);
+    if (m.rtr)
+        return n + 9;   /* " remote" and CR LF */
+
+    for (i = 0; i < m.len; i++)
+        n += snprintf (buf, sizeof(buf), " %X", m.data[i]);
+
+    return n + 2;
+}
+
+static int compress (const char *in_name, const char *out_name)
+{
+    CanLogFrame frame;
+    CanLogger logger;
+    FILE *in;
+    FILE *out;
+    FILE *text;
+    unsigned long print_bytes = 0;
+    long text_bytes;
+    long out_bytes;
+
+    in = fopen (in_name, "r");
+    if (!in) {
+        perror (in_name);
+        return 1;
+    }
+    out = fopen (out_name, "wb");
+    if (!out) {
+        perror (out_name);
+        return 1;
+    }
+    text = tmpfile ();
+
+    CanLogReader reader (in);
+    logger.begin (write_block, out);
+
+    while (reader.next (&frame)) {
+        frame.msg.rtr = frame.rtr;
+        logger.log (frame.msg, (uint32_t)frame.time);
+        logger.poll ();
+
+        can_log_write (text, &frame, "can0");
+        print_bytes += print_size (frame.msg);
+    }
+    if (!logger.flush ()) {
+        fprintf (stderr, "%s: write failed\n", out_name);
+        return 1;
+    }
+
+    text_bytes = ftell (text);
+    out_bytes = (long)logger.sector () * CAN_LOGGER_BLOCK;
+
+    const CanLoggerStats &s = logger.stats ();
+    printf ("messages,blocks,record_bytes,bytes_per_message,"
+            "candump_bytes,candump_ratio,print_bytes,print_ratio\n");
+    printf ("%lu,%lu,%lu,%.2f,%ld,%.2f,%lu,%.2f\n",
+            (unsigned long)s.messages, (unsigned long)s.blocks,
+            (unsigned long)s.bytes,
+            s.messages ? (double)out_bytes / s.messages : 0,
+            text_bytes, out_bytes ? (double)text_bytes / out_bytes : 0,
+            print_bytes, out_bytes ? (double)print_bytes / out_bytes : 0);
+
+    fclose (text);
+    fclose (out);
+    fclose (in);
+
+    return 0;
+}
+
+static int decode (const char *name, uint64_t base)
+{
+    CanLogFrame frame;
+    FILE *f;
+
+    f = fopen (name, "rb");
+    if (!f) {
+        perror (name);
+        return 1;
+    }
+
+    CanLoggerReader reader (f);
+    reader.setBase (base);
+
+    while (reader.next (&frame))
+        can_log_write (stdout, &frame, "can0");
+
+    if (reader.bad_blocks || reader.skipped) {
+        fprintf (stderr, "%lu blocks, %lu damaged, %lu skipped\n",
+                 (unsigned long)reader.blocks,
+                 (unsigned long)reader.bad_blocks,
+                 (unsigned long)reader.skipped);
+    }
+
+    fclose (f);
+    return 0;
+}
+
+int main (int argc, char **argv)
+{
+    const char *log = NULL;
+    double base = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "b:c:")) != -1) {
+        switch (opt) {
+        case 'b':
+            base = strtod (optarg, NULL);
+            break;
+        case 'c':
+            log = optarg;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+
+    if (optind != argc - 1) {
+        fprintf (stderr, "usage: %s [-b seconds] image\n"
+                 "       %s -c log image\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if (log)
+        return compress (log, argv[optind]);
+
+    return decode (argv[optind], (uint64_t)(base * 1000000));
+}
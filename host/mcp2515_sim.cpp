@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/mcp2515_sim.cpp
+ * A simulated MCP2515 for host builds of the CAN library.
+ */
+#include <string.h>
+
+#include "mcp2515_sim.h"
+#include "../mcp2515_regs.h"
+
+/* SPI instructions */
+enum {
+    CMD_RESET       = 0xC0,
+    CMD_READ        = 0x03,
+    CMD_WRITE       = 0x02,
+    CMD_BIT_MODIFY  = 0x05,
+    CMD_READ_STATUS = 0xA0,
+    CMD_RX_STATUS   = 0xB0,
+};
+
+/* Operation modes (REQOP/OPMOD values) */
+enum {
+    MODE_NORMAL     = 0,
+    MODE_SLEEP      = 1,
+    MODE_LOOPBACK   = 2,
+    MODE_LISTEN     = 3,
+    MODE_CONFIG     = 4,
+};
+
+static Mcp2515Sim *sims[SIM_PINS];
+
+Mcp2515Sim *Mcp2515Sim::selected;
+uint32_t Mcp2515Sim::total_transactions;
+uint32_t Mcp2515Sim::total_bytes;
+
+Mcp2515Sim::Mcp2515Sim ()
+{
+    auto_tx = true;
+    bus_bit_time = 0;
+    transactions = 0;
+    bytes = 0;
+    frames_sent = 0;
+    frames_received = 0;
+    tx_fn = NULL;
+    tx_ctx = NULL;
+    cmd = 0;
+    count = 0;
+    reset ();
+}
+
+Mcp2515Sim *Mcp2515Sim::at (uint8_t pin)
+{
+    if (pin >= SIM_PINS)
+        return NULL;
+
+    if (!sims[pin])
+        sims[pin] = new Mcp2515Sim ();
+
+    return sims[pin];
+}
+
+void Mcp2515Sim::reset ()
+{
+    memset (regs, 0, sizeof(regs));
+    regs[CANSTAT] = MODE_CONFIG << OPMOD;
+    regs[CANCTRL] = (MODE_CONFIG << REQOP) | (1 << CLKEN) | (3 << CLKPRE);
+}
+
+void Mcp2515Sim::onTransmit (sim_tx_fn fn, void *ctx)
+{
+    tx_fn = fn;
+    tx_ctx = ctx;
+}
+
+/*
+ * CANSTAT and CANCTRL appear at the end of every row of registers
+ */
+uint8_t Mcp2515Sim::map (uint8_t addr)
+{
+    addr &= 0x7F;
+
+    if ((addr & 0x0F) == CANSTAT)
+        return CANSTAT;
+    if ((addr & 0x0F) == CANCTRL)
+        return CANCTRL;
+
+    return addr;
+}
+
+uint8_t Mcp2515Sim::readReg (uint8_t addr)
+{
+    return regs[map (addr)];
+}
+
+void Mcp2515Sim::writeReg (uint8_t addr, uint8_t val)
+{
+    uint8_t i;
+    uint8_t old;
+
+    addr = map (addr);
+
+    if (addr == CANSTAT)
+        return;
+
+    old = regs[addr];
+    regs[addr] = val;
+
+    /* Clearing a pending TXREQ aborts the message */
+    for (i = 0; i < 3; i++) {
+        if (addr == REG(TX, i, CTRL) && (old & (1 << TXREQ)) &&
+            !(val & (1 << TXREQ)))
+            regs[addr] |= (1 << ABTF);
+    }
+
+    if (addr == CANCTRL) {
+        regs[CANSTAT] = (regs[CANSTAT] & ~OPMOD_MASK) |
+                        (((val & REQOP_MASK) >> REQOP) << OPMOD);
+
+        if (val & (1 << ABAT)) {
+            for (i = 0; i < 3; i++) {
+                if (regs[REG(TX, i, CTRL)] & (1 << TXREQ)) {
+                    regs[REG(TX, i, CTRL)] &= ~(1 << TXREQ);
+                    regs[REG(TX, i, CTRL)] |= (1 << ABTF);
+                }
+            }
+        }
+
+        /* Pending requests go out once the mode allows it */
+        for (i = 0; i < 3; i++) {
+            if (regs[REG(TX, i, CTRL)] & (1 << TXREQ))
+                transmit (i);
+        }
+        return;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (addr == REG(TX, i, CTRL) && (val & (1 << TXREQ)))
+            transmit (i);
+    }
+}
+
+void Mcp2515Sim::modifyReg (uint8_t addr, uint8_t mask, uint8_t val)
+{
+    uint8_t old = regs[map (addr)];
+
+    writeReg (addr, (old & ~mask) | (val & mask));
+}
+
+void Mcp2515Sim::transmit (uint8_t tx_buf)
+{
+    uint8_t raw[13];
+    uint8_t mode = (regs[CANSTAT] & OPMOD_MASK) >> OPMOD;
+
+    if (!auto_tx)
+        return;
+    if (mode != MODE_NORMAL && mode != MODE_LOOPBACK)
+        return;
+
+    memcpy (raw, &regs[REG(TX, tx_buf, SIDH)], sizeof(raw));
+
+    regs[REG(TX, tx_buf, CTRL)] &= ~((1 << TXREQ) | (1 << ABTF));
+    regs[CANINTF] |= (1 << (TX0IF + tx_buf));
+    frames_sent++;
+
+    if (mode == MODE_LOOPBACK)
+        receiveRaw (raw);
+    else if (tx_fn)
+        tx_fn (this, raw, tx_ctx);
+}
+
+/*
+ * Find the first filter in [first, last] that accepts the message
+ */
+int8_t Mcp2515Sim::match (const uint8_t *raw, uint8_t first, uint8_t last,
+                          uint8_t mask_num)
+{
+    const uint8_t *m = &regs[mask_num ? RXM1SIDH : RXM0SIDH];
+    const uint8_t *f;
+    uint8_t ext = raw[1] & (1 << EXIDE);
+    uint8_t sidl_mask = ext ? 0xE3 : 0xE0;
+    uint8_t i;
+    uint8_t addr;
+
+    for (i = first; i <= last; i++) {
+        addr = i * 4;
+        if (addr >= 12)
+            addr += 4;
+        f = &regs[addr];
+
+        if ((f[1] & (1 << EXIDE)) != ext)
+            continue;
+        if ((raw[0] ^ f[0]) & m[0])
+            continue;
+        if ((raw[1] ^ f[1]) & m[1] & sidl_mask)
+            continue;
+        if (ext && (((raw[2] ^ f[2]) & m[2]) || ((raw[3] ^ f[3]) & m[3])))
+            continue;
+
+        return i;
+    }
+
+    return -1;
+}
+
+/*
+ * Place a message in a receive buffer, converting the remote request bit
+ * to its receive buffer position
+ */
+void Mcp2515Sim::load (uint8_t rx_buf, const uint8_t *raw, uint8_t filter)
+{
+    uint8_t *r = &regs[REG(RX, rx_buf, SIDH)];
+    uint8_t rtr = raw[4] & (1 << RTR);
+    uint8_t ctrl = regs[REG(RX, rx_buf, CTRL)];
+
+    memcpy (r, raw, 13);
+
+    if (!(raw[1] & (1 << EXIDE))) {
+        r[1] &= 0xE0;
+        r[2] = 0;
+        r[3] = 0;
+        r[4] &= ~(1 << RTR);
+        if (rtr)
+            r[1] |= (1 << SRR);
+    }
+
+    if (rx_buf == 0)
+        ctrl = (ctrl & ~0x0F) | (ctrl & (1 << BUKT)) | (filter & 1);
+    else
+        ctrl = (ctrl & ~0x0F) | (filter & 7);
+    if (rtr)
+        ctrl |= (1 << RXRTR);
+    regs[REG(RX, rx_buf, CTRL)] = ctrl;
+
+    regs[CANINTF] |= (1 << (RX0IF + rx_buf));
+    frames_received++;
+}
+
+uint32_t Mcp2515Sim::bitTime ()
+{
+    uint8_t brp = regs[CNF1] & 0x3F;
+    uint8_t prop = (regs[CNF2] >> PRSEG) & 7;
+    uint8_t ps1 = (regs[CNF2] >> PHSEG1) & 7;
+    uint8_t ps2 = (regs[CNF3] >> PHSEG2) & 7;
+
+    /* Sync segment plus the three others; a quantum is 2 * (BRP + 1)
+     * cycles of the 16 MHz oscillator */
+    return (uint32_t)(4 + prop + ps1 + ps2) * (brp + 1) * 125;
+}
+
+bool Mcp2515Sim::receiveRaw (const uint8_t *raw)
+{
+    uint8_t mode = (regs[CANSTAT] & OPMOD_MASK) >> OPMOD;
+    uint8_t rxm0 = (regs[REG(RX, 0, CTRL)] >> RXM) & 3;
+    uint8_t rxm1 = (regs[REG(RX, 1, CTRL)] >> RXM) & 3;
+    int8_t f;
+
+    if (mode == MODE_CONFIG || mode == MODE_SLEEP)
+        return false;
+
+    if (bus_bit_time) {
+        uint32_t diff = bitTime () > bus_bit_time ? bitTime () - bus_bit_time
+                                                  : bus_bit_time - bitTime ();
+        if (diff * 100 > bus_bit_time) {
+            regs[CANINTF] |= (1 << MERRF);
+            return false;
+        }
+    }
+
+    f = rxm0 == 3 ? 0 : match (raw, 0, 1, 0);
+    if (f >= 0) {
+        if (!(regs[CANINTF] & (1 << RX0IF))) {
+            load (0, raw, f);
+            return true;
+        }
+        if ((regs[REG(RX, 0, CTRL)] & (1 << BUKT)) &&
+            !(regs[CANINTF] & (1 << RX1IF))) {
+            load (1, raw, f);
+            return true;
+        }
+        regs[EFLG] |= (1 << RX0OVR);
+        regs[CANINTF] |= (1 << ERRIF);
+        return false;
+    }
+
+    f = rxm1 == 3 ? 2 : match (raw, 2, 5, 1);
+    if (f < 0)
+        return false;
+
+    if (regs[CANINTF] & (1 << RX1IF)) {
+        regs[EFLG] |= (1 << RX1OVR);
+        regs[CANINTF] |= (1 << ERRIF);
+        return false;
+    }
+
+    load (1, raw, f);
+    return true;
+}
+
+bool Mcp2515Sim::receive (uint32_t id, uint8_t extended,
+                          const uint8_t *data, uint8_t len, uint8_t rtr)
+{
+    uint8_t raw[13];
+
+    memset (raw, 0, sizeof(raw));
+
+    mcp2515_encode_id (id, extended, raw);
+
+    if (len > 8)
+        len = 8;
+    raw[4] = len | (rtr ? (1 << RTR) : 0);
+    if (data && !rtr)
+        memcpy (&raw[5], data, len);
+
+    return receiveRaw (raw);
+}
+
+void Mcp2515Sim::select ()
+{
+    selected = this;
+    transactions++;
+    total_transactions++;
+    count = 0;
+}
+
+void Mcp2515Sim::deselect ()
+{
+    /* READ RX BUFFER clears the receive flag when it completes */
+    if (count > 0 && (cmd & 0xF9) == 0x90)
+        regs[CANINTF] &= ~(1 << (RX0IF + ((cmd >> 2) & 1)));
+
+    if (selected == this)
+        selected = NULL;
+}
+
+uint8_t Mcp2515Sim::transfer (uint8_t byte)
+{
+    uint8_t out = 0;
+    uint8_t status;
+    uint8_t intf = regs[CANINTF];
+    uint8_t i;
+
+    bytes++;
+    total_bytes++;
+
+    if (count == 0) {
+        cmd = byte;
+        count++;
+
+        if (cmd == CMD_RESET) {
+            reset ();
+        } else if ((cmd & 0xF8) == 0x80) {
+            /* RTS */
+            for (i = 0; i < 3; i++) {
+                if (cmd & (1 << i))
+                    modifyReg (REG(TX, i, CTRL), 1 << TXREQ, 1 << TXREQ);
+            }
+        } else if ((cmd & 0xF9) == 0x90) {
+            /* READ RX BUFFER */
+            addr = REG(RX, (cmd >> 2) & 1, (cmd & 2) ? D0 : SIDH);
+        } else if ((cmd & 0xF8) == 0x40) {
+            /* LOAD TX BUFFER */
+            addr = REG(TX, (cmd >> 1) & 3, (cmd & 1) ? D0 : SIDH);
+        }
+        return 0;
+    }
+
+    switch (cmd) {
+    case CMD_READ:
+        if (count == 1)
+            addr = byte;
+        else
+            out = readReg (addr++);
+        break;
+
+    case CMD_WRITE:
+        if (count == 1)
+            addr = byte;
+        else
+            writeReg (addr++, byte);
+        break;
+
+    case CMD_BIT_MODIFY:
+        if (count == 1)
+            addr = byte;
+        else if (count == 2)
+            mask = byte;
+        else if (count == 3)
+            modifyReg (addr, mask, byte);
+        break;
+
+    case CMD_READ_STATUS:
+        out = (intf & ((1 << RX0IF) | (1 << RX1IF)));
+        for (i = 0; i < 3; i++) {
+            if (regs[REG(TX, i, CTRL)] & (1 << TXREQ))
+                out |= 0x04 << (i << 1);
+            if (intf & (1 << (TX0IF + i)))
+                out |= 0x08 << (i << 1);
+        }
+        break;
+
+    case CMD_RX_STATUS:
+        status = (intf & ((1 << RX0IF) | (1 << RX1IF))) << 6;
+        if (status) {
+            i = (intf & (1 << RX0IF)) ? 0 : 1;
+            if (regs[REG(RX, i, SIDL)] & (1 << IDE))
+                status |= 0x10;
+            if (regs[REG(RX, i, CTRL)] & (1 << RXRTR))
+                status |= 0x08;
+            if (i == 0)
+                status |= regs[REG(RX, 0, CTRL)] & 1;
+            else if ((regs[REG(RX, 1, CTRL)] & 7) < 2)
+                status |= 6 + (regs[REG(RX, 1, CTRL)] & 1);
+            else
+                status |= regs[REG(RX, 1, CTRL)] & 7;
+        }
+        out = status;
+        break;
+
+    default:
+        if ((cmd & 0xF9) == 0x90)
+            out = readReg (addr++);
+        else if ((cmd & 0xF8) == 0x40)
+            writeReg (addr++, byte);
+        break;
+    }
+
+    if (count < 255)
+        count++;
+
+    return out;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/mcp2515_sim.h
+ * A simulated MCP2515 for host builds of the CAN library.  It implements
+ * the SPI instruction set, the register file, acceptance filtering and
+ * loopback, and counts every SPI transaction and byte so that the cost of
+ * driver operations can be measured.
+ */
+
+#ifndef HOST_MCP2515_SIM_H
+#define HOST_MCP2515_SIM_H
+
+#include <stdint.h>
+
+/** Number of slave select pins that can have a simulated device */
+#define SIM_PINS                64
+
+class Mcp2515Sim;
+
+/**
+ * Called when a simulated device transmits a message outside loopback
+ * mode.
+ * @param sim - The device
+ * @param raw - The message in register layout (SIDH..D7)
+ * @param ctx - The context given to Mcp2515Sim::onTransmit
+ */
+typedef void (*sim_tx_fn) (Mcp2515Sim *sim, const uint8_t *raw, void *ctx);
+
+class Mcp2515Sim {
+    public:
+        Mcp2515Sim ();
+
+        /**
+         * Get the device connected to a slave select pin, creating it if
+         * necessary.
+         */
+        static Mcp2515Sim *at (uint8_t pin);
+
+        /** The device whose slave select line is asserted, or NULL */
+        static Mcp2515Sim *selected;
+
+        /** Return every register to its reset value */
+        void reset ();
+
+        /** Slave select asserted */
+        void select ();
+        /** Slave select deasserted; completes the instruction */
+        void deselect ();
+        /** Exchange one byte on SPI */
+        uint8_t transfer (uint8_t byte);
+
+        /**
+         * Receive a message from the bus.  The message passes through the
+         * acceptance filters into a free receive buffer.
+         * @return False if the message was filtered out or both receive
+         *         buffers were full (an overflow is flagged in EFLG).
+         */
+        bool receive (uint32_t id, uint8_t extended, const uint8_t *data,
+                      uint8_t len, uint8_t rtr = 0);
+
+        /** Receive a message given in register layout */
+        bool receiveRaw (const uint8_t *raw);
+
+        /** Call fn for every message transmitted outside loopback mode */
+        void onTransmit (sim_tx_fn fn, void *ctx);
+
+        /**
+         * Complete transmission requests immediately (the default).  If
+         * false, TXREQ stays set, as it does when no other node
+         * acknowledges, until the request is aborted.
+         */
+        bool auto_tx;
+
+        /**
+         * Bit time of the simulated bus in nanoseconds, or 0 to accept
+         * messages at any bit timing.  If the bit timing set in CNF1-3
+         * is more than 1% off, received messages are lost and MERRF is
+         * set, as on a real bus.
+         */
+        uint32_t bus_bit_time;
+
+        /** Bit time set in CNF1-3, in nanoseconds */
+        uint32_t bitTime ();
+
+        /** Register file */
+        uint8_t regs[128];
+
+        /* Instrumentation */
+        uint32_t transactions;      /**< Slave select assertions */
+        uint32_t bytes;             /**< Bytes transferred */
+        uint32_t frames_sent;       /**< Messages transmitted */
+        uint32_t frames_received;   /**< Messages accepted */
+
+        /** Total transactions of all devices */
+        static uint32_t total_transactions;
+        /** Total bytes of all devices */
+        static uint32_t total_bytes;
+
+    private:
+        uint8_t map (uint8_t addr);
+        uint8_t readReg (uint8_t addr);
+        void writeReg (uint8_t addr, uint8_t val);
+        void modifyReg (uint8_t addr, uint8_t mask, uint8_t val);
+        void transmit (uint8_t tx_buf);
+        int8_t match (const uint8_t *raw, uint8_t first, uint8_t last,
+                      uint8_t mask);
+        void load (uint8_t rx_buf, const uint8_t *raw, uint8_t filter);
+
+        uint8_t cmd;
+        uint8_t count;
+        uint8_t addr;
+        uint8_t mask;
+        sim_tx_fn tx_fn;
+        void *tx_ctx;
+};
+
+#endif
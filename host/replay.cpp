@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+/**
+ * @file host/replay.cpp
+ * Replays a candump or ASC log through the CAN library on the simulated
+ * MCP2515 and reports the achieved rate against the requested rate.
+ *
+ * Usage: replay [-m | -s scale] [-r] log
+ *   -m        Replay as fast as possible
+ *   -s scale  Replay scale times faster than logged
+ *   -r        Feed messages into the receive path and read them with
+ *             CAN.getMessage, instead of sending them with CAN.send
+ */
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "CAN.h"
+#include "can_replay.h"
+
+/** Slave select pin of the controller used by CAN */
+#define CAN_SS_PIN          10
+
+static uint32_t received;
+
+/* Stands in for the firmware: read everything that has arrived */
+static void drain (void *ctx)
+{
+    (void)ctx;
+
+    while (CAN.available ()) {
+        CAN.getMessage ();
+        received++;
+    }
+}
+
+static void usage (void)
+{
+    fprintf (stderr, "usage: replay [-m | -s scale] [-r] log\n");
+    exit (2);
+}
+
+int main (int argc, char **argv)
+{
+    Mcp2515Sim *sim = Mcp2515Sim::at (CAN_SS_PIN);
+    uint8_t timing = CAN_REPLAY_ORIGINAL;
+    double scale = 1.0;
+    bool rx = false;
+    FILE *f;
+    int c;
+
+    while ((c = getopt (argc, argv, "ms:r")) != -1) {
+        switch (c) {
+        case 'm':
+            timing = CAN_REPLAY_MAX_RATE;
+            break;
+        case 's':
+            timing = CAN_REPLAY_SCALED;
+            scale = atof (optarg);
+            break;
+        case 'r':
+            rx = true;
+            break;
+        default:
+            usage ();
+        }
+    }
+    if (optind != argc - 1)
+        usage ();
+
+    f = fopen (argv[optind], "r");
+    if (!f) {
+        perror (argv[optind]);
+        return 1;
+    }
+
+    CAN.begin (CAN_SPEED_500000);
+    CAN.changeMode (CAN_MODE_NORMAL);
+
+    CanLogReader reader (f);
+    CanReplay replay (&reader);
+
+    replay.setTiming (timing, scale);
+    if (rx) {
+        replay.setSink (CanReplay::receiveSink, sim);
+        replay.setIdle (drain, NULL);
+    }
+
+    replay.run ();
+    drain (NULL);
+
+    const CanReplayStats &s = replay.stats ();
+
+    printf ("frames,delayed,max_late_us,requested_fps,achieved_fps,"
+            "elapsed_us,delivered,parse_errors\n");
+    printf ("%lu,%lu,%lu,%.1f,%.1f,%llu,%lu,%lu\n",
+            (unsigned long)s.frames, (unsigned long)s.delayed,
+            (unsigned long)s.max_late, s.requestedRate (), s.achievedRate (),
+            (unsigned long long)s.elapsed,
+            (unsigned long)(rx ? received : sim->frames_sent),
+            (unsigned long)reader.errors);
+
+    fclose (f);
+    return 0;
+}
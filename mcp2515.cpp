@@ -1,8 +1,7 @@
 /**
  * @file mcp2515.cpp
- * MCP2515 driver.  This file is straight C code, and can be renamed to .c
- * to use it in a C project.  It is named .cpp so that it will be built by
- * the Arduino build system.
+ * MCP2515 driver.  Its SPI transactions come from the driver core
+ * template in mcp2515_driver.h, so it must be built as C++.
  */
 #include "mcp2515.h"
 #include "mcp2515_regs.h"
@@ -26,57 +25,225 @@
 #define SYNC_JUMP_WIDTH 1
 
 
-/* SPI Commands */
-enum {
-    MCP2515_CMD_RESET       = 0xC0,
-    MCP2515_CMD_READ        = 0x03,
-    MCP2515_CMD_WRITE       = 0x02,
-    MCP2515_CMD_RTS         = 0x80,
-    MCP2515_CMD_READ_STATUS = 0xA0,
-    MCP2515_CMD_BIT_MODIFY  = 0x05,
-};
+/*
+ * SPI transactions, from the driver core template
+ */
+#include "mcp2515_driver.h"
+
+/** Driver core addressing the device chosen with mcp2515_select */
+#if defined(SPDR) && !ARDUINO
+typedef Mcp2515Driver<Mcp2515SpiAvr, Mcp2515SsSelected> chip;
+#else
+typedef Mcp2515Driver<Mcp2515SpiDefault, Mcp2515SsSelected> chip;
+#endif
+
+static inline void spi_read_regs (uint8_t addr, uint8_t* buf, uint8_t n)
+{
+    chip::readRegs (addr, buf, n);
+}
+
+static inline void spi_write_regs (uint8_t addr, const uint8_t* buf, uint8_t n)
+{
+    chip::writeRegs (addr, buf, n);
+}
+
+static inline void spi_bit_modify (uint8_t addr, uint8_t mask, uint8_t bits)
+{
+    chip::bitModify (addr, mask, bits);
+}
+
+static inline void spi_reset (void)
+{
+    chip::reset ();
+}
+
+static inline uint8_t spi_status (uint8_t cmd)
+{
+    return cmd == MCP2515_CMD_RX_STATUS ? chip::rxStatus () :
+                                          chip::readStatus ();
+}
+
+static inline uint8_t spi_read_rx (uint8_t rx_buf, uint8_t *raw)
+{
+    return chip::readRx (rx_buf, raw);
+}
+
+static inline void spi_load_tx (uint8_t tx_buf, const uint8_t *raw)
+{
+    chip::loadTx (tx_buf, raw);
+}
+
+static inline void spi_rts (uint8_t tx_buf)
+{
+    chip::requestToSend (tx_buf);
+}
+
+/** Registers below this address are mirrored in the shadow cache */
+#define SHADOW_SIZE     0x2C
+
+/** Per-device state */
+static struct {
+    /** Slave select line of the device */
+    uint8_t ss;
+    /** Host copy of the write-mostly configuration registers */
+    uint8_t regs[SHADOW_SIZE];
+    /** One bit per shadow register, set when the copy matches the chip */
+    uint8_t valid[(SHADOW_SIZE + 7) / 8];
+    /** Transmit buffers mcp2515_free_tx_buf must not return */
+    uint8_t tx_reserved;
+    /** Number of loads into each transmit buffer */
+    uint8_t tx_loads[3];
+} devices[MCP2515_MAX_DEVICES] = { { SPI_DEFAULT_SS, { 0 }, { 0 }, 0, { 0 } } };
+
+/** Number of the device currently being addressed */
+static uint8_t current;
+
+/** Shadow registers of the current device */
+static uint8_t *shadow = devices[0].regs;
+
+/** Shadow valid bits of the current device */
+static uint8_t *shadow_valid = devices[0].valid;
+
+/**
+ * Check whether a register may be served from the shadow cache.  Status
+ * registers and counters that the MCP2515 changes on its own are never
+ * cached.
+ */
+static uint8_t shadow_cacheable (uint8_t addr)
+{
+    if (addr >= SHADOW_SIZE)
+        return 0;
+    if (addr == CANSTAT || addr == TXRTSCTRL)
+        return 0;
+    /* TEC, REC and the CANSTAT/CANCTRL mirrors */
+    if (addr >= TEC && addr < RXM0SIDH)
+        return 0;
+    return 1;
+}
+
+static uint8_t shadow_is_valid (uint8_t addr)
+{
+    return shadow_valid[addr >> 3] & (1 << (addr & 7));
+}
+
+/**
+ * Copy n registers out of the shadow cache.
+ * @return Nonzero if every register was cached, zero if the chip must be
+ *         read instead.
+ */
+static uint8_t shadow_lookup (uint8_t addr, uint8_t *buf, uint8_t n)
+{
+    uint8_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!shadow_cacheable (addr + i) || !shadow_is_valid (addr + i))
+            return 0;
+    }
+
+    for (i = 0; i < n; i++)
+        buf[i] = shadow[addr + i];
+
+    return 1;
+}
+
+/**
+ * Check whether writing n registers would leave the chip unchanged.
+ */
+static uint8_t shadow_matches (uint8_t addr, const uint8_t *buf, uint8_t n)
+{
+    uint8_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!shadow_cacheable (addr + i) || !shadow_is_valid (addr + i))
+            return 0;
+        if (shadow[addr + i] != buf[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+/** Record register values known to be in the chip */
+static void shadow_store (uint8_t addr, const uint8_t *buf, uint8_t n)
+{
+    uint8_t i;
+
+    for (i = 0; i < n; i++, addr++) {
+        if (shadow_cacheable (addr)) {
+            shadow[addr] = buf[i];
+            shadow_valid[addr >> 3] |= (1 << (addr & 7));
+        }
+    }
+}
+
+void mcp2515_shadow_invalidate (void)
+{
+    uint8_t i;
+
+    for (i = 0; i < sizeof(devices[0].valid); i++)
+        shadow_valid[i] = 0;
+}
+
+void mcp2515_attach (uint8_t dev, uint8_t ss)
+{
+    devices[dev].ss = ss;
+    init_ss (ss);
+}
+
+void mcp2515_select (uint8_t dev)
+{
+    current = dev;
+    shadow = devices[dev].regs;
+    shadow_valid = devices[dev].valid;
+    select_ss (devices[dev].ss);
+}
+
+uint8_t mcp2515_selected (void)
+{
+    return current;
+}
 
 void mcp2515_read_regs (uint8_t addr, uint8_t* buf, uint8_t n)
 {
-    int i;
+    if (shadow_lookup (addr, buf, n))
+        return;
 
-    assert_ss();
-    spi_send(MCP2515_CMD_READ);
-    spi_send(addr);
-    for (i=0; i<n; i++)
-        buf[i] = spi_receive();
-    deassert_ss();
+    spi_read_regs (addr, buf, n);
+    shadow_store (addr, buf, n);
 }
 
 void mcp2515_write_regs (uint8_t addr, const uint8_t* buf, uint8_t n)
 {
-    int i;
+    /* Anything but TXBnCTRL changes the message in the buffer */
+    if (addr >= TX && addr < RX && (addr & 0x0F) != CTRL)
+        devices[current].tx_loads[(addr - TX) >> 4]++;
 
-    assert_ss();
-    spi_send(MCP2515_CMD_WRITE);
-    spi_send(addr);
-    for (i=0; i<n; i++)
-        spi_send(buf[i]);
-    deassert_ss();
+    if (shadow_matches (addr, buf, n))
+        return;
+
+    spi_write_regs (addr, buf, n);
+    shadow_store (addr, buf, n);
 }
 
 static void mcp2515_write_reg (uint8_t addr, uint8_t buf)
 {
-    assert_ss();
-    spi_send(MCP2515_CMD_WRITE);
-    spi_send(addr);
-    spi_send(buf);
-    deassert_ss();
+    mcp2515_write_regs (addr, &buf, 1);
 }
 
 static void mcp2515_bit_modify (uint8_t addr, uint8_t mask, uint8_t bits)
 {
-    assert_ss();
-    spi_send(MCP2515_CMD_BIT_MODIFY);
-    spi_send(addr);
-    spi_send(mask);
-    spi_send(bits);
-    deassert_ss();
+    uint8_t val;
+
+    if (shadow_cacheable (addr) && shadow_is_valid (addr)) {
+        val = (shadow[addr] & ~mask) | (bits & mask);
+        if (val == shadow[addr])
+            return;
+
+        spi_bit_modify (addr, mask, bits);
+        shadow[addr] = val;
+    } else {
+        spi_bit_modify (addr, mask, bits);
+    }
 }
 
 /**
@@ -111,6 +278,10 @@ static uint8_t calc_brp (uint32_t bit_period, uint8_t *bit_width)
 
     total_steps = bit_period / TIME_QUANTUM_STEP;
 
+    /* If no prescalar in range is any better, use the slowest */
+    best_brp = brp_max;
+    best_width = total_steps / (brp_max + 1);
+
     for (i = brp_min; i <= brp_max; i++) {
         error = total_steps % (i + 1);
 
@@ -142,7 +313,13 @@ static uint8_t calc_brp (uint32_t bit_period, uint8_t *bit_width)
 }
 
 
-void mcp2515_init (uint32_t bit_period)
+/**
+ * Calculate the bit timing registers for a bit period.
+ * @param bit_period - Length of bit period in nanoseconds
+ * @param cnf        - Buffer to store CNF3, CNF2 and CNF1 in, in register
+ *                     address order.
+ */
+static void calc_cnf (uint32_t bit_period, uint8_t *cnf)
 {
     uint8_t brp;
     uint8_t bit_width;
@@ -166,26 +343,130 @@ void mcp2515_init (uint32_t bit_period)
 
     prop_seg = bit_width - phase_1_seg - 1;
 
-    /* Set registers */
-    mcp2515_write_reg (CNF1,
-            (brp << BRP) |
-            ((SYNC_JUMP_WIDTH - 1) << SJW) );
+    cnf[2] = (brp << BRP) |                             /* CNF1 */
+             ((SYNC_JUMP_WIDTH - 1) << SJW);
+
+    cnf[1] = ((prop_seg - 1) << PRSEG) |                /* CNF2 */
+             ((phase_1_seg - 1) << PHSEG1) |
+             (0 << SAM) |  /* Sample once */
+             (1 << BTLMODE);  /* Phase 2 set by CNF3 */
+
+    cnf[0] = ((phase_2_seg - 1) << PHSEG2) |            /* CNF3 */
+             (0 << WAKFIL);
+}
+
+void mcp2515_init (uint32_t bit_period)
+{
+    uint8_t cnf[3];
 
-    mcp2515_write_reg (CNF2,
-            ((prop_seg - 1) << PRSEG) |
-            ((phase_1_seg - 1) << PHSEG1) |
-            (0 << SAM) |  /* Sample once */
-            (1 << BTLMODE) );  /* Phase 2 set by CNF3 */
+    calc_cnf (bit_period, cnf);
 
-    mcp2515_write_reg (CNF3,
-            ((phase_2_seg - 1) << PHSEG2) |
-            (0 << WAKFIL) );
+    /* CNF3, CNF2 and CNF1 are contiguous; set them in one transaction */
+    mcp2515_write_regs (CNF3, cnf, sizeof(cnf));
 
     mcp2515_write_reg (REG(RX, 0, CTRL),
             (0x0 << RXM) |
             (0 << BUKT) );
 }
 
+uint8_t mcp2515_reset (uint16_t max_polls)
+{
+    uint8_t byte;
+
+    spi_reset ();
+
+    /* Every register is back at its reset value */
+    mcp2515_shadow_invalidate ();
+
+    /* The MCP2515 answers in configuration mode as soon as its oscillator
+     * start-up timer has expired */
+    do {
+        spi_read_regs (CANSTAT, &byte, 1);
+        if ((byte & OPMOD_MASK) == (MCP2515_MODE_CONFIG << OPMOD))
+            return 1;
+    } while (max_polls-- > 0);
+
+    return 0;
+}
+
+void mcp2515_config_init (struct mcp2515_config *cfg, uint32_t bit_period)
+{
+    uint8_t i;
+    uint8_t *p = (uint8_t *)cfg;
+
+    for (i = 0; i < sizeof(*cfg); i++)
+        p[i] = 0;
+
+    calc_cnf (bit_period, cfg->cnf);
+}
+
+void mcp2515_config_mask (struct mcp2515_config *cfg, uint8_t mask_num,
+                                        uint32_t mask, uint8_t extended)
+{
+    mcp2515_encode_id (mask, extended, cfg->rxm[mask_num]);
+
+    /* Masks have no EXIDE bit */
+    cfg->rxm[mask_num][1] &= ~(1 << EXIDE);
+}
+
+void mcp2515_config_filter (struct mcp2515_config *cfg, uint8_t filter_num,
+                                        uint32_t filter, uint8_t extended)
+{
+    mcp2515_encode_id (filter, extended, cfg->rxf[filter_num]);
+}
+
+/*
+ * Write one block of the configuration image and read it back
+ */
+static uint8_t write_verify (uint8_t addr, const uint8_t *buf, uint8_t n)
+{
+    uint8_t check[MCP2515_CONFIG_BLOCK];
+    uint8_t i;
+
+    spi_write_regs (addr, buf, n);
+    spi_read_regs (addr, check, n);
+
+    for (i = 0; i < n; i++) {
+        if (check[i] != buf[i])
+            return 0;
+    }
+
+    shadow_store (addr, buf, n);
+    return 1;
+}
+
+uint8_t mcp2515_configure (const struct mcp2515_config *cfg,
+                                        uint16_t max_polls)
+{
+    if (!mcp2515_reset (max_polls))
+        return MCP2515_ERR_RESET;
+
+    /* RXF0-RXF2 and RXF3-RXF5 are two blocks of twelve registers; the
+     * masks, CNF3-CNF1 and CANINTE are a third */
+    if (!write_verify (0x00, cfg->rxf[0], MCP2515_CONFIG_BLOCK) ||
+        !write_verify (0x10, cfg->rxf[3], MCP2515_CONFIG_BLOCK) ||
+        !write_verify (RXM0SIDH, cfg->rxm[0], MCP2515_CONFIG_BLOCK))
+        return MCP2515_ERR_VERIFY;
+
+    spi_write_regs (REG(RX, 0, CTRL), &cfg->rxbctrl[0], 1);
+    spi_write_regs (REG(RX, 1, CTRL), &cfg->rxbctrl[1], 1);
+
+    return MCP2515_OK;
+}
+
+void mcp2515_read_config (struct mcp2515_config *cfg)
+{
+    mcp2515_read_regs (0x00, cfg->rxf[0], MCP2515_CONFIG_BLOCK);
+    mcp2515_read_regs (0x10, cfg->rxf[3], MCP2515_CONFIG_BLOCK);
+    mcp2515_read_regs (RXM0SIDH, cfg->rxm[0], MCP2515_CONFIG_BLOCK);
+
+    /* Keep only the writable bits of the receive buffer controls */
+    mcp2515_read_regs (REG(RX, 0, CTRL), &cfg->rxbctrl[0], 1);
+    mcp2515_read_regs (REG(RX, 1, CTRL), &cfg->rxbctrl[1], 1);
+    cfg->rxbctrl[0] &= (0x3 << RXM) | (1 << BUKT);
+    cfg->rxbctrl[1] &= (0x3 << RXM);
+}
+
 
 /*
  * Set the operating mode of the MCP2515
@@ -195,6 +476,47 @@ void mcp2515_set_mode (uint8_t mode)
     mcp2515_bit_modify (CANCTRL, REQOP_MASK, mode << REQOP);
 }
 
+/*
+ * Read the mode the MCP2515 is actually in
+ */
+uint8_t mcp2515_get_mode (void)
+{
+    uint8_t byte;
+
+    mcp2515_read_regs (CANSTAT, &byte, 1);
+
+    return (byte & OPMOD_MASK) >> OPMOD;
+}
+
+/*
+ * Request a mode change without trusting the cached REQOP bits
+ */
+void mcp2515_request_mode (uint8_t mode)
+{
+    spi_bit_modify (CANCTRL, REQOP_MASK, mode << REQOP);
+
+    if (shadow_is_valid (CANCTRL))
+        shadow[CANCTRL] = (shadow[CANCTRL] & ~REQOP_MASK) | (mode << REQOP);
+}
+
+/*
+ * Request a mode change and confirm it through CANSTAT.OPMOD
+ */
+uint8_t mcp2515_change_mode (uint8_t mode, uint16_t max_polls)
+{
+    if (mcp2515_get_mode () == mode)
+        return 1;
+
+    mcp2515_request_mode (mode);
+
+    do {
+        if (mcp2515_get_mode () == mode)
+            return 1;
+    } while (max_polls-- > 0);
+
+    return 0;
+}
+
 /*
  * Reads a message from the receive buffer and marks it as read.
  */
@@ -208,19 +530,10 @@ uint8_t mcp2515_get_msg (uint8_t rx_buf, uint32_t *id,
     *len = buf[4] & 0x0f;
     if (*len > 8)
         *len = 8;
-    mcp2515_read_regs (REG(RX, rx_buf, D0), data, *len);
+    if (!mcp2515_raw_is_remote (buf))
+        mcp2515_read_regs (REG(RX, rx_buf, D0), data, *len);
 
-    extended = buf[1] & (1 << IDE);
-    if (extended) {
-        *id = ((uint32_t)(buf[0]) << 21) |
-              ((uint32_t)(buf[1] & 0xE0) << 13) |
-              ((uint32_t)(buf[1] & 0x03) << 16) |
-              ((uint32_t)(buf[2]) << 8) |
-              ((uint32_t)(buf[3]) << 0);
-    } else {
-        *id = ((uint32_t)buf[0] << 3) |
-              ((uint32_t)buf[1] >> 5);
-    }
+    extended = mcp2515_raw_get_id (buf, id);
 
     mcp2515_bit_modify (CANINTF, 1 << (RX0IF + rx_buf), 0);
 
@@ -235,17 +548,7 @@ void mcp2515_set_msg (uint8_t tx_buf, uint32_t id, const uint8_t *data,
 {
     uint8_t buf[5];
 
-    if (extended) {
-        buf[0] = (uint8_t)(id >> 21);
-        buf[1] = (uint8_t)(((id >> 13) & 0xE0) |
-                (1 << EXIDE) |
-                ((id >> 16) & 0x03));
-        buf[2] = (uint8_t)(id >> 8);
-        buf[3] = (uint8_t)(id);
-    } else {
-        buf[0] = (uint8_t)(id >> 3);
-        buf[1] = (uint8_t)(id << 5);
-    }
+    mcp2515_encode_id (id, extended, buf);
 
     if (len > 8)
         len = 8;
@@ -256,6 +559,141 @@ void mcp2515_set_msg (uint8_t tx_buf, uint32_t id, const uint8_t *data,
     mcp2515_write_regs (REG(TX, tx_buf, D0), data, len);
 }
 
+/*
+ * Loads a remote transmission request; it has no data bytes
+ */
+void mcp2515_set_remote (uint8_t tx_buf, uint32_t id, uint8_t len,
+                    uint8_t extended)
+{
+    uint8_t buf[5];
+
+    mcp2515_encode_id (id, extended, buf);
+
+    if (len > 8)
+        len = 8;
+
+    buf[4] = (1 << RTR) | (len << DLC0);
+
+    mcp2515_write_regs (REG(TX, tx_buf, SIDH), buf, 5);
+}
+
+/*
+ * Reads a message in its register layout, using the READ RX BUFFER
+ * instruction so that the receive flag is cleared without another command.
+ */
+uint8_t mcp2515_read_raw (uint8_t rx_buf, uint8_t *raw)
+{
+    return spi_read_rx (rx_buf, raw);
+}
+
+/*
+ * Loads a message in its register layout using the LOAD TX BUFFER
+ * instruction, and requests transmission using RTS.
+ */
+void mcp2515_send_raw (uint8_t tx_buf, const uint8_t *raw)
+{
+    devices[current].tx_loads[tx_buf]++;
+    spi_load_tx (tx_buf, raw);
+    spi_rts (tx_buf);
+}
+
+uint8_t mcp2515_raw_get_id (const uint8_t *raw, uint32_t *id)
+{
+    uint8_t extended;
+
+    extended = raw[1] & (1 << IDE);
+    if (extended) {
+        *id = ((uint32_t)(raw[0]) << 21) |
+              ((uint32_t)(raw[1] & 0xE0) << 13) |
+              ((uint32_t)(raw[1] & 0x03) << 16) |
+              ((uint32_t)(raw[2]) << 8) |
+              ((uint32_t)(raw[3]) << 0);
+    } else {
+        *id = ((uint32_t)raw[0] << 3) |
+              ((uint32_t)raw[1] >> 5);
+    }
+
+    return extended;
+}
+
+/*
+ * A received standard frame flags a remote request with SRR, an extended
+ * frame with the RTR bit of its DLC
+ */
+uint8_t mcp2515_raw_is_remote (const uint8_t *raw)
+{
+    if (raw[1] & (1 << IDE))
+        return raw[4] & (1 << RTR);
+
+    return raw[1] & (1 << SRR);
+}
+
+void mcp2515_raw_set_id (uint8_t *raw, uint32_t id, uint8_t extended)
+{
+    mcp2515_encode_id (id, extended, raw);
+}
+
+/*
+ * Returns the READ STATUS byte
+ */
+uint8_t mcp2515_read_status (void)
+{
+    return spi_status (MCP2515_CMD_READ_STATUS);
+}
+
+/*
+ * Returns the RX STATUS byte
+ */
+uint8_t mcp2515_rx_status (void)
+{
+    return spi_status (MCP2515_CMD_RX_STATUS);
+}
+
+/*
+ * Finds a transmit buffer with no pending request
+ */
+int8_t mcp2515_free_tx_buf (void)
+{
+    uint8_t status;
+    uint8_t i;
+
+    status = mcp2515_read_status ();
+
+    for (i = 0; i < 3; i++) {
+        if (devices[current].tx_reserved & (1 << i))
+            continue;
+        if (!(status & (MCP2515_STATUS_TX0REQ << (i << 1))))
+            return i;
+    }
+
+    return -1;
+}
+
+void mcp2515_reserve_tx (uint8_t mask)
+{
+    devices[current].tx_reserved = mask;
+}
+
+uint8_t mcp2515_tx_loads (uint8_t tx_buf)
+{
+    return devices[current].tx_loads[tx_buf];
+}
+
+uint8_t mcp2515_abort_tx (uint8_t tx_buf, uint16_t max_polls)
+{
+    uint8_t pending = MCP2515_STATUS_TX0REQ << (tx_buf << 1);
+    uint8_t done;
+
+    mcp2515_bit_modify (REG(TX, tx_buf, CTRL), 1 << TXREQ, 0);
+
+    /* A message already on the bus is finished first */
+    do {
+        done = !(mcp2515_read_status () & pending);
+    } while (!done && max_polls-- > 0);
+
+    return done;
+}
+
 /*
  * Requests transmission of the loaded message
  */
@@ -288,6 +726,11 @@ uint8_t mcp2515_msg_sent (void)
     return (!(byte & (1 << TXREQ)));
 }
 
+void mcp2515_clear_int (uint8_t flags)
+{
+    mcp2515_bit_modify (CANINTF, flags, 0);
+}
+
 void mcp2515_set_rx_mask (uint8_t mask_num, uint32_t mask, uint8_t extended)
 {
     uint8_t reg;
@@ -298,18 +741,8 @@ void mcp2515_set_rx_mask (uint8_t mask_num, uint32_t mask, uint8_t extended)
     else
         reg = RXM1SIDH;
 
-    if (extended) {
-        buf[0] = (uint8_t)(mask >> 21);
-        buf[1] = (uint8_t)(((mask >> 13) & 0xE0)
-                         | ((mask >> 16) & 0x03));
-        buf[2] = (uint8_t)(mask >> 8);
-        buf[3] = (uint8_t)(mask >> 0);
-    } else {
-        buf[0] = (uint8_t)(mask >> 3);
-        buf[1] = (uint8_t)(mask << 5);
-        buf[2] = 0;
-        buf[3] = 0;
-    }
+    mcp2515_encode_id (mask, extended, buf);
+    buf[1] &= ~(1 << EXIDE);
 
     mcp2515_write_regs (reg, buf, 4);
 }
@@ -324,19 +757,7 @@ void mcp2515_set_rx_filter (uint8_t filter_num, uint32_t filter, uint8_t extende
     if (reg >= 12)
         reg += 4;
 
-    if (extended) {
-        buf[0] = (uint8_t)(filter >> 21);
-        buf[1] = (uint8_t)(((filter >> 13) & 0xE0)
-                         | ((filter >> 16) & 0x03)
-                         | (1 << EXIDE));
-        buf[2] = (uint8_t)(filter >> 8);
-        buf[3] = (uint8_t)(filter >> 0);
-    } else {
-        buf[0] = (uint8_t)(filter >> 3);
-        buf[1] = (uint8_t)(filter << 5);
-        buf[2] = 0;
-        buf[3] = 0;
-    }
+    mcp2515_encode_id (filter, extended, buf);
 
     mcp2515_write_regs (reg, buf, 4);
 }
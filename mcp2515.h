@@ -15,10 +15,18 @@
 #define MCP2515_MODE_LISTEN_ONLY    0x03
 #define MCP2515_MODE_CONFIG         0x04
 
+/**
+ * Default number of CANSTAT reads mcp2515_change_mode will make while
+ * waiting for a mode change.  A request to leave normal mode is not
+ * honored until the frame currently on the bus is complete.
+ */
+#define MCP2515_MODE_POLLS          1000
+
 /**
  * CAN bus speeds.  These are the bit-times for common frequencies.
  */
 enum {
+    MCP2515_SPEED_1000000 = 1000,
     MCP2515_SPEED_500000 = 2000,
     MCP2515_SPEED_250000 = 4000,
     MCP2515_SPEED_125000 = 8000,
@@ -31,6 +39,60 @@ enum {
     MCP2515_SPEED_15625  = 64000
 };
 
+/** Number of MCP2515 devices the driver can address */
+#ifndef MCP2515_MAX_DEVICES
+#define MCP2515_MAX_DEVICES         2
+#endif
+
+/**
+ * Size of a message in register layout: SIDH, SIDL, EID8, EID0, DLC and
+ * up to eight data bytes.
+ */
+#define MCP2515_RAW_SIZE            13
+
+/* READ STATUS bits */
+#define MCP2515_STATUS_RX0IF        0x01
+#define MCP2515_STATUS_RX1IF        0x02
+#define MCP2515_STATUS_TX0REQ       0x04
+#define MCP2515_STATUS_TX1REQ       0x10
+#define MCP2515_STATUS_TX2REQ       0x40
+
+/* RX STATUS bits */
+#define MCP2515_RXSTATUS_RX0        0x40
+#define MCP2515_RXSTATUS_RX1        0x80
+#define MCP2515_RXSTATUS_FILTER     0x07    /**< Filter hit; 6 and 7 are
+                                              *  RXF0 and RXF1 rolled over
+                                              *  into RXB1 */
+
+/* Status codes */
+#define MCP2515_OK                  0
+#define MCP2515_ERR_RESET           1   /**< Chip did not come out of reset */
+#define MCP2515_ERR_VERIFY          2   /**< Configuration read back wrong */
+
+/**
+ * Default number of CANSTAT reads mcp2515_reset will make while waiting
+ * for the oscillator to start.  The start-up timer is 128 oscillator
+ * cycles, so this is only reached if the chip is not responding.
+ */
+#define MCP2515_RESET_POLLS         100
+
+/** Size of each block of registers written by mcp2515_configure */
+#define MCP2515_CONFIG_BLOCK        12
+
+/**
+ * Complete configuration image of the MCP2515.  The fields are laid out in
+ * register address order so that mcp2515_configure can write the whole
+ * image in a few burst writes.  Fill it in with mcp2515_config_init,
+ * mcp2515_config_mask and mcp2515_config_filter.
+ */
+struct mcp2515_config {
+    uint8_t rxf[6][4];      /**< RXFnSIDH..RXFnEID0 for each filter */
+    uint8_t rxm[2][4];      /**< RXMnSIDH..RXMnEID0 for each mask */
+    uint8_t cnf[3];         /**< CNF3, CNF2, CNF1 (follows rxm directly) */
+    uint8_t caninte;        /**< CANINTE (follows cnf directly) */
+    uint8_t rxbctrl[2];     /**< RXB0CTRL, RXB1CTRL */
+};
+
 /**
  * Initialize the MCP2515.
  * @param bit_period - The length of the desired bit period.  The closest
@@ -39,6 +101,60 @@ enum {
  */
 void mcp2515_init (uint32_t bit_period);
 
+/**
+ * Reset the MCP2515 and wait for its oscillator to become ready.  All
+ * registers return to their default values and the chip is left in
+ * configuration mode.
+ * @param max_polls - Maximum number of additional CANSTAT reads to make
+ *                    while waiting for the chip.
+ * @return Nonzero if the chip came out of reset, zero otherwise.
+ */
+uint8_t mcp2515_reset (uint16_t max_polls);
+
+/**
+ * Start a new configuration image.  The bit timing is calculated for
+ * bit_period and every other register is cleared: masks accept all
+ * identifiers and interrupts are disabled.
+ * @param cfg        - The image to initialize.
+ * @param bit_period - The length of the desired bit period.
+ */
+void mcp2515_config_init (struct mcp2515_config *cfg, uint32_t bit_period);
+
+/**
+ * Set a receive mask in a configuration image.
+ * @see mcp2515_set_rx_mask.
+ */
+void mcp2515_config_mask (struct mcp2515_config *cfg, uint8_t mask_num,
+                                        uint32_t mask, uint8_t extended);
+
+/**
+ * Set a receive filter in a configuration image.
+ * @see mcp2515_set_rx_filter.
+ */
+void mcp2515_config_filter (struct mcp2515_config *cfg, uint8_t filter_num,
+                                        uint32_t filter, uint8_t extended);
+
+/**
+ * Reset the MCP2515 and load a complete configuration image.  The image
+ * is written in five transactions and the filters, masks and bit timing
+ * are read back to verify them.  The chip is left in configuration mode.
+ * @param cfg       - The configuration to load.
+ * @param max_polls - Passed to mcp2515_reset.
+ * @return MCP2515_OK on success, or MCP2515_ERR_RESET or
+ *         MCP2515_ERR_VERIFY.
+ */
+uint8_t mcp2515_configure (const struct mcp2515_config *cfg,
+                                        uint16_t max_polls);
+
+/**
+ * Read the configuration of the MCP2515 into an image, e.g. to load it
+ * again with mcp2515_configure after a reset.  The chip reads masks and
+ * filters as zero outside configuration mode, so unless they are in the
+ * register shadow, call this in configuration mode.
+ * @param cfg - The image to fill in.
+ */
+void mcp2515_read_config (struct mcp2515_config *cfg);
+
 /**
  * Read registers from the MCP2515.
  * @param addr - Address to begin reading from.
@@ -62,6 +178,41 @@ void mcp2515_write_regs (uint8_t addr, const uint8_t* buf, uint8_t n);
  */
 void mcp2515_set_mode (uint8_t mode);
 
+/**
+ * Read the operation mode the MCP2515 is currently in.  This may differ
+ * from the last mode set while a transition is still pending.
+ * @return One of the MCP2515_MODE values.
+ */
+uint8_t mcp2515_get_mode (void);
+
+/**
+ * Request a change of operation mode and return immediately.  Unlike
+ * mcp2515_set_mode, the request is always sent to the chip.  Poll
+ * mcp2515_get_mode to find out when the transition has completed.
+ * @param mode - one of the MCP2515_MODE values.
+ */
+void mcp2515_request_mode (uint8_t mode);
+
+/**
+ * Change the operation mode and confirm the transition.  If the chip is
+ * already in the requested mode, nothing is written.
+ * @param mode      - one of the MCP2515_MODE values.
+ * @param max_polls - Maximum number of additional CANSTAT reads to make
+ *                    while waiting for the transition.
+ * @return Nonzero if the MCP2515 reached the requested mode, zero if it
+ *         was still pending after max_polls reads.
+ */
+uint8_t mcp2515_change_mode (uint8_t mode, uint16_t max_polls);
+
+/**
+ * Forget all cached register values.  The driver keeps a copy of the
+ * configuration registers (CANCTRL, CNFx, CANINTE, masks and filters) so
+ * that redundant reads and writes can be skipped.  Call this if the chip
+ * may have been changed behind the driver's back, e.g. by a hardware
+ * reset or through the template driver in mcp2515_driver.h.
+ */
+void mcp2515_shadow_invalidate (void);
+
 /**
  * Reads a CAN message received by the MCP2515.
  * @param rx_buf - Receive buffer to read from.
@@ -69,7 +220,8 @@ void mcp2515_set_mode (uint8_t mode);
  * @param data   - Buffer to store the message data in; must have space for at
  *                 least n bytes.
  * @param len    - Pointer to the location to store the length of the received
- *                 message in.
+ *                 message in.  For a remote transmission request this is
+ *                 the requested length, and no data is read.
  * @return 0 if the message has a standard message ID, nonzero otherwise.
  */
 uint8_t mcp2515_get_msg (uint8_t rx_buf, uint32_t *id,
@@ -105,6 +257,126 @@ static inline void mcp2515_set_msg_ext (uint8_t tx_buf, uint32_t id,
     mcp2515_set_msg (tx_buf, id, data, len, 1);
 }
 
+/**
+ * Loads a remote transmission request into a transmit buffer of the
+ * MCP2515.
+ * @param tx_buf   - Transmit buffer to write to.
+ * @param id       - Message ID to request.
+ * @param len      - Number of data bytes requested.
+ * @param extended - Nonzero if id is an extended ID.
+ */
+void mcp2515_set_remote (uint8_t tx_buf, uint32_t id, uint8_t len,
+                                        uint8_t extended);
+
+/**
+ * Read a received message in register layout and mark it as read.  This
+ * is the fastest way to move a message, since it is not decoded.
+ * @param rx_buf - Receive buffer to read from.
+ * @param raw    - Buffer with space for MCP2515_RAW_SIZE bytes.
+ * @return The number of data bytes in the message.
+ */
+uint8_t mcp2515_read_raw (uint8_t rx_buf, uint8_t *raw);
+
+/**
+ * Load a message in register layout into a transmit buffer and request
+ * its transmission.
+ * @param tx_buf - Transmit buffer to write to; it must not have a
+ *                 transmission pending.
+ * @param raw    - Message as read by mcp2515_read_raw.
+ */
+void mcp2515_send_raw (uint8_t tx_buf, const uint8_t *raw);
+
+/**
+ * Decode the identifier of a message in register layout.
+ * @param raw - The message.
+ * @param id  - Pointer to the location to store the CAN message ID.
+ * @return 0 if the message has a standard message ID, nonzero otherwise.
+ */
+uint8_t mcp2515_raw_get_id (const uint8_t *raw, uint32_t *id);
+
+/**
+ * Check whether a received message in register layout is a remote
+ * transmission request.  Its data bytes are not valid.
+ * @param raw - The message.
+ * @return Nonzero for a remote transmission request.
+ */
+uint8_t mcp2515_raw_is_remote (const uint8_t *raw);
+
+/**
+ * Replace the identifier of a message in register layout.
+ * @param raw      - The message.
+ * @param id       - New message ID.
+ * @param extended - Nonzero if the new ID is an extended ID.
+ */
+void mcp2515_raw_set_id (uint8_t *raw, uint32_t id, uint8_t extended);
+
+/**
+ * Read the status of the receive and transmit buffers in a single short
+ * transaction.
+ * @return The READ STATUS byte; see the MCP2515_STATUS bits.
+ */
+uint8_t mcp2515_read_status (void);
+
+/**
+ * Read which receive buffers hold messages and which filter they matched.
+ * @return The RX STATUS byte; see the MCP2515_RXSTATUS bits.
+ */
+uint8_t mcp2515_rx_status (void);
+
+/**
+ * Find a transmit buffer that has no transmission pending and is not
+ * reserved.
+ * @return The number of the buffer, or -1 if all buffers are busy.
+ */
+int8_t mcp2515_free_tx_buf (void);
+
+/**
+ * Reserve transmit buffers of the current device, so that
+ * mcp2515_free_tx_buf never returns them.
+ * @param mask - Bit n reserves TXBn; 0 releases them all.
+ */
+void mcp2515_reserve_tx (uint8_t mask);
+
+/**
+ * Count the loads into a transmit buffer of the current device.  The
+ * count changes whenever a message is loaded through this driver, so the
+ * owner of a buffer can tell whether it still holds its message.
+ * @param tx_buf - The number of the TX buffer.
+ * @return The count, which wraps around.
+ */
+uint8_t mcp2515_tx_loads (uint8_t tx_buf);
+
+/**
+ * Set the slave select line of a device.  Device 0 uses the default slave
+ * select line unless it is attached to another one.
+ * @param dev - Device number, less than MCP2515_MAX_DEVICES.
+ * @param ss  - Slave select line.  On the Arduino this is a pin number.
+ */
+void mcp2515_attach (uint8_t dev, uint8_t ss);
+
+/**
+ * Choose the device addressed by all other driver functions.
+ * @param dev - Device number, less than MCP2515_MAX_DEVICES.
+ */
+void mcp2515_select (uint8_t dev);
+
+/**
+ * @return The number of the device currently being addressed.
+ */
+uint8_t mcp2515_selected (void);
+
+/**
+ * Abort the pending transmission of one transmit buffer by clearing its
+ * TXREQ bit; the other buffers are left alone.  A message that is
+ * already being transmitted is completed or fails first.  ABTF in the
+ * buffer's control register tells whether it was aborted.
+ * @param tx_buf    - The number of the TX buffer.
+ * @param max_polls - Maximum number of additional status reads to make
+ *                    while waiting for the buffer to clear.
+ * @return Nonzero if its transmission is no longer pending.
+ */
+uint8_t mcp2515_abort_tx (uint8_t tx_buf, uint16_t max_polls);
+
 /**
  * Reqest transmission of a message
  * @param tx_buf - The number of the TX buffer to be transmitted.
@@ -125,6 +397,12 @@ uint8_t mcp2515_msg_received (void);
  */
 uint8_t mcp2515_msg_sent (void);
 
+/**
+ * Clear interrupt flags
+ * @param flags - The CANINTF bits to clear
+ */
+void mcp2515_clear_int (uint8_t flags);
+
 /**
  * Set a receive mask on the MCP2515.  See MCP2515 documentation for details.
  * @param mask_num  - The number of the mask to be set.
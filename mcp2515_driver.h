@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2010-2011 by Kevin Smith <faz@fazjaxton.net>
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 3
+ * as published by the Free Software Foundation.
+ */
+
+#ifndef __MCP2515_DRIVER_H__
+#define __MCP2515_DRIVER_H__
+
+/**
+ * @file mcp2515_driver.h
+ * MCP2515 driver core as a C++ template.  The template is parameterized
+ * on an SPI policy and a slave select policy, and every function is
+ * inline, so with a policy that writes the SPI and port registers
+ * directly each register access compiles down to a few instructions.
+ * Identifiers that are constant at compile time are encoded into
+ * register layout by the compiler.
+ *
+ * The plain functions in mcp2515.h are built on an instantiation with
+ * the default policies, which address the device chosen with
+ * mcp2515_select through spi_transfer and the slave select functions of
+ * my_spi.h.  That keeps one copy of each SPI transaction but is no faster
+ * than before: on the Arduino the slave select still goes through
+ * digitalWrite.  The speedup needs a direct port policy, as below.
+ * Unlike the plain functions, the template has no register shadow; every
+ * call goes to the chip.
+ *
+ * The two can share a device, but the plain functions' shadow does not
+ * see the template's writes.  Use the template for transmit buffers and
+ * status, which are not shadowed, and change the configuration (mode,
+ * masks, filters, bit timing, interrupt enables) through only one of the
+ * two.  After configuring a device through the template, call
+ * mcp2515_shadow_invalidate with the device selected before using the
+ * plain functions on it again.
+ *
+ * A policy for a device whose slave select is on Arduino pin 10 (PB2):
+ * ~~~~~{c}
+ * typedef Mcp2515Driver<Mcp2515SpiAvr, Mcp2515SsPortB<2> > Can0;
+ *
+ * Can0::setFilter (0, 0x123, 0);
+ * Can0::send (0, 0x321, 0, data, 8);
+ * ~~~~~
+ */
+
+#include <stdint.h>
+
+#if defined(__AVR__)
+#include <avr/io.h>
+#endif
+
+#include "mcp2515.h"
+#include "mcp2515_regs.h"
+#include "my_spi.h"
+
+/** SPI policy using spi_transfer from my_spi.h */
+struct Mcp2515SpiDefault {
+    static inline uint8_t transfer (uint8_t byte)
+    {
+        return spi_transfer (byte);
+    }
+};
+
+/** Slave select policy using the line chosen with mcp2515_select */
+struct Mcp2515SsSelected {
+    static inline void begin (void)
+    {
+        assert_ss ();
+    }
+
+    static inline void end (void)
+    {
+        deassert_ss ();
+    }
+};
+
+#if ARDUINO
+/** Slave select policy for a fixed Arduino pin, using digitalWrite */
+template <uint8_t Pin>
+struct Mcp2515SsPin {
+    static inline void begin (void)
+    {
+        digitalWrite (Pin, LOW);
+    }
+
+    static inline void end (void)
+    {
+        digitalWrite (Pin, HIGH);
+    }
+};
+#endif
+
+#if defined(SPDR)
+/**
+ * SPI policy driving the AVR SPI peripheral registers directly.  The
+ * peripheral must already be set up, e.g. by SPI.begin or init_spi.
+ */
+struct Mcp2515SpiAvr {
+    static inline uint8_t transfer (uint8_t byte)
+    {
+        SPDR = byte;
+        while (!(SPSR & (1 << SPIF)))
+            ;
+
+        return SPDR;
+    }
+};
+#endif
+
+/**
+ * Define a slave select policy for a bit of an AVR I/O port.  Each
+ * assertion compiles to a single cbi or sbi instruction.
+ */
+#define MCP2515_SS_PORT(name, port)                         \
+    template <uint8_t Bit>                                  \
+    struct name {                                           \
+        static inline void begin (void)                     \
+        {                                                   \
+            port &= (uint8_t)~(1 << Bit);                   \
+        }                                                   \
+                                                            \
+        static inline void end (void)                       \
+        {                                                   \
+            port |= (uint8_t)(1 << Bit);                    \
+        }                                                   \
+    }
+
+#if defined(PORTB)
+MCP2515_SS_PORT (Mcp2515SsPortB, PORTB);
+#endif
+#if defined(PORTC)
+MCP2515_SS_PORT (Mcp2515SsPortC, PORTC);
+#endif
+#if defined(PORTD)
+MCP2515_SS_PORT (Mcp2515SsPortD, PORTD);
+#endif
+
+/**
+ * MCP2515 driver core.
+ * @param Spi - SPI policy with a static transfer (byte) function.
+ * @param Ss  - Slave select policy with static begin () and end ()
+ *              functions that assert and deassert the slave select line.
+ */
+template <class Spi, class Ss>
+class Mcp2515Driver {
+    public:
+        /** @see mcp2515_read_regs */
+        static inline void readRegs (uint8_t addr, uint8_t *buf, uint8_t n)
+        {
+            uint8_t i;
+
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_READ);
+            Spi::transfer (addr);
+            for (i = 0; i < n; i++)
+                buf[i] = Spi::transfer (0);
+            Ss::end ();
+        }
+
+        /** Read a single register */
+        static inline uint8_t readReg (uint8_t addr)
+        {
+            uint8_t val;
+
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_READ);
+            Spi::transfer (addr);
+            val = Spi::transfer (0);
+            Ss::end ();
+
+            return val;
+        }
+
+        /** @see mcp2515_write_regs */
+        static inline void writeRegs (uint8_t addr, const uint8_t *buf,
+                                      uint8_t n)
+        {
+            uint8_t i;
+
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_WRITE);
+            Spi::transfer (addr);
+            for (i = 0; i < n; i++)
+                Spi::transfer (buf[i]);
+            Ss::end ();
+        }
+
+        /** Write a single register */
+        static inline void writeReg (uint8_t addr, uint8_t val)
+        {
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_WRITE);
+            Spi::transfer (addr);
+            Spi::transfer (val);
+            Ss::end ();
+        }
+
+        /** Change the bits of a register selected by mask */
+        static inline void bitModify (uint8_t addr, uint8_t mask,
+                                      uint8_t bits)
+        {
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_BIT_MODIFY);
+            Spi::transfer (addr);
+            Spi::transfer (mask);
+            Spi::transfer (bits);
+            Ss::end ();
+        }
+
+        /** Send the RESET instruction */
+        static inline void reset (void)
+        {
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_RESET);
+            Ss::end ();
+        }
+
+        /** @see mcp2515_read_status */
+        static inline uint8_t readStatus (void)
+        {
+            return status (MCP2515_CMD_READ_STATUS);
+        }
+
+        /** @see mcp2515_rx_status */
+        static inline uint8_t rxStatus (void)
+        {
+            return status (MCP2515_CMD_RX_STATUS);
+        }
+
+        /** @see mcp2515_request_mode */
+        static inline void setMode (uint8_t mode)
+        {
+            bitModify (CANCTRL, REQOP_MASK, mode << REQOP);
+        }
+
+        /** @see mcp2515_get_mode */
+        static inline uint8_t getMode (void)
+        {
+            return (readReg (CANSTAT) & OPMOD_MASK) >> OPMOD;
+        }
+
+        /** @see mcp2515_encode_id */
+        static inline void encodeId (uint32_t id, uint8_t extended,
+                                     uint8_t *buf)
+        {
+            mcp2515_encode_id (id, extended, buf);
+        }
+
+        /** @see mcp2515_set_rx_mask */
+        static inline void setMask (uint8_t mask_num, uint32_t mask,
+                                    uint8_t extended)
+        {
+            uint8_t buf[4];
+
+            encodeId (mask, extended, buf);
+            buf[1] &= ~(1 << EXIDE);
+
+            writeRegs (mask_num ? RXM1SIDH : RXM0SIDH, buf, 4);
+        }
+
+        /** @see mcp2515_set_rx_filter */
+        static inline void setFilter (uint8_t filter_num, uint32_t filter,
+                                      uint8_t extended)
+        {
+            uint8_t buf[4];
+            uint8_t reg = filter_num * 4;
+
+            if (reg >= 12)
+                reg += 4;
+
+            encodeId (filter, extended, buf);
+
+            writeRegs (reg, buf, 4);
+        }
+
+        /** @see mcp2515_read_raw */
+        static inline uint8_t readRx (uint8_t rx_buf, uint8_t *raw)
+        {
+            uint8_t i;
+            uint8_t len;
+
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_READ_RX | (rx_buf << 2));
+            for (i = 0; i < 5; i++)
+                raw[i] = Spi::transfer (0);
+
+            len = raw[4] & 0x0f;
+            if (len > 8)
+                len = 8;
+
+            for (i = 0; i < len; i++)
+                raw[5 + i] = Spi::transfer (0);
+            Ss::end ();
+
+            return len;
+        }
+
+        /** Load a message in register layout into a transmit buffer */
+        static inline void loadTx (uint8_t tx_buf, const uint8_t *raw)
+        {
+            uint8_t i;
+            uint8_t n;
+
+            n = 5 + (raw[4] & 0x0f);
+            if (n > MCP2515_RAW_SIZE)
+                n = MCP2515_RAW_SIZE;
+
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_LOAD_TX | (tx_buf << 1));
+            for (i = 0; i < n; i++)
+                Spi::transfer (raw[i]);
+            Ss::end ();
+        }
+
+        /**
+         * Load a message into a transmit buffer in one transaction.
+         * @see mcp2515_set_msg
+         */
+        static inline void loadTx (uint8_t tx_buf, uint32_t id,
+                                   uint8_t extended, const uint8_t *data,
+                                   uint8_t len)
+        {
+            uint8_t buf[4];
+            uint8_t i;
+
+            encodeId (id, extended, buf);
+
+            if (len > 8)
+                len = 8;
+
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_LOAD_TX | (tx_buf << 1));
+            for (i = 0; i < 4; i++)
+                Spi::transfer (buf[i]);
+            Spi::transfer (len << DLC0);
+            for (i = 0; i < len; i++)
+                Spi::transfer (data[i]);
+            Ss::end ();
+        }
+
+        /** Request transmission of a transmit buffer with RTS */
+        static inline void requestToSend (uint8_t tx_buf)
+        {
+            Ss::begin ();
+            Spi::transfer (MCP2515_CMD_RTS | (1 << tx_buf));
+            Ss::end ();
+        }
+
+        /** Load a message into a transmit buffer and send it */
+        static inline void send (uint8_t tx_buf, uint32_t id,
+                                 uint8_t extended, const uint8_t *data,
+                                 uint8_t len)
+        {
+            loadTx (tx_buf, id, extended, data, len);
+            requestToSend (tx_buf);
+        }
+
+    private:
+        static inline uint8_t status (uint8_t cmd)
+        {
+            uint8_t val;
+
+            Ss::begin ();
+            Spi::transfer (cmd);
+            val = Spi::transfer (0);
+            Ss::end ();
+
+            return val;
+        }
+};
+
+#endif
@@ -9,15 +9,36 @@
 #ifndef __MCP2515_REGS__
 #define __MCP2515_REGS__
 
+#include <stdint.h>
+
 /* Defines a field mask of width w */
 #define FIELD_MASK(w)   ((1 << w) - 1)
 
+/* SPI Commands */
+enum {
+    MCP2515_CMD_RESET       = 0xC0,
+    MCP2515_CMD_READ        = 0x03,
+    MCP2515_CMD_WRITE       = 0x02,
+    MCP2515_CMD_RTS         = 0x80,
+    MCP2515_CMD_READ_STATUS = 0xA0,
+    MCP2515_CMD_BIT_MODIFY  = 0x05,
+    MCP2515_CMD_READ_RX     = 0x90,
+    MCP2515_CMD_LOAD_TX     = 0x40,
+    MCP2515_CMD_RX_STATUS   = 0xB0,
+};
+
 /* Registers and bits */
 #define RXM0SIDH    0x20
 #define RXM1SIDH    0x24
 
+#define BFPCTRL     0x0C
+#define TXRTSCTRL   0x0D
+#define TEC         0x1C
+#define REC         0x1D
+
 #define CANSTAT     0x0E
 #define OPMOD       5
+#define OPMOD_MASK  (FIELD_MASK(3) << OPMOD)
 #define ICOD        1
 
 #define CANCTRL     0x0F
@@ -41,6 +62,16 @@
 #define BRP         0
 #define SJW         6
 
+#define CANINTE     0x2B
+#define MERRE       7
+#define WAKIE       6
+#define ERRIE       5
+#define TX2IE       4
+#define TX1IE       3
+#define TX0IE       2
+#define RX1IE       1
+#define RX0IE       0
+
 #define CANINTF     0x2C
 #define MERRF       7
 #define WAKIF       6
@@ -51,6 +82,16 @@
 #define RX1IF       1
 #define RX0IF       0
 
+#define EFLG        0x2D
+#define RX1OVR      7
+#define RX0OVR      6
+#define TXBO        5
+#define TXEP        4
+#define RXEP        3
+#define TXWAR       2
+#define RXWAR       1
+#define EWARN       0
+
 /**
  * For registers that are duplicated across multiple RX and TX buffers,
  * use the REG macro.
@@ -100,6 +141,7 @@
 #define FILHIT0     0
 
 /* RXB SIDL bits */
+#define SRR         4
 #define IDE         3
 
 /* RX DLC bits */
@@ -107,4 +149,30 @@
 #define RB          4
 // #define DLC0 0  // Duplicate of TX
 
+/**
+ * Encode a CAN identifier into the SIDH, SIDL, EID8 and EID0 register
+ * layout shared by the transmit buffers, masks and filters.
+ * @param id       - The identifier to encode
+ * @param extended - Nonzero to encode a 29-bit identifier.  The EXIDE bit
+ *                   is set for extended identifiers.
+ * @param buf      - Buffer with space for four registers
+ */
+static inline void mcp2515_encode_id (uint32_t id, uint8_t extended,
+                                      uint8_t *buf)
+{
+    if (extended) {
+        buf[0] = (uint8_t)(id >> 21);
+        buf[1] = (uint8_t)(((id >> 13) & 0xE0) |
+                (1 << EXIDE) |
+                ((id >> 16) & 0x03));
+        buf[2] = (uint8_t)(id >> 8);
+        buf[3] = (uint8_t)(id);
+    } else {
+        buf[0] = (uint8_t)(id >> 3);
+        buf[1] = (uint8_t)(id << 5);
+        buf[2] = 0;
+        buf[3] = 0;
+    }
+}
+
 #endif
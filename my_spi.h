@@ -19,19 +19,38 @@
 #endif
 
 
+/**
+ * Slave select line of the device currently being addressed.  On the
+ * Arduino this is a pin number; otherwise it is a bit number in PORTB.
+ */
+extern uint8_t spi_ss;
+
 #if ARDUINO
 const int slaveSelectPin = 10;
 
+/** Slave select line used until another one is selected */
+#define SPI_DEFAULT_SS      slaveSelectPin
+
 /** Assert the slave select signal */
 static inline void assert_ss (void)
 {
-    digitalWrite (slaveSelectPin, LOW);
+    digitalWrite (spi_ss, LOW);
 }
 
 /** Deassert the slave select signal */
 static inline void deassert_ss (void)
 {
-    digitalWrite (slaveSelectPin, HIGH);
+    digitalWrite (spi_ss, HIGH);
+}
+
+/**
+ * Configure a slave select line as an output and deassert it.
+ * @param ss - The slave select line
+ */
+static inline void init_ss (uint8_t ss)
+{
+    digitalWrite (ss, HIGH);
+    pinMode (ss, OUTPUT);
 }
 
 /**
@@ -46,9 +65,18 @@ static uint8_t spi_transfer (uint8_t byte)
 
 #else
 
+/** Slave select line used until another one is selected (PB2) */
+#define SPI_DEFAULT_SS      2
+
 /** Initialize the SPI */
 void init_spi (void);
 
+/**
+ * Configure a slave select line as an output and deassert it.
+ * @param ss - The slave select line
+ */
+void init_ss (uint8_t ss);
+
 /** Assert the slave select signal */
 void assert_ss (void);
 
@@ -64,6 +92,15 @@ uint8_t spi_transfer (uint8_t byte);
 
 #endif
 
+/**
+ * Address a different device on the bus.
+ * @param ss - The slave select line of the device
+ */
+static inline void select_ss (uint8_t ss)
+{
+    spi_ss = ss;
+}
+
 /** Convenience function for sending a byte and ignoring the receive value */
 static inline void spi_send (uint8_t byte)
 {
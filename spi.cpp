@@ -8,13 +8,16 @@
 
 #include "my_spi.h"
 
-/* Don't build this file if for the Arduino */
+uint8_t spi_ss = SPI_DEFAULT_SS;
+
+/* Don't build the rest of this file if for the Arduino */
 #if ! ARDUINO
 
 #include <avr/io.h>
 
 #define SS_PORT     (PORTB)
-#define SS_PIN      (1 << PORTB2)
+#define SS_DDR      (DDRB)
+#define SS_PIN      (1 << spi_ss)
 
 enum {
     SPI_MODE_0 = 0x0,
@@ -39,6 +42,12 @@ void deassert_ss (void)
     SS_PORT |= SS_PIN;
 }
 
+void init_ss (uint8_t ss)
+{
+    SS_PORT |= (1 << ss);
+    SS_DDR |= (1 << ss);
+}
+
 uint8_t spi_transfer (uint8_t byte)
 {
     SPDR = byte;